@@ -0,0 +1,193 @@
+//
+// bench.c
+// benchmark reports
+//
+// A benchmark replays a recording as fast as possible, and collects the CPU
+// and GPU time of each frame, and the time taken by each command. Reports
+// are written as JSON, with the 50th, 95th and 99th percentile and the
+// maximum of each measurement, eg.
+//
+//     {
+//       "recording": "paint.rec",
+//       "elapsed": 1.234,
+//       "cpu": { "count": 600, "p50": 1.2, "p95": 2.5, "p99": 4.1, "max": 9.8 },
+//       ...
+//     }
+//
+// and can be compared against a baseline report. Only percentiles are
+// compared, as the maximum is too noisy to tell regressions apart.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "util.h"
+#include "bench.h"
+
+static const char *metrics[]     = { "cpu", "gpu", "command" };
+static const char *percentiles[] = { "p50", "p95", "p99" };
+
+void samples_add(struct samples *s, double v)
+{
+	if (s->len == s->cap) {
+		s->cap    = s->cap ? s->cap * 2 : 1024;
+		s->values = realloc(s->values, sizeof(*s->values) * s->cap);
+	}
+	s->values[s->len ++] = v;
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a,
+	       y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Value below which `p` percent of the samples fall, with the nearest rank
+ * method. Sorts the samples. */
+double samples_percentile(struct samples *s, double p)
+{
+	if (s->len == 0)
+		return 0;
+
+	qsort(s->values, s->len, sizeof(*s->values), compare);
+
+	size_t rank = (size_t)ceil(p / 100.0 * (double)s->len);
+
+	return s->values[rank > 0 ? rank - 1 : 0];
+}
+
+void bench_init(struct bench *b, const char *recording)
+{
+	*b = (struct bench){ .recording = recording };
+}
+
+void bench_free(struct bench *b)
+{
+	free(b->cpu.values);
+	free(b->gpu.values);
+	free(b->commands.values);
+}
+
+static void bench_write_samples(FILE *fp, const char *name, struct samples *s, bool last)
+{
+	fprintf(fp, "  \"%s\": { \"count\": %zu, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+		name, s->len,
+		samples_percentile(s, 50), samples_percentile(s, 95), samples_percentile(s, 99),
+		samples_percentile(s, 100), last ? "" : ",");
+}
+
+/* Write a string as a JSON string literal, escaping what needs to be. */
+static void bench_write_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+
+	for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			fprintf(fp, "\\%c", *p);
+		else if (*p < 0x20)
+			fprintf(fp, "\\u%04x", *p);
+		else
+			fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+/* Write a report of the benchmark, as JSON. */
+bool bench_write(struct bench *b, const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (! fp)
+		return false;
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"recording\": ");
+	bench_write_string(fp, b->recording);
+	fprintf(fp, ",\n");
+	fprintf(fp, "  \"elapsed\": %.4f,\n", b->elapsed);
+
+	bench_write_samples(fp, "cpu",     &b->cpu,      false);
+	bench_write_samples(fp, "gpu",     &b->gpu,      false);
+	bench_write_samples(fp, "command", &b->commands, true);
+
+	fprintf(fp, "}\n");
+
+	return fclose(fp) == 0;
+}
+
+/* Find a value of a report, eg. `p95` of `cpu`. Only reports written by
+ * `bench_write` need to be understood. */
+static bool report_value(const char *json, const char *metric, const char *key, double *v)
+{
+	char        name[32];
+	const char *p, *end;
+
+	snprintf(name, sizeof(name), "\"%s\":", metric);
+
+	if (! (p = strstr(json, name)) || ! (end = strchr(p, '}')))
+		return false;
+
+	snprintf(name, sizeof(name), "\"%s\":", key);
+
+	if (! (p = strstr(p, name)) || p > end)
+		return false;
+
+	*v = strtod(p + strlen(name), NULL);
+
+	return true;
+}
+
+static char *report_read(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+
+	if (! fp)
+		return NULL;
+	fclose(fp);
+
+	return readfile(path);
+}
+
+/* Compare a report against a baseline report, printing the difference of
+ * each percentile. A percentile regresses if it's more than `threshold`
+ * percent above the baseline. Returns the number of regressions, or -1 if
+ * either report can't be read. */
+int bench_compare(const char *path, const char *baseline, double threshold)
+{
+	char *cur  = report_read(path),
+	     *base = report_read(baseline);
+	int   regressions = 0;
+
+	if (! cur || ! base) {
+		errorf("bench", "couldn't read report '%s'", cur ? baseline : path);
+		free(cur);
+		free(base);
+		return -1;
+	}
+	for (size_t i = 0; i < elems(metrics); i++) {
+		for (size_t j = 0; j < elems(percentiles); j++) {
+			double now, was;
+
+			if (! report_value(cur, metrics[i], percentiles[j], &now) ||
+			    ! report_value(base, metrics[i], percentiles[j], &was))
+				continue;
+
+			double change     = was > 0 ? (now - was) / was * 100.0 : 0;
+			bool   regression = change > threshold;
+
+			printf("%-8s %s  %8.3fms  %8.3fms  %+6.1f%%%s\n",
+				metrics[i], percentiles[j], was, now, change, regression ? "  REGRESSION" : "");
+
+			regressions += regression;
+		}
+	}
+	free(cur);
+	free(base);
+
+	return regressions;
+}
@@ -0,0 +1,26 @@
+//
+// bench.h
+// benchmark reports
+//
+#define BENCH_THRESHOLD  10.0       /* Default regression threshold, in percent */
+
+/* Measurements of one kind, in milliseconds. */
+struct samples {
+	double          *values;
+	size_t           len, cap;
+};
+
+struct bench {
+	const char      *recording;
+	struct samples   cpu;       /* CPU time of each frame */
+	struct samples   gpu;       /* GPU time of each frame */
+	struct samples   commands;  /* Time taken by each command played */
+	double           elapsed;   /* Total time, in seconds */
+};
+
+void             samples_add(struct samples *, double);
+double           samples_percentile(struct samples *, double);
+void             bench_init(struct bench *, const char *);
+void             bench_free(struct bench *);
+bool             bench_write(struct bench *, const char *);
+int              bench_compare(const char *, const char *, double);
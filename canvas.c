@@ -0,0 +1,1296 @@
+//
+// canvas.c
+// sparse pixel storage of a view, split into frames and tiles
+//
+// Each frame is divided into a grid of tiles, and each tile which was ever
+// written to is stored in its own layer of a single array texture. Empty
+// tiles take no storage, and read as transparent. Which layer holds which
+// tile is kept in `tiles`, so that frames can be added, removed and
+// reordered without touching the pixels of the other frames.
+//
+// Tiles are addressed in "strip coordinates", where the frames are laid out
+// side by side, and `y` is the texel row.
+//
+// Each layer also has a few mip levels, used to draw the canvas zoomed out.
+// Writing to a tile marks its layer as stale, and only stale layers have
+// their mip levels regenerated, by the caller.
+//
+// At most `TILE_RESIDENT` tiles are kept in the texture. When it's full, the
+// least recently used tile is paged out to host memory, and paged back in
+// when it's next drawn or drawn into. Tiles used since `canvas_pin` aren't
+// paged out, so that a frame can't evict the tiles it's drawing. If a tile
+// can't be made resident, `failed` is set for the caller to report. Tiles
+// paged in keep their page until they're written to, so that paging them
+// back out doesn't need to read them back.
+//
+// Every tile also has a low resolution copy of its lowest mip level, in a
+// cell of the `lowres` texture, which packs many cells per layer and is
+// never paged out. Zoomed all the way out, tiles are drawn from their copy,
+// so that any number of them can be shown at once. Otherwise, tiles which
+// can't be made resident, or whose mip levels are out of date, are drawn
+// from their copy instead. A copy is up to date, unless its tile is
+// resident and its layer is stale.
+//
+#include <GL/glew.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "linmath.h"
+#include "color.h"
+#include "texture.h"
+#include "assert.h"
+#include "gl.h"
+#include "trace.h"
+#include "canvas.h"
+#include "util.h"
+
+#define PAGED(layer)   ((layer) < -1)
+#define PAGE(layer)    (-2 - (layer))
+
+static unsigned long uses   = 0;           /* Ticks on every use of a layer */
+static unsigned long pinned = ULONG_MAX;   /* Layers used since can't be paged out */
+
+/* Get the number of layers an array texture can have. */
+static int gl_max_layers(void)
+{
+	GLint layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &layers);
+
+	return layers;
+}
+
+/* Get the number of layers a canvas texture can have. */
+static int canvas_max_layers(void)
+{
+	return min(gl_max_layers(), TILE_RESIDENT);
+}
+
+static GLuint canvas_texture(int w, int h, int layers, int levels, GLenum format)
+{
+	GLuint t;
+
+	glGenTextures(1, &t);
+	gl_bind_texture_array(0, t);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+	for (int l = 0; l < levels; l++) {
+		glTexImage3D(
+			GL_TEXTURE_2D_ARRAY,
+			l,                    // Mipmap level
+			(GLint)format,        // Internal texel format
+			max(w >> l, 1),       // Width, height & number of layers
+			max(h >> l, 1),
+			layers,
+			0,                    // Should always be 0
+			GL_RGBA,              // Texel format of array
+			GL_UNSIGNED_BYTE,     // Data type of the components
+			NULL                  // Data
+		);
+	}
+	return t;
+}
+
+/* Attach a layer of the texture `t` to the canvas framebuffer, and bind it.
+ * `t` is either the canvas texture, or one that is about to replace it. */
+static void canvas_attach(struct canvas *c, GLuint t, int layer)
+{
+	gl_bind_framebuffer(c->fb);
+
+	if (t == c->handle && layer == c->attached)
+		return;
+
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, t, 0, layer);
+	c->attached = t == c->handle ? layer : -1;
+}
+
+static void canvas_use(struct canvas *c, int layer)
+{
+	c->used[layer] = ++ uses;
+}
+
+/* Store pixels as a page, reusing a free slot. Returns the page. */
+static int canvas_page(struct canvas *c, rgba_t *pixels)
+{
+	int p = 0;
+
+	while (p < c->npages && c->pages[p])
+		p ++;
+
+	if (p == c->npages) {
+		c->pages = realloc(c->pages, sizeof(*c->pages) * (size_t)++ c->npages);
+	}
+	c->pages[p] = pixels;
+
+	return p;
+}
+
+static void canvas_page_free(struct canvas *c, int p)
+{
+	free(c->pages[p]);
+	c->pages[p] = NULL;
+}
+
+static rgba_t *canvas_page_alloc(struct canvas *c)
+{
+	return calloc((size_t)(c->tw * c->th), sizeof(rgba_t));
+}
+
+/* Read a whole layer back into host memory. */
+static rgba_t *canvas_read_layer(struct canvas *c, int layer)
+{
+	rgba_t *pixels = canvas_page_alloc(c);
+
+	canvas_attach(c, c->handle, layer);
+	trace_begin("gl", "glReadPixels");
+	glReadPixels(0, 0, c->tw, c->th, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	trace_end("gl", "glReadPixels");
+	gl_stats.readbacks ++;
+
+	return pixels;
+}
+
+/* Copy the attached layer into a layer of the array texture `t`. */
+static void canvas_copy_layer(GLuint t, int layer, int w, int h)
+{
+	gl_bind_texture_array(0, t);
+	glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, w, h);
+}
+
+/* Mark the layers in the range `[from, to)` as unused, lowest first. */
+static void canvas_release_layers(struct canvas *c, int from, int to)
+{
+	for (int l = to - 1; l >= from; l--)
+		c->unused[c->nunused ++] = l;
+}
+
+static void canvas_stale_layer(struct canvas *c, int layer)
+{
+	if (! c->stale[layer]) {
+		c->stale[layer] = true;
+		c->nstale ++;
+	}
+}
+
+/* Mark a layer as written to. Its mip levels are then out of date, and so
+ * is the page it was paged in from, if it was kept. */
+static void canvas_dirty_layer(struct canvas *c, int layer)
+{
+	canvas_stale_layer(c, layer);
+
+	if (c->kept[layer] >= 0) {
+		canvas_page_free(c, c->kept[layer]);
+		c->kept[layer] = -1;
+	}
+}
+
+/* Mark a layer as unused, dropping the page it was paged in from. */
+static void canvas_release_layer(struct canvas *c, int layer)
+{
+	if (c->kept[layer] >= 0) {
+		canvas_page_free(c, c->kept[layer]);
+		c->kept[layer] = -1;
+	}
+	c->unused[c->nunused ++] = layer;
+}
+
+/* Get the origin of a cell within its layer of the low resolution texture. */
+static void canvas_cell_origin(struct canvas *c, int cell, int *x, int *y)
+{
+	int i      = cell % c->ncells,
+	    across = c->tw / c->cw;
+
+	*x = (i % across) * c->cw;
+	*y = (i / across) * c->ch;
+}
+
+/* Double the number of layers of the low resolution texture, making their
+ * cells available. Returns false if it can't grow any further. */
+static bool canvas_grow_lowres(struct canvas *c)
+{
+	int limit = gl_max_layers();
+
+	if (c->lowcap >= limit)
+		return false;
+
+	int    cap = min(max(c->lowcap * 2, 1), limit);
+	GLuint t   = canvas_texture(c->tw, c->th, cap, 1, c->format);
+
+	for (int l = 0; l < c->lowcap; l++) {
+		canvas_attach(c, c->lowres, l);
+		canvas_copy_layer(t, l, c->tw, c->th);
+	}
+	if (c->lowres)
+		gl_delete_texture(c->lowres);
+
+	c->lowres    = t;
+	c->freecells = realloc(c->freecells, sizeof(*c->freecells) * (size_t)(cap * c->ncells));
+
+	/* Cells are handed out lowest first. */
+	for (int i = cap * c->ncells - 1; i >= c->lowcap * c->ncells; i--)
+		c->freecells[c->nfreecells ++] = i;
+
+	c->lowcap = cap;
+
+	return true;
+}
+
+/* Give the tile at index `i` of `tiles` a cell for its low resolution copy.
+ * It's left without one if tiles don't have copies, or there's no room. */
+static void canvas_alloc_cell(struct canvas *c, int i)
+{
+	c->cells[i] = -1;
+
+	if (c->cw == 0 || (c->nfreecells == 0 && ! canvas_grow_lowres(c)))
+		return;
+
+	c->cells[i] = c->freecells[-- c->nfreecells];
+}
+
+static void canvas_free_cell(struct canvas *c, int i)
+{
+	if (c->cells[i] >= 0)
+		c->freecells[c->nfreecells ++] = c->cells[i];
+
+	c->cells[i] = -1;
+}
+
+/* Average a 2x2 block of texels, the way mip levels are generated. Colors
+ * are weighted by their alpha. */
+static rgba_t texel_average(const rgba_t *p, int stride)
+{
+	const rgba_t q[] = { p[0], p[1], p[stride], p[stride + 1] };
+	float        r   = 0.f, g = 0.f, b = 0.f, a = 0.f;
+
+	for (size_t i = 0; i < elems(q); i++) {
+		float w = q[i].a / 255.f;
+
+		r += q[i].r * w;
+		g += q[i].g * w;
+		b += q[i].b * w;
+		a += w;
+	}
+	if (a == 0.f)
+		return RGBA_TRANSPARENT;
+
+	return rgba((uint8_t)(r / a + .5f), (uint8_t)(g / a + .5f), (uint8_t)(b / a + .5f),
+	            (uint8_t)(a / 4.f * 255.f + .5f));
+}
+
+/* Update the low resolution copy of the tile at index `i` from its pixels in
+ * host memory, by generating its mip levels. Indices can't be averaged, so
+ * the levels of indexed canvases are point sampled. */
+static void canvas_update_cell(struct canvas *c, int i, const rgba_t *page)
+{
+	if (c->cells[i] < 0)
+		return;
+
+	int           w   = c->tw,
+	              h   = c->th,
+	              x, y;
+	rgba_t       *buf = malloc(sizeof(*buf) * (size_t)((w / 2) * (h / 2)));
+	const rgba_t *src = page;
+
+	/* Each level is smaller than the one above, so they can all be
+	 * generated in the same buffer. */
+	for (int l = 0; l < TILE_LOWRES; l++) {
+		for (y = 0; y < h / 2; y++) {
+			for (x = 0; x < w / 2; x++) {
+				const rgba_t *p = src + 2 * y * w + 2 * x;
+
+				buf[y * (w / 2) + x] = c->format == GL_R8 ? *p : texel_average(p, w);
+			}
+		}
+		src = buf;
+		w  /= 2;
+		h  /= 2;
+	}
+	canvas_cell_origin(c, c->cells[i], &x, &y);
+
+	gl_bind_texture_array(0, c->lowres);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, c->cells[i] / c->ncells,
+		c->cw, c->ch, 1, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+	gl_stats.uploads ++;
+
+	free(buf);
+}
+
+/* Copy the lowest mip level of a layer into the cell of the tile at index
+ * `i`, as its low resolution copy. */
+static void canvas_copy_cell(struct canvas *c, int i, int layer)
+{
+	int x, y;
+
+	if (c->cells[i] < 0)
+		return;
+
+	canvas_cell_origin(c, c->cells[i], &x, &y);
+
+	gl_bind_framebuffer(c->fb);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, c->handle, TILE_LOWRES, layer);
+	c->attached = -1;
+
+	gl_bind_texture_array(0, c->lowres);
+	glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, c->cells[i] / c->ncells, 0, 0, c->cw, c->ch);
+}
+
+/* Set up the tile grid for the given frame size. Frames smaller than a tile
+ * are stored in a single tile of their own size. */
+static void canvas_grid(struct canvas *c, int w, int h)
+{
+	c->w      = w;
+	c->h      = h;
+	c->tw     = min(w, TILE_SIZE);
+	c->th     = min(h, TILE_SIZE);
+	c->cols   = (w + c->tw - 1) / c->tw;
+	c->rows   = (h + c->th - 1) / c->th;
+	c->ntiles = c->cols * c->rows;
+	c->levels = 1;
+
+	/* Levels stop at one texel in either direction. */
+	while (c->levels < TILE_LEVELS && (min(c->tw, c->th) >> c->levels) > 0)
+		c->levels ++;
+
+	/* Only tiles with all their levels have low resolution copies. */
+	c->cw     = c->levels == TILE_LEVELS ? c->tw >> TILE_LOWRES : 0;
+	c->ch     = c->levels == TILE_LEVELS ? c->th >> TILE_LOWRES : 0;
+	c->ncells = c->cw ? (c->tw / c->cw) * (c->th / c->ch) : 0;
+}
+
+static void canvas_reserve_tiles(struct canvas *c, int nframes)
+{
+	int n = nframes * c->ntiles;
+
+	if (n <= c->tilescap)
+		return;
+
+	c->tilescap = max(n, c->tilescap * 2);
+	c->tiles    = realloc(c->tiles, sizeof(*c->tiles) * (size_t)c->tilescap);
+	c->cells    = realloc(c->cells, sizeof(*c->cells) * (size_t)c->tilescap);
+}
+
+/* Move the frame at position `from` of an array stored like `tiles` to
+ * position `to`. */
+static void canvas_move_frame(struct canvas *c, int *frames, int from, int to)
+{
+	size_t size  = sizeof(*frames) * (size_t)c->ntiles;
+	int   *tiles = malloc(size);
+
+	memcpy(tiles, frames + from * c->ntiles, size);
+
+	if (from < to) {
+		memmove(frames + from * c->ntiles, frames + (from + 1) * c->ntiles, size * (size_t)(to - from));
+	} else {
+		memmove(frames + (to + 1) * c->ntiles, frames + to * c->ntiles, size * (size_t)(from - to));
+	}
+	memcpy(frames + to * c->ntiles, tiles, size);
+	free(tiles);
+}
+
+static int *canvas_frame_tiles(struct canvas *c, int frame)
+{
+	return c->tiles + frame * c->ntiles;
+}
+
+/* Double the number of layers. This is the only operation that copies every
+ * tile, and it happens less and less often as the canvas grows. */
+static bool canvas_grow(struct canvas *c)
+{
+	int limit = canvas_max_layers();
+
+	if (c->cap >= limit)
+		return false;
+
+	int    cap = min(c->cap * 2, limit);
+	GLuint t   = canvas_texture(c->tw, c->th, cap, c->levels, c->format);
+
+	c->stale = realloc(c->stale, sizeof(*c->stale) * (size_t)cap);
+	memset(c->stale + c->cap, 0, sizeof(*c->stale) * (size_t)(cap - c->cap));
+	c->used  = realloc(c->used, sizeof(*c->used) * (size_t)cap);
+	memset(c->used + c->cap, 0, sizeof(*c->used) * (size_t)(cap - c->cap));
+	c->kept  = realloc(c->kept, sizeof(*c->kept) * (size_t)cap);
+
+	for (int l = c->cap; l < cap; l++)
+		c->kept[l] = -1;
+
+	/* Only the tiles themselves are copied, their mip levels are
+	 * regenerated. */
+	for (int i = 0; i < c->nframes * c->ntiles; i++) {
+		if (c->tiles[i] < 0)
+			continue;
+		canvas_attach(c, c->handle, c->tiles[i]);
+		canvas_copy_layer(t, c->tiles[i], c->tw, c->th);
+		canvas_stale_layer(c, c->tiles[i]);
+	}
+	gl_delete_texture(c->handle);
+
+	c->handle   = t;
+	c->attached = -1;
+	c->unused   = realloc(c->unused, sizeof(*c->unused) * (size_t)cap);
+
+	canvas_release_layers(c, c->cap, cap);
+	c->cap = cap;
+
+	return true;
+}
+
+/* Page the least recently used tile out to host memory, releasing its
+ * layer. Returns false if every resident tile is pinned. */
+static bool canvas_evict(struct canvas *c)
+{
+	int victim = -1;
+
+	for (int i = 0; i < c->nframes * c->ntiles; i++) {
+		int layer = c->tiles[i];
+
+		if (layer < 0 || c->used[layer] >= pinned)
+			continue;
+		if (victim < 0 || c->used[layer] < c->used[c->tiles[victim]])
+			victim = i;
+	}
+	if (victim < 0)
+		return false;
+
+	int layer = c->tiles[victim],
+	    page  = c->kept[layer];
+
+	/* Tiles which weren't written to since they were paged in still have
+	 * their page. Others are read back, and have their copy brought up to
+	 * date, unless their mip levels were. */
+	if (page < 0) {
+		page = canvas_page(c, canvas_read_layer(c, layer));
+
+		if (c->stale[layer])
+			canvas_update_cell(c, victim, c->pages[page]);
+	}
+	c->kept[layer]   = -1;
+	c->tiles[victim] = -2 - page;
+
+	if (c->stale[layer]) {
+		c->stale[layer] = false;
+		c->nstale --;
+	}
+	c->unused[c->nunused ++] = layer;
+
+	return true;
+}
+
+/* Take an unused layer, growing the texture, or paging a tile out if needed.
+ * Returns -1 if the canvas can't hold any more tiles. */
+static int canvas_alloc_layer(struct canvas *c)
+{
+	if (c->nunused == 0 && ! canvas_grow(c) && ! canvas_evict(c))
+		return -1;
+
+	int layer = c->unused[-- c->nunused];
+	canvas_use(c, layer);
+
+	return layer;
+}
+
+/* Upload a page into a free layer, which keeps the page until it's written
+ * to. Returns the layer, or -1 if there is no room for it. */
+static int canvas_page_in(struct canvas *c, int p)
+{
+	int layer = canvas_alloc_layer(c);
+
+	if (layer < 0)
+		return -1;
+
+	gl_bind_texture_array(0, c->handle);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer,
+		c->tw, c->th, 1, GL_RGBA, GL_UNSIGNED_BYTE, c->pages[p]);
+	gl_stats.uploads ++;
+
+	canvas_stale_layer(c, layer);
+	c->kept[layer] = p;
+
+	return layer;
+}
+
+/* Check whether pixels are all transparent, or all hold index zero on an
+ * indexed canvas, which is what empty tiles read as. */
+static bool tile_empty(struct canvas *c, const rgba_t *pixels, int stride, int w, int h)
+{
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			rgba_t p = pixels[y * stride + x];
+
+			if (c->format == GL_R8 ? p.r : p.a)
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Create a canvas of `n` frames of size `w` by `h`. If `pixels` is given, it
+ * holds the frames side by side, as a horizontal strip. Otherwise, the
+ * frames are transparent. Only tiles with visible pixels are stored.
+ *
+ * The `format` is either GL_RGBA, or GL_R8 for an indexed canvas, which
+ * stores a palette index per pixel. Pixels are passed in and read back as
+ * RGBA either way, with the index of indexed canvases in the red channel. */
+struct canvas *canvas(int w, int h, int n, const void *pixels, GLenum format)
+{
+	assert(n > 0);
+	assert(w > 0 && h > 0);
+
+	struct canvas *c      = calloc(1, sizeof(*c));
+	const rgba_t  *strip  = pixels;
+	int            stride = w * n;
+	int            used   = 0;
+	int            limit  = canvas_max_layers();
+
+	c->format = format;
+	canvas_grid(c, w, h);
+	canvas_reserve_tiles(c, n);
+
+	c->nframes  = n;
+	c->attached = -1;
+	c->sampler  = gen_sampler(GL_NEAREST_MIPMAP_NEAREST, GL_NEAREST);
+
+	for (int i = 0; i < n * c->ntiles; i++) {
+		rect_t r = canvas_tile_rect(c, i % c->ntiles);
+		int    x = (i / c->ntiles) * w + (int)r.x1;
+
+		const rgba_t *src = strip ? strip + (int)r.y1 * stride + x : NULL;
+
+		if (! src || tile_empty(c, src, stride, rect_w(&r), rect_h(&r))) {
+			c->tiles[i] = -1;
+		} else if (used < limit) {
+			c->tiles[i] = used ++;
+		} else {
+			/* Tiles past what the texture can hold start out paged out. */
+			rgba_t *page = canvas_page_alloc(c);
+
+			for (int y = 0; y < rect_h(&r); y++)
+				memcpy(page + y * c->tw, src + y * stride, sizeof(*page) * (size_t)rect_w(&r));
+
+			c->tiles[i] = -2 - canvas_page(c, page);
+		}
+	}
+	c->cap    = max(used, 1);
+	c->unused = malloc(sizeof(*c->unused) * (size_t)c->cap);
+	c->stale  = calloc((size_t)c->cap, sizeof(*c->stale));
+	c->used   = calloc((size_t)c->cap, sizeof(*c->used));
+	c->kept   = malloc(sizeof(*c->kept) * (size_t)c->cap);
+	c->handle = canvas_texture(c->tw, c->th, c->cap, c->levels, c->format);
+
+	for (int l = 0; l < c->cap; l++)
+		c->kept[l] = -1;
+
+	canvas_release_layers(c, used, c->cap);
+
+	glGenFramebuffers(1, &c->fb);
+	canvas_attach(c, c->handle, 0);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		fatalf("canvas", "glCheckFramebufferStatus: error %u", status);
+	}
+	/* Tiles which start out paged out get their copy now, the others once
+	 * their mip levels are generated. */
+	for (int i = 0; i < n * c->ntiles; i++) {
+		if (c->tiles[i] == -1) {
+			c->cells[i] = -1;
+			continue;
+		}
+		canvas_alloc_cell(c, i);
+
+		if (PAGED(c->tiles[i]))
+			canvas_update_cell(c, i, c->pages[PAGE(c->tiles[i])]);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+
+	for (int i = 0; i < n * c->ntiles; i++) {
+		if (c->tiles[i] < 0)
+			continue;
+
+		rect_t r = canvas_tile_rect(c, i % c->ntiles);
+
+		/* Tiles on the edge of a frame aren't covered entirely, make sure
+		 * the rest is transparent. */
+		if (rect_w(&r) < c->tw || rect_h(&r) < c->th) {
+			canvas_attach(c, c->handle, c->tiles[i]);
+			gl_clear(0.f, 0.f, 0.f, 0.f);
+		}
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, (i / c->ntiles) * w + (int)r.x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, (int)r.y1);
+
+		gl_bind_texture_array(0, c->handle);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, c->tiles[i],
+			rect_w(&r), rect_h(&r), 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		gl_stats.uploads ++;
+
+		canvas_stale_layer(c, c->tiles[i]);
+	}
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	return c;
+}
+
+void canvas_free(struct canvas *c)
+{
+	gl_delete_framebuffer(c->fb);
+	gl_delete_texture(c->handle);
+	gl_delete_sampler(c->sampler);
+
+	if (c->lowres)
+		gl_delete_texture(c->lowres);
+
+	for (int p = 0; p < c->npages; p++)
+		free(c->pages[p]);
+
+	free(c->pages);
+	free(c->tiles);
+	free(c->unused);
+	free(c->stale);
+	free(c->used);
+	free(c->kept);
+	free(c->cells);
+	free(c->freecells);
+	free(c);
+}
+
+/* Get the area covered by a tile within its frame. Tiles on the right and
+ * top edges may be cut short by the frame size. */
+rect_t canvas_tile_rect(struct canvas *c, int tile)
+{
+	int x = (tile % c->cols) * c->tw,
+	    y = (tile / c->cols) * c->th;
+
+	return rect(x, y, min(x + c->tw, c->w), min(y + c->th, c->h));
+}
+
+/* Pin the tiles used from now on, so that they aren't paged out until
+ * unpinned. Used around drawing a frame. */
+void canvas_pin(bool pin)
+{
+	pinned = pin ? uses + 1 : ULONG_MAX;
+}
+
+/* Get the layer holding the tile at index `i` of `tiles`, paging it in if
+ * needed. Returns -1 if the tile is empty, or couldn't be paged in. The
+ * bound framebuffer is kept. */
+static int canvas_resident(struct canvas *c, int i)
+{
+	int *layer = &c->tiles[i];
+
+	if (PAGED(*layer)) {
+		GLuint fb = gl_framebuffer();
+		int    l  = canvas_page_in(c, PAGE(*layer));
+
+		if (l < 0)
+			return -1;
+
+		*layer = l;
+		gl_bind_framebuffer(fb);
+	}
+	if (*layer >= 0)
+		canvas_use(c, *layer);
+
+	return *layer;
+}
+
+/* Get the layer holding a tile, paging it in if needed. Returns -1 if the
+ * tile is empty, or couldn't be paged in. The bound framebuffer is kept, so
+ * this can be called while drawing. */
+int canvas_layer(struct canvas *c, int frame, int tile)
+{
+	assert(frame >= 0 && frame < c->nframes);
+	assert(tile >= 0 && tile < c->ntiles);
+
+	int i     = frame * c->ntiles + tile,
+	    layer = canvas_resident(c, i);
+
+	if (PAGED(c->tiles[i]))
+		c->failed = true;
+
+	return layer;
+}
+
+/* Get what a tile is drawn from at the given mip level: the layer holding
+ * it, or else the cell holding its low resolution copy, the other one being
+ * -1. At the level of the copies, tiles are drawn from their copy without
+ * being paged in. Otherwise, tiles which can't be paged in, or whose mip
+ * levels are out of date, fall back to their copy. Returns false if the tile
+ * is empty, or can't be drawn. The bound framebuffer is kept. */
+bool canvas_draw_tile(struct canvas *c, int frame, int tile, int level, int *layer, int *cell)
+{
+	assert(frame >= 0 && frame < c->nframes);
+	assert(tile >= 0 && tile < c->ntiles);
+
+	int i = frame * c->ntiles + tile;
+
+	*layer = -1;
+	*cell  = c->cells[i];
+
+	if (c->tiles[i] == -1)
+		return false;
+	if (*cell >= 0 && level == TILE_LOWRES)
+		return true;
+
+	int l = canvas_resident(c, i);
+
+	if (l >= 0 && (level == 0 || ! c->stale[l] || *cell < 0)) {
+		*layer = l;
+		*cell  = -1;
+		return true;
+	}
+	if (*cell >= 0)
+		return true;
+
+	c->failed = true;
+	c->undrawn ++;
+
+	return false;
+}
+
+/* Check whether a tile is empty, without paging it in. */
+bool canvas_tile_empty(struct canvas *c, int frame, int tile)
+{
+	assert(frame >= 0 && frame < c->nframes);
+	assert(tile >= 0 && tile < c->ntiles);
+
+	return c->tiles[frame * c->ntiles + tile] == -1;
+}
+
+/* Bind the canvas framebuffer, for drawing into the given tile, whose origin
+ * is then at (0, 0). Empty tiles are allocated, and start out transparent.
+ * Returns false if the tile can't be made resident. */
+bool canvas_bind_tile(struct canvas *c, int frame, int tile)
+{
+	int  i     = frame * c->ntiles + tile,
+	    *layer = &c->tiles[i];
+
+	if (*layer != -1) {
+		int l = canvas_layer(c, frame, tile);
+
+		if (l < 0)
+			return false;
+
+		canvas_attach(c, c->handle, l);
+		canvas_dirty_layer(c, l);
+
+		return true;
+	}
+	if ((*layer = canvas_alloc_layer(c)) < 0) {
+		c->failed = true;
+		return false;
+	}
+	canvas_alloc_cell(c, i);
+	canvas_attach(c, c->handle, *layer);
+	gl_clear(0.f, 0.f, 0.f, 0.f);
+	canvas_dirty_layer(c, *layer);
+
+	return true;
+}
+
+/* Make a tile empty, releasing its storage. */
+void canvas_drop_tile(struct canvas *c, int frame, int tile)
+{
+	int  i     = frame * c->ntiles + tile,
+	    *layer = &c->tiles[i];
+
+	if (*layer >= 0)
+		canvas_release_layer(c, *layer);
+	else if (PAGED(*layer))
+		canvas_page_free(c, PAGE(*layer));
+
+	canvas_free_cell(c, i);
+	*layer = -1;
+}
+
+/* Mark a tile as written to, so that its mip levels are regenerated. Paged
+ * out tiles are marked once paged back in. */
+void canvas_touch(struct canvas *c, int frame, int tile)
+{
+	int layer = c->tiles[frame * c->ntiles + tile];
+
+	if (layer >= 0)
+		canvas_dirty_layer(c, layer);
+}
+
+/* Bind the canvas framebuffer for drawing into the given mip level of a
+ * layer, with the level above it as the only one that can be sampled, at
+ * level of detail 0. Its origin is then at (0, 0). */
+void canvas_bind_level(struct canvas *c, int layer, int level)
+{
+	assert(level > 0 && level < c->levels);
+
+	gl_bind_texture_array(0, c->handle);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, level - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, level - 1);
+
+	gl_bind_framebuffer(c->fb);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, c->handle, level, layer);
+	c->attached = -1;
+}
+
+/* Mark all mip levels as up to date, once they've been regenerated through
+ * `canvas_bind_level`, and copy the lowest level of the tiles concerned. */
+void canvas_mips_done(struct canvas *c)
+{
+	gl_bind_texture_array(0, c->handle);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, c->levels - 1);
+
+	for (int i = 0; c->cw && i < c->nframes * c->ntiles; i++) {
+		if (c->tiles[i] >= 0 && c->stale[c->tiles[i]])
+			canvas_copy_cell(c, i, c->tiles[i]);
+	}
+
+	memset(c->stale, 0, sizeof(*c->stale) * (size_t)c->cap);
+	c->nstale = 0;
+}
+
+/* Bind the canvas texture to the first texture unit, and the low resolution
+ * copies to the third, for sampling. */
+void canvas_bind_texture(struct canvas *c)
+{
+	gl_bind_texture_array(0, c->handle);
+	gl_bind_sampler(0, c->sampler);
+	gl_bind_texture_array(2, c->lowres);
+	gl_bind_sampler(2, c->sampler);
+}
+
+/* Start iterating over the tiles intersecting `r`, in strip coordinates.
+ * When `write` is set, empty tiles are allocated, otherwise they are
+ * skipped. */
+void canvas_tiles(struct tileiter *it, struct canvas *c, rect_t r, bool write)
+{
+	r = rect_norm(r);
+
+	it->c      = c;
+	it->write  = write;
+	it->host   = false;
+	it->pixels = NULL;
+	it->x1     = max(0, (int)r.x1);
+	it->y1     = max(0, (int)r.y1);
+	it->x2     = min(c->w * c->nframes, (int)r.x2);
+	it->y2     = min(c->h, (int)r.y2);
+	it->frame  = it->x1 / c->w;
+	it->col    = -1;
+	it->row    = -1;
+}
+
+/* Move on to the next tile, and bind it for drawing. Drawing then has to be
+ * offset by the tile origin. Returns false once there are no tiles left.
+ * With `host` set, paged out tiles aren't bound, but have `pixels` set. */
+bool canvas_tiles_next(struct tileiter *it)
+{
+	struct canvas *c = it->c;
+
+	if (it->x1 >= it->x2 || it->y1 >= it->y2)
+		return false;
+
+	for (;;) {
+		int fx   = it->frame * c->w;
+		int col1 = max(it->x1 - fx, 0) / c->tw,
+		    col2 = (min(it->x2 - fx, c->w) - 1) / c->tw,
+		    row1 = it->y1 / c->th,
+		    row2 = (it->y2 - 1) / c->th;
+
+		if (it->col < 0) {
+			it->col = col1;
+			it->row = row1;
+		} else if (++ it->col > col2) {
+			it->col = col1;
+
+			if (++ it->row > row2) {
+				it->frame ++;
+				it->col = it->row = -1;
+
+				if (it->frame * c->w >= it->x2)
+					return false;
+				continue;
+			}
+		}
+		it->tile = it->row * c->cols + it->col;
+		it->x    = fx + it->col * c->tw;
+		it->y    = it->row * c->th;
+
+		if (it->write)
+			return canvas_bind_tile(c, it->frame, it->tile);
+
+		int *slot = &c->tiles[it->frame * c->ntiles + it->tile];
+
+		if (it->host && PAGED(*slot)) {
+			it->pixels = c->pages[PAGE(*slot)];
+			return true;
+		}
+		it->pixels = NULL;
+
+		int layer = canvas_layer(c, it->frame, it->tile);
+
+		if (layer >= 0) {
+			canvas_attach(c, c->handle, layer);
+			return true;
+		}
+	}
+}
+
+/* Insert a frame at position `at`. The new frame is a copy of the frame at
+ * position `src`, or is empty if `src` is negative. Copies which don't fit
+ * in the texture are paged out. */
+void canvas_insert(struct canvas *c, int at, int src)
+{
+	assert(at >= 0 && at <= c->nframes);
+	assert(src < c->nframes);
+
+	canvas_reserve_tiles(c, c->nframes + 1);
+
+	/* The new frame is built after the last frame, then moved into place. */
+	int last = c->nframes ++;
+
+	for (int t = 0; t < c->ntiles; t++) {
+		c->tiles[last * c->ntiles + t] = -1;
+		c->cells[last * c->ntiles + t] = -1;
+	}
+	for (int t = 0; src >= 0 && t < c->ntiles; t++) {
+		int *from = &c->tiles[src * c->ntiles + t];
+		int  i    = last * c->ntiles + t,
+		     to   = -1;
+
+		if (*from == -1)
+			continue;
+
+		canvas_alloc_cell(c, i);
+
+		if (*from >= 0) {
+			canvas_use(c, *from);
+			to = canvas_alloc_layer(c);
+		}
+		/* The source may have been paged out to make room. */
+		if (to >= 0 && PAGED(*from)) {
+			canvas_release_layer(c, to);
+			to = -1;
+		}
+		if (to < 0) {
+			rgba_t *page;
+
+			if (PAGED(*from)) {
+				page = canvas_page_alloc(c);
+				memcpy(page, c->pages[PAGE(*from)], sizeof(*page) * (size_t)(c->tw * c->th));
+			} else {
+				page = canvas_read_layer(c, *from);
+			}
+			c->tiles[i] = -2 - canvas_page(c, page);
+			canvas_update_cell(c, i, page);
+
+			continue;
+		}
+		canvas_attach(c, c->handle, *from);
+		canvas_copy_layer(c->handle, to, c->tw, c->th);
+		canvas_stale_layer(c, to);
+
+		c->tiles[i] = to;
+	}
+	canvas_move(c, last, at);
+}
+
+void canvas_remove(struct canvas *c, int frame)
+{
+	assert(c->nframes > 1);
+	assert(frame >= 0 && frame < c->nframes);
+
+	for (int t = 0; t < c->ntiles; t++)
+		canvas_drop_tile(c, frame, t);
+
+	c->nframes --;
+
+	memmove(canvas_frame_tiles(c, frame), canvas_frame_tiles(c, frame + 1),
+		sizeof(*c->tiles) * (size_t)((c->nframes - frame) * c->ntiles));
+	memmove(c->cells + frame * c->ntiles, c->cells + (frame + 1) * c->ntiles,
+		sizeof(*c->cells) * (size_t)((c->nframes - frame) * c->ntiles));
+}
+
+/* Move the frame at position `from` to position `to`. */
+void canvas_move(struct canvas *c, int from, int to)
+{
+	assert(from >= 0 && from < c->nframes);
+	assert(to >= 0 && to < c->nframes);
+
+	if (from == to)
+		return;
+
+	canvas_move_frame(c, c->tiles, from, to);
+	canvas_move_frame(c, c->cells, from, to);
+}
+
+/* Fit a page to the tile size, keeping only the area `r` of the tile, which
+ * is what lies inside the frame. Pages were `ow` by `oh` before. */
+static void canvas_page_fit(struct canvas *c, int p, int ow, int oh, rect_t r)
+{
+	rgba_t *old  = c->pages[p],
+	       *page = canvas_page_alloc(c);
+	int     w    = min(rect_w(&r), ow),
+	        h    = min(rect_h(&r), oh);
+
+	for (int y = 0; y < h; y++)
+		memcpy(page + y * c->tw, old + y * ow, sizeof(*page) * (size_t)w);
+
+	free(old);
+	c->pages[p] = page;
+}
+
+/* Change the frame size. The contents of each frame are kept in place, and
+ * any new area is transparent. Tiles keep their position in the grid, so
+ * unless the tile size changes, no pixels are copied. When it does change,
+ * the frame was smaller than a tile before or after, so only the first row
+ * or column of tiles is concerned. */
+void canvas_resize(struct canvas *c, int w, int h)
+{
+	if (w == c->w && h == c->h)
+		return;
+
+	struct canvas old = *c;
+
+	canvas_grid(c, w, h);
+
+	bool   retile = c->tw != old.tw || c->th != old.th;
+	GLuint t      = retile ? canvas_texture(c->tw, c->th, c->cap, c->levels, c->format) : c->handle;
+
+	c->tiles    = NULL;
+	c->cells    = NULL;
+	c->tilescap = 0;
+	canvas_reserve_tiles(c, c->nframes);
+
+	/* The cell size changes with the tile size, so copies are made anew. */
+	if (retile) {
+		c->lowres     = 0;
+		c->lowcap     = 0;
+		c->freecells  = NULL;
+		c->nfreecells = 0;
+	}
+	for (int f = 0; f < c->nframes; f++) {
+		for (int i = 0; i < c->ntiles; i++) {
+			int col    = i % c->cols,
+			    row    = i / c->cols,
+			    j      = f * c->ntiles + i,
+			    *layer = &c->tiles[j];
+
+			*layer      = -1;
+			c->cells[j] = -1;
+
+			if (col < old.cols && row < old.rows) {
+				*layer      = old.tiles[f * old.ntiles + row * old.cols + col];
+				c->cells[j] = old.cells[f * old.ntiles + row * old.cols + col];
+			}
+			if (*layer == -1)
+				continue;
+			if (retile)
+				canvas_alloc_cell(c, j);
+
+			rect_t r = canvas_tile_rect(c, i);
+
+			if (PAGED(*layer)) {
+				canvas_page_fit(c, PAGE(*layer), old.tw, old.th, r);
+				canvas_update_cell(c, j, c->pages[PAGE(*layer)]);
+				continue;
+			}
+			if (retile) {
+				canvas_attach(c, t, *layer);
+				gl_clear(0.f, 0.f, 0.f, 0.f);
+				canvas_attach(c, old.handle, *layer);
+				canvas_copy_layer(t, *layer, min(c->tw, old.tw), min(c->th, old.th));
+			}
+			/* Clear what now lies outside the frame, so that it doesn't
+			 * show up if the frame grows again. */
+			canvas_attach(c, t, *layer);
+
+			gl_scissor(rect_w(&r), 0, c->tw, c->th);
+			gl_clear(0.f, 0.f, 0.f, 0.f);
+			gl_scissor(0, rect_h(&r), c->tw, c->th);
+			gl_clear(0.f, 0.f, 0.f, 0.f);
+			gl_scissor_disable();
+
+			canvas_dirty_layer(c, *layer);
+		}
+		/* Tiles which are no longer part of the grid are released. */
+		for (int i = 0; i < old.ntiles; i++) {
+			int layer = old.tiles[f * old.ntiles + i],
+			    cell  = old.cells[f * old.ntiles + i];
+
+			if (i % old.cols < c->cols && i / old.cols < c->rows)
+				continue;
+
+			if (layer >= 0)
+				canvas_release_layer(c, layer);
+			else if (PAGED(layer))
+				canvas_page_free(c, PAGE(layer));
+
+			if (cell >= 0 && ! retile)
+				c->freecells[c->nfreecells ++] = cell;
+		}
+	}
+	free(old.tiles);
+	free(old.cells);
+
+	if (retile) {
+		gl_delete_texture(old.handle);
+		c->handle = t;
+
+		if (old.lowres)
+			gl_delete_texture(old.lowres);
+		free(old.freecells);
+	}
+	c->attached = -1;
+}
+
+/* Read the pixels of a rect into `buf`. The rect is in strip coordinates,
+ * and may span several frames and tiles. */
+void canvas_read(struct canvas *c, rect_t r, rgba_t *buf)
+{
+	struct tileiter it;
+
+	r = rect_norm(r);
+
+	int x1 = (int)r.x1,
+	    y1 = (int)r.y1;
+
+	memset(buf, 0, sizeof(*buf) * (size_t)(rect_w(&r) * rect_h(&r)));
+	glPixelStorei(GL_PACK_ROW_LENGTH, rect_w(&r));
+
+	canvas_tiles(&it, c, r, false);
+	it.host = true;
+
+	while (canvas_tiles_next(&it)) {
+		int tx1 = max(x1, it.x),
+		    ty1 = max(y1, it.y),
+		    tx2 = min(min((int)r.x2, it.x + c->tw), (it.frame + 1) * c->w),
+		    ty2 = min(min((int)r.y2, it.y + c->th), c->h);
+
+		/* Paged out tiles are read from host memory. */
+		if (it.pixels) {
+			for (int y = ty1; y < ty2; y++) {
+				memcpy(buf + (y - y1) * rect_w(&r) + (tx1 - x1),
+					it.pixels + (y - it.y) * c->tw + (tx1 - it.x),
+					sizeof(*buf) * (size_t)(tx2 - tx1));
+			}
+			continue;
+		}
+
+		glPixelStorei(GL_PACK_SKIP_PIXELS, tx1 - x1);
+		glPixelStorei(GL_PACK_SKIP_ROWS, ty1 - y1);
+		trace_begin("gl", "glReadPixels");
+		glReadPixels(tx1 - it.x, ty1 - it.y, tx2 - tx1, ty2 - ty1, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+		trace_end("gl", "glReadPixels");
+		gl_stats.readbacks ++;
+	}
+	glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+	glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+}
+
+/* Upload the pixels of a tile, laid out the way `canvas_read` returns the
+ * tile's area. Empty tiles are allocated first. Paged out tiles, and tiles
+ * which don't fit in the texture, are written in host memory. */
+bool canvas_write(struct canvas *c, int frame, int tile, const rgba_t *pixels)
+{
+	rect_t r     = canvas_tile_rect(c, tile);
+	int    i     = frame * c->ntiles + tile,
+	      *layer = &c->tiles[i];
+
+	if (*layer == -1) {
+		canvas_alloc_cell(c, i);
+
+		if ((*layer = canvas_alloc_layer(c)) >= 0) {
+			canvas_attach(c, c->handle, *layer);
+			gl_clear(0.f, 0.f, 0.f, 0.f);
+		} else {
+			*layer = -2 - canvas_page(c, canvas_page_alloc(c));
+		}
+	}
+	if (PAGED(*layer)) {
+		rgba_t *page = c->pages[PAGE(*layer)];
+
+		for (int y = 0; y < rect_h(&r); y++)
+			memcpy(page + y * c->tw, pixels + y * rect_w(&r), sizeof(*page) * (size_t)rect_w(&r));
+
+		canvas_update_cell(c, i, page);
+
+		return true;
+	}
+	canvas_use(c, *layer);
+	gl_bind_texture_array(0, c->handle);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, *layer,
+		rect_w(&r), rect_h(&r), 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	gl_stats.uploads ++;
+
+	canvas_dirty_layer(c, *layer);
+
+	return true;
+}
+
+/* Bind the tile holding a pixel, for reading it. The pixel is given in strip
+ * coordinates, and converted to coordinates within the tile. Returns false
+ * if the pixel is outside of the canvas, or in an empty tile, in which case
+ * it's transparent. */
+bool canvas_bind_pixel(struct canvas *c, int *x, int *y)
+{
+	int f = *x / c->w;
+
+	if (*x < 0 || *y < 0 || *y >= c->h || f >= c->nframes)
+		return false;
+
+	int fx    = *x - f * c->w,
+	    tile  = (*y / c->th) * c->cols + fx / c->tw,
+	    layer = canvas_layer(c, f, tile);
+
+	if (layer < 0)
+		return false;
+
+	canvas_attach(c, c->handle, layer);
+
+	*x = fx % c->tw;
+	*y = *y % c->th;
+
+	return true;
+}
+
+/* Get a pixel, in strip coordinates, from host memory. Returns NULL unless
+ * its tile is paged out, or still has the page it was paged in from. */
+const rgba_t *canvas_host_pixel(struct canvas *c, int x, int y)
+{
+	int f = x / c->w;
+
+	if (x < 0 || y < 0 || y >= c->h || f >= c->nframes)
+		return NULL;
+
+	int fx   = x - f * c->w,
+	    tile = (y / c->th) * c->cols + fx / c->tw,
+	    slot = c->tiles[f * c->ntiles + tile],
+	    page = PAGED(slot) ? PAGE(slot) : slot >= 0 ? c->kept[slot] : -1;
+
+	if (page < 0)
+		return NULL;
+
+	return &c->pages[page][(y % c->th) * c->tw + fx % c->tw];
+}
+
+/* Sample a pixel, in strip coordinates. Tiles with a page are sampled in
+ * host memory. */
+rgba_t canvas_sample(struct canvas *c, int x, int y)
+{
+	rgba_t        color = {0, 0, 0, 0};
+	const rgba_t *host  = canvas_host_pixel(c, x, y);
+
+	if (host)
+		return *host;
+
+	if (canvas_bind_pixel(c, &x, &y)) {
+		trace_begin("gl", "glReadPixels");
+		glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &color);
+		trace_end("gl", "glReadPixels");
+		gl_stats.readbacks ++;
+	}
+
+	return color;
+}
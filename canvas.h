@@ -0,0 +1,86 @@
+//
+// canvas.h
+// sparse pixel storage of a view, split into frames and tiles
+//
+#define TILE_SIZE        512
+#define TILE_LEVELS      4          /* Mip levels of a tile, including the tile itself */
+#define TILE_RESIDENT    256        /* Most tiles of a canvas kept in video memory */
+#define TILE_LOWRES      (TILE_LEVELS - 1) /* Level of the low resolution copies */
+
+struct canvas {
+	GLuint           handle;    /* Array texture, one tile per layer */
+	GLuint           fb;        /* Framebuffer, attached to one layer at a time */
+	GLuint           sampler;
+	GLenum           format;    /* GL_RGBA, or GL_R8 for palette indices */
+	int              w, h;      /* Frame size */
+	int              tw, th;    /* Tile size */
+	int              cols, rows;/* Number of tiles across and down a frame */
+	int              ntiles;    /* Number of tiles in a frame */
+	int              levels;    /* Number of mip levels of each tile */
+	int              nframes;
+	int             *tiles;     /* Layer holding each tile, -1 if the tile is
+	                             * empty, or -2 minus its page if it's paged
+	                             * out. Tiles are stored frame by frame. */
+	int              tilescap;
+	int              cap;       /* Number of layers allocated */
+	int             *unused;    /* Layers not holding a tile */
+	int              nunused;
+	int              attached;  /* Layer attached to `fb`, or -1 */
+	bool            *stale;     /* Layers whose mip levels are out of date */
+	int              nstale;
+	unsigned long   *used;      /* When each layer was last used */
+	int             *kept;      /* Page each layer was paged in from, kept
+	                             * until the layer is written to, or -1 */
+	rgba_t         **pages;     /* Tiles paged out to host memory, or NULL */
+	int              npages;
+	GLuint           lowres;    /* Array texture of low resolution copies of
+	                             * the tiles, many cells per layer, or 0 */
+	int              cw, ch;    /* Cell size, or 0 if tiles have no copies */
+	int              ncells;    /* Number of cells in a layer of `lowres` */
+	int              lowcap;    /* Number of layers of `lowres` */
+	int             *cells;     /* Cell holding the copy of each tile, or -1.
+	                             * Stored like `tiles`. */
+	int             *freecells;
+	int              nfreecells;
+	bool             failed;    /* A tile couldn't be made resident */
+	int              undrawn;   /* Tiles which couldn't be drawn */
+};
+
+/* Iterates over the tiles of a canvas intersecting an area. */
+struct tileiter {
+	struct canvas   *c;
+	bool             write;     /* Allocate empty tiles instead of skipping them */
+	bool             host;      /* Don't page tiles in, return their pixels */
+	rgba_t          *pixels;    /* Pixels of the current tile, if paged out */
+	int              x1, y1;    /* Area, in strip coordinates */
+	int              x2, y2;
+	int              frame;     /* Current frame */
+	int              col, row;  /* Current tile within the frame */
+	int              tile;
+	int              x, y;      /* Origin of the current tile, in strip coordinates */
+};
+
+struct canvas   *canvas(int, int, int, const void *, GLenum);
+void             canvas_free(struct canvas *);
+void             canvas_pin(bool);
+void             canvas_tiles(struct tileiter *, struct canvas *, rect_t, bool);
+bool             canvas_tiles_next(struct tileiter *);
+bool             canvas_bind_tile(struct canvas *, int, int);
+void             canvas_drop_tile(struct canvas *, int, int);
+void             canvas_touch(struct canvas *, int, int);
+void             canvas_bind_level(struct canvas *, int, int);
+void             canvas_mips_done(struct canvas *);
+void             canvas_bind_texture(struct canvas *);
+int              canvas_layer(struct canvas *, int, int);
+bool             canvas_draw_tile(struct canvas *, int, int, int, int *, int *);
+bool             canvas_tile_empty(struct canvas *, int, int);
+rect_t           canvas_tile_rect(struct canvas *, int);
+void             canvas_insert(struct canvas *, int, int);
+void             canvas_remove(struct canvas *, int);
+void             canvas_move(struct canvas *, int, int);
+void             canvas_resize(struct canvas *, int, int);
+void             canvas_read(struct canvas *, rect_t, rgba_t *);
+bool             canvas_write(struct canvas *, int, int, const rgba_t *);
+bool             canvas_bind_pixel(struct canvas *, int *, int *);
+const rgba_t    *canvas_host_pixel(struct canvas *, int, int);
+rgba_t           canvas_sample(struct canvas *, int, int);
@@ -34,10 +34,10 @@ rgba_t hsla2rgba(struct hsla hsla)
 	float m1 = l * 2.f - m2;
 
 	return (struct rgba){
-		(uint8_t)(hue(h + 1.f/3.f, m1, m2) * 255.f),
-		(uint8_t)(hue(h,           m1, m2) * 255.f),
-		(uint8_t)(hue(h - 1.f/3.f, m1, m2) * 255.f),
-		(uint8_t)(a * 255.f)
+		(uint8_t)(hue(h + 1.f/3.f, m1, m2) * 255.f + .5f),
+		(uint8_t)(hue(h,           m1, m2) * 255.f + .5f),
+		(uint8_t)(hue(h - 1.f/3.f, m1, m2) * 255.f + .5f),
+		(uint8_t)(a * 255.f + .5f)
 	};
 }
 
@@ -69,6 +69,52 @@ hsla_t rgba2hsla(struct rgba rgba)
 	return (struct hsla){h, s, l, a};
 }
 
+/* Move a saturation or lightness value towards 1 by `amount` when it's
+ * positive, or towards 0 when it's negative. */
+static float towards(float v, float amount)
+{
+	return amount > 0 ? v + (1.f - v) * amount : v * (1.f + amount);
+}
+
+/* Rotate the hue of a color by `h` turns, and move its saturation and
+ * lightness by `s` and `l`, from -1 to 1. Must match `adjust` in
+ * shaders/color.glsl, which previews and applies adjustments. */
+rgba_t rgba_adjust(struct rgba rgba, float h, float s, float l)
+{
+	hsla_t c = rgba2hsla(rgba);
+
+	c.h = fmodf(c.h + h + 1.f, 1.f);
+	c.s = towards(c.s, s);
+	c.l = towards(c.l, l);
+
+	return hsla2rgba(c);
+}
+
+static float linear(uint8_t c)
+{
+	float v = (float)c / 255.f;
+
+	return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+/* Convert an sRGB color to OKLab. Alpha is dropped. */
+lab_t rgba2lab(struct rgba rgba)
+{
+	float r = linear(rgba.r),
+	      g = linear(rgba.g),
+	      b = linear(rgba.b);
+
+	float l = cbrtf(0.4122214708f * r + 0.5363325363f * g + 0.0514459929f * b),
+	      m = cbrtf(0.2119034982f * r + 0.6806995451f * g + 0.1073969566f * b),
+	      s = cbrtf(0.0883024619f * r + 0.2817188376f * g + 0.6299787005f * b);
+
+	return (struct lab){
+		0.2104542553f * l + 0.7936177850f * m - 0.0040720468f * s,
+		1.9779984951f * l - 2.4285922050f * m + 0.4505937099f * s,
+		0.0259040371f * l + 0.7827717662f * m - 0.8086757660f * s
+	};
+}
+
 rgba_t hex2rgba(const char *hex)
 {
 	assert(hex[0] == '#');
@@ -4,6 +4,7 @@
  */
 typedef struct rgba  rgba_t;
 typedef struct hsla  hsla_t;
+typedef struct lab   lab_t;
 
 #define rgba2vec4(rgba)      vec4((rgba).r/255.f, (rgba).g/255.f, \
 		                  (rgba).b/255.f, (rgba).a/255.f)
@@ -28,8 +29,15 @@ struct hsla {
 	float h, s, l, a;
 };
 
+/* Color in the OKLab space, where distances follow perceived differences. */
+struct lab {
+	float l, a, b;
+};
+
 rgba_t hsla2rgba(hsla_t);
 hsla_t rgba2hsla(rgba_t);
+lab_t  rgba2lab(rgba_t);
+rgba_t rgba_adjust(rgba_t, float, float, float);
 rgba_t hex2rgba(const char *);
 
 int    rgbacmp(rgba_t, rgba_t);
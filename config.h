@@ -11,6 +11,7 @@ static struct binding bindings[] = {
 	{"command",            MODE_ANY,    GLFW_MOD_SHIFT,         GLFW_KEY_SEMICOLON,    GLFW_PRESS,    kb_cmdmode,         { 0 }},
 	{"pixel mode",         MODE_ANY,    0,                      GLFW_KEY_V,            GLFW_PRESS,    kb_pixelmode,       { 0 }},
 	{"presentation mode",  MODE_ANY,    0,                      GLFW_KEY_F11,          GLFW_PRESS,    kb_presentmode,     { 0 }},
+	{"perf overlay",       MODE_ANY,    0,                      GLFW_KEY_F12,          GLFW_PRESS,    kb_toggle_perf,     { 0 }},
 	{"zoom in",            MODE_ANY,    0,                      '.',                   GLFW_PRESS,    kb_zoom,            { .i = +1 }},
 	{"zoom out",           MODE_ANY,    0,                      ',',                   GLFW_PRESS,    kb_zoom,            { .i = -1 }},
 	{"create frame",       MODE_ANY,    GLFW_MOD_CONTROL,       GLFW_KEY_F,            GLFW_PRESS,    kb_create_frame,    { 0 }},
@@ -34,6 +35,12 @@ static struct binding bindings[] = {
 	{"flip y",             MODE_ANY,    GLFW_MOD_SHIFT,         GLFW_KEY_BACKSLASH,    GLFW_RELEASE,  kb_flipy,           { false }},
 	{"help",               MODE_ANY,    0,                      GLFW_KEY_SLASH,        GLFW_PRESS,    kb_help,            { true }},
 	{"help",               MODE_ANY,    0,                      GLFW_KEY_SLASH,        GLFW_RELEASE,  kb_help,            { false }},
+	{"hue +",              MODE_ANY,    GLFW_MOD_ALT,           GLFW_KEY_H,            GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_HUE, +15} }},
+	{"hue -",              MODE_ANY,    GLFW_MOD_ALT|GLFW_MOD_SHIFT, GLFW_KEY_H,       GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_HUE, -15} }},
+	{"saturation +",       MODE_ANY,    GLFW_MOD_ALT,           GLFW_KEY_S,            GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_SATURATION, +5} }},
+	{"saturation -",       MODE_ANY,    GLFW_MOD_ALT|GLFW_MOD_SHIFT, GLFW_KEY_S,       GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_SATURATION, -5} }},
+	{"lightness +",        MODE_ANY,    GLFW_MOD_ALT,           GLFW_KEY_L,            GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_LIGHTNESS, +5} }},
+	{"lightness -",        MODE_ANY,    GLFW_MOD_ALT|GLFW_MOD_SHIFT, GLFW_KEY_L,       GLFW_PRESS,    kb_adjust,          { .p = {ADJUST_LIGHTNESS, -5} }},
 
 	/* NORMAL MODE */
 	{"brush",              MODE_NORMAL, 0,                      GLFW_KEY_B,            GLFW_PRESS,    kb_brush,           { 0 }},
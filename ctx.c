@@ -17,11 +17,14 @@
 #include "cursor.h"
 #include "texture.h"
 #include "gl.h"
-#include "ctx.h"
+#include "perf.h"
+#include "trace.h"
+#include "bench.h"
+#include "latency.h"
 #include "program.h"
+#include "ctx.h"
 #include "polygon.h"
 #include "framebuffer.h"
-#include "list.h"
 #include "sprite.h"
 
 //////////////
@@ -54,21 +57,48 @@ static void ctx_update_cursor_pos(struct context *ctx)
 	ctx_set_cursor_pos(ctx, mx, my);
 }
 
+/* Update the pacer after presenting a frame, and schedule the next one.
+ * Deadlines follow a fixed grid of periods, so that frames are evenly
+ * spaced while something is animating, unless we fall behind. */
+static void ctx_pacer_tick(struct pacer *p)
+{
+	double now    = glfwGetTime();
+	double period = 1.0 / p->rate;
+	double dt     = now - p->last;
+
+	p->frametime = (now - p->start) * 1000.0;
+	p->interval  = dt * 1000.0;
+	p->frames   ++;
+
+	/* Only consecutive frames count towards the average and jitter,
+	 * idle periods don't. */
+	if (dt < period * 2) {
+		p->average = p->average > 0 ? p->average * 0.9 + p->interval * 0.1 : p->interval;
+		p->jitter  = fmax(p->jitter, fabs(dt - period) * 1000.0);
+	}
+	p->last      = now;
+	p->deadline += period;
+
+	if (p->deadline < now)
+		p->deadline = now + period;
+}
+
 static void ctx_setup_program_unifs(struct context *ctx, struct program *p)
 {
-	set_uniform_mat4(p, "transform", ctx->transform);
-	set_uniform_i32(p, "sampler", 0); // Set sampler uniform to texture unit 0
+	set_uniform_i32(p, UNIFORM_SAMPLER, 0); // Set sampler uniform to texture unit 0
 }
 
 static void ctx_setup_ortho(struct context *ctx)
 {
 	struct program *prev = ctx->program;
-	struct program *p    = NULL;
-	list_t         ps    = ctx->programs;
 
-	while (list_next(&ps, (void **)&p)) {
-		program_use(p);
-		set_uniform_mat4(p, "ortho",  &ctx->ortho);
+	for (int i = 0; i < PROGRAM_MAX; i++) {
+		struct program *p = ctx->programs[i];
+
+		if (p) {
+			program_use(p);
+			set_uniform_mat4(p, UNIFORM_ORTHO, &ctx->ortho);
+		}
 	}
 	program_use(prev);
 }
@@ -99,25 +129,43 @@ static void key_callback(GLFWwindow *win, int key, int scan, int action, int mod
 {
 	struct context *ctx = glfwGetWindowUserPointer(win);
 
+	perf_begin(PERF_INPUT);
+	latency_input(INPUT_KEY);
+
 	if (ctx->on_key)
 		ctx->on_key(ctx, key, scan, action, mods);
+
+	latency_input_end();
+	perf_end(PERF_INPUT);
 }
 
 static void mouse_button_callback(GLFWwindow *win, int button, int action, int mods)
 {
 	struct context *ctx = glfwGetWindowUserPointer(win);
 
+	perf_begin(PERF_INPUT);
+	latency_input(INPUT_BUTTON);
+
 	if (ctx->on_click)
 		ctx->on_click(ctx, button, action, mods);
+
+	latency_input_end();
+	perf_end(PERF_INPUT);
 }
 
 static void cursor_pos_callback(GLFWwindow *win, double x, double y)
 {
 	struct context *ctx = glfwGetWindowUserPointer(win);
+
+	perf_begin(PERF_INPUT);
+	latency_input(INPUT_MOTION);
 	ctx_set_cursor_pos(ctx, x, y);
 
 	if (ctx->on_cursor)
 		ctx->on_cursor(ctx, ctx->cursorx, ctx->cursory);
+
+	latency_input_end();
+	perf_end(PERF_INPUT);
 }
 
 static void focus_callback(GLFWwindow *win, int focus)
@@ -165,17 +213,29 @@ static void char_callback(GLFWwindow *win, unsigned int codepoint)
 {
 	struct context *ctx = glfwGetWindowUserPointer(win);
 
+	perf_begin(PERF_INPUT);
+	latency_input(INPUT_KEY);
+
 	if (ctx->on_char)
 		ctx->on_char(ctx, codepoint);
+
+	latency_input_end();
+	perf_end(PERF_INPUT);
 }
 
-static void ctx_free_programs(struct context *ctx)
+static void refresh_callback(GLFWwindow *win)
 {
-	struct program *p = NULL;
-	list_t         ps = ctx->programs;
+	struct context *ctx = glfwGetWindowUserPointer(win);
+
+	if (ctx->on_refresh)
+		ctx->on_refresh(ctx);
+}
 
-	while ((p = list_pop(&ps)) && p) {
-		program_free(p);
+static void ctx_free_programs(struct context *ctx)
+{
+	for (int i = 0; i < PROGRAM_MAX; i++) {
+		if (ctx->programs[i])
+			program_free(ctx->programs[i]);
 	}
 }
 
@@ -193,13 +253,20 @@ bool ctx_init(struct context *ctx, int w, int h, bool debug)
 	}
 
 	GLFWmonitor          *monitor = glfwGetPrimaryMonitor();
-	const GLFWvidmode    *mode    = glfwGetVideoMode(monitor);
+	const GLFWvidmode    *mode    = monitor ? glfwGetVideoMode(monitor) : NULL;
+
+	int mw = 0, mh = 0;
 
-	int mw, mh;
-	glfwGetMonitorPhysicalSize(monitor, &mw, &mh);
+	if (monitor)
+		glfwGetMonitorPhysicalSize(monitor, &mw, &mh);
 
-	ctx->dpi            = mode->width / (mw / 25.4);
-	ctx->hidpi          = ctx->dpi > 180.0;
+	/* Hidden windows are always at the size asked for, so that they look
+	 * the same on any display, or none. */
+	if (! mode && ! ctx->hidden)
+		return false;
+
+	ctx->dpi            = mode && mw > 0 ? mode->width / (mw / 25.4) : 96.0;
+	ctx->hidpi          = ! ctx->hidden && ctx->dpi > 180.0;
 	ctx->vidmode        = mode;
 
 	if (ctx->hidpi) {
@@ -221,6 +288,7 @@ bool ctx_init(struct context *ctx, int w, int h, bool debug)
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
 
 	glfwWindowHint(GLFW_SAMPLES, 16);
+	glfwWindowHint(GLFW_VISIBLE, ! ctx->hidden);
 
 	if ((ctx->win = glfwCreateWindow(w, h, "px", NULL, NULL)) == NULL) {
 		return false;
@@ -236,10 +304,13 @@ bool ctx_init(struct context *ctx, int w, int h, bool debug)
 	glfwSetFramebufferSizeCallback(ctx->win, framebuffer_size_callback);
 	glfwSetWindowPosCallback(ctx->win, window_pos_callback);
 	glfwSetCharCallback(ctx->win, char_callback);
+	glfwSetWindowRefreshCallback(ctx->win, refresh_callback);
 	glfwSetWindowAspectRatio(ctx->win, w, h);
 
 	glfwGetFramebufferSize(ctx->win, &ctx->winw, &ctx->winh);
-	ctx_win_center(ctx);
+
+	if (! ctx->hidden)
+		ctx_win_center(ctx);
 	gl_init(ctx->winw, ctx->winh, debug);
 
 	int vw = ctx->winw, /* Virtual screen */
@@ -257,9 +328,7 @@ bool ctx_init(struct context *ctx, int w, int h, bool debug)
 	infof("ctx", "real screen size: %dx%d", ctx->winw, ctx->winh);
 	infof("ctx", "virtual screen size: %dx%d", vw, vh);
 
-	ctx->lastframe      = 0;
-	ctx->frametime      = 0;
-	ctx->transforms     = NULL;
+	ctx->ntransforms    = 0;
 	ctx->ortho          = mat4ortho(ctx->winw, ctx->winh);
 	ctx->font           = malloc(sizeof(*ctx->font));
 
@@ -273,6 +342,7 @@ bool ctx_init(struct context *ctx, int w, int h, bool debug)
 	ctx_save(ctx);
 
 	glfwSetTime(0);
+	ctx_pace(ctx, PACE_VSYNC, mode->refreshRate);
 
 	infof("ctx", "dpi = %f", ctx->dpi);
 
@@ -300,22 +370,21 @@ void ctx_blend
 
 void ctx_save(struct context *ctx)
 {
-	mat4_t *m = malloc(sizeof(*m));
+	int n = ctx->ntransforms;
 
-	if (ctx->transforms == NULL) {
-		*m = mat4identity();
-	} else {
-		*m = *(mat4_t *)ctx->transforms->head;
-	}
-	list_push(&ctx->transforms, m);
-	ctx->transform = m;
+	if (n == MAX_TRANSFORMS)
+		fatal("ctx", "transform stack overflow");
+
+	ctx->transforms[n] = n ? ctx->transforms[n - 1] : mat4identity();
+	ctx->transform     = &ctx->transforms[n];
+	ctx->ntransforms   = n + 1;
 }
 
 void ctx_restore(struct context *ctx)
 {
-	if (list_length(ctx->transforms) > 1) {
-		free(list_pop(&ctx->transforms));
-		ctx->transform = ctx->transforms->head;
+	if (ctx->ntransforms > 1) {
+		ctx->ntransforms --;
+		ctx->transform = &ctx->transforms[ctx->ntransforms - 1];
 	}
 }
 
@@ -329,7 +398,6 @@ void ctx_destroy(struct context *ctx, const char *reason)
 	ctx_free_programs(ctx);
 	font_free(ctx->font);
 	framebuffer_free(ctx->screen);
-	list_consume(&ctx->transforms, free);
 
 	free(ctx);
 }
@@ -337,85 +405,97 @@ void ctx_destroy(struct context *ctx, const char *reason)
 void ctx_scale(struct context *ctx, float x, float y)
 {
 	mat4transform(ctx->transform, 0, 0, x, y);
-
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
 }
 
 void ctx_translation(struct context *ctx, float x, float y)
 {
 	*ctx->transform = mat4translate(*ctx->transform, vec3(x, y, 1.f));
-
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
 }
 
 void ctx_translate(struct context *ctx, float x, float y)
 {
 	mat4transform(ctx->transform, x, y, 1, 1);
-
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
 }
 
 void ctx_transform(struct context *ctx, mat4_t *tr)
 {
 	*ctx->transform = mat4mul(*ctx->transform, *tr);
-
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
 }
 
 void ctx_set_transform(struct context *ctx, mat4_t *tr)
 {
 	*ctx->transform = *tr;
-
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
 }
 
 void ctx_identity(struct context *ctx)
 {
 	*ctx->transform = mat4identity();
+}
+
+/* Upload the current transform to the bound program, if it changed since
+ * the last draw with that program, and apply the current blending. Must be
+ * called before issuing a draw. */
+void ctx_prepare(struct context *ctx)
+{
+	struct program *p = ctx->program;
 
-	if (ctx->program)
-		set_uniform_mat4(ctx->program, "transform", ctx->transform);
+	gl_blend(ctx->blend.color, ctx->blend.sfactor, ctx->blend.dfactor);
+
+	if (! p)
+		return;
+
+	if (! p->synced || ! mat4eq(&p->transform, ctx->transform)) {
+		set_uniform_mat4(p, UNIFORM_TRANSFORM, ctx->transform);
+		p->transform = *ctx->transform;
+		p->synced    = true;
+	}
 }
 
-void ctx_load_program(struct context *ctx, const char *name, const char *vertpath, const char *fragpath)
+void ctx_load_program(struct context *ctx, enum programid id, const char *name, const char *vertpath, const char *fragpath)
 {
 	struct program *p = program_load(name, vertpath, fragpath);
 
 	if (! p) fatalf("ctx", "failed to load program '%s'", name);
 
+	assert(! ctx->programs[id]);
+
+	ctx->programs[id] = p;
 	ctx_setup_program(ctx, p);
-	list_push(&ctx->programs, p);
 }
 
-void ctx_program(struct context *ctx, const char *name)
+/* Select the program used by subsequent draws. Selecting `PROGRAM_NONE`
+ * leaves the GL program bound, since no draws happen without a program,
+ * and it's likely to be selected again. */
+void ctx_program(struct context *ctx, enum programid id)
 {
-	struct program *p = NULL;
-	list_t         ps = ctx->programs;
+	struct program *p = ctx->programs[id];
 
-	if (! name) {
-		program_use(NULL);
-		ctx->program = NULL;
-		return;
-	}
+	ctx->program = p;
 
-	while (list_next(&ps, (void **)&p)) {
-		if (! strcmp(name, p->name)) {
-			ctx->program = p;
-			program_use(p);
-			ctx_setup_program_unifs(ctx, p);
-			break;
-		}
+	if (p)
+		program_use(p);
+}
+
+/* Restrict drawing to the given screen area, or lift the restriction if
+ * `NULL` is passed. */
+void ctx_clip(struct context *ctx, rect_t *r)
+{
+	if (! r) {
+		gl_scissor_disable();
+		return;
 	}
+	gl_scissor(
+		(int)floorf(r->x1),
+		(int)floorf(r->y1),
+		(int)ceilf(r->x2 - r->x1),
+		(int)ceilf(r->y2 - r->y1)
+	);
 }
 
 void ctx_present(struct context *ctx)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	trace_begin("draw", "ctx_present");
+	gl_bind_framebuffer(0);
 
 	gl_viewport(ctx->winw, ctx->winh);
 	gl_clear(0.f, 0.f, 0.f, 1.f);
@@ -424,7 +504,18 @@ void ctx_present(struct context *ctx)
 		ctx_scale(ctx, 2, 2);
 
 	framebuffer_draw(ctx->screen, ctx);
+
+	if (ctx->gputimer)
+		gl_timer_end(ctx->gputimer);
+
+	trace_begin("gl", "glfwSwapBuffers");
 	glfwSwapBuffers(ctx->win);
+	trace_end("gl", "glfwSwapBuffers");
+	latency_present();
+
+	gl_stats_frame(&ctx->glstats);
+	ctx_pacer_tick(&ctx->pacer);
+	trace_end("draw", "ctx_present");
 }
 
 void ctx_tick(struct context *ctx)
@@ -446,6 +537,59 @@ void ctx_tick_wait(struct context *ctx)
 	glfwWaitEvents();
 }
 
+/* Wait for events for at most `timeout` seconds. */
+void ctx_tick_timeout(struct context *ctx, double timeout)
+{
+	if (timeout > 0) {
+		glfwWaitEventsTimeout(timeout);
+	} else {
+		glfwPollEvents();
+	}
+}
+
+/* Wait for events until the given time, as returned by `ctx_time`. */
+void ctx_tick_until(struct context *ctx, double t)
+{
+	ctx_tick_timeout(ctx, t - glfwGetTime());
+}
+
+/* Set the frame pacing mode, and the target frame rate. In uncapped mode,
+ * the rate is only used as a reference for statistics. */
+void ctx_pace(struct context *ctx, enum pacing mode, double rate)
+{
+	struct pacer *p = &ctx->pacer;
+
+	if (rate <= 0)
+		rate = 60;
+
+	p->mode     = mode;
+	p->rate     = rate;
+	p->deadline = glfwGetTime();
+	p->jitter   = 0;
+
+	glfwSwapInterval(mode == PACE_VSYNC ? 1 : 0);
+}
+
+/* Whether it's time to draw the next frame. */
+bool ctx_frame_due(struct context *ctx)
+{
+	struct pacer *p = &ctx->pacer;
+
+	if (p->mode == PACE_UNCAPPED)
+		return true;
+
+	/* Allow for some timer slack when waking up. */
+	return glfwGetTime() >= p->deadline - 0.0005;
+}
+
+void ctx_frame_begin(struct context *ctx)
+{
+	ctx->pacer.start = glfwGetTime();
+
+	if (ctx->gputimer)
+		gl_timer_begin(ctx->gputimer);
+}
+
 void ctx_closewindow(struct context *ctx)
 {
 	glfwSetWindowShouldClose(ctx->win, true);
@@ -453,6 +597,9 @@ void ctx_closewindow(struct context *ctx)
 
 void ctx_fullscreen(struct context *ctx)
 {
+	if (! ctx->vidmode)
+		return;
+
 	glfwSetWindowPos(ctx->win, 0, 0);
 	glfwSetWindowSize(ctx->win, ctx->vidmode->width, ctx->vidmode->height);
 
@@ -489,11 +636,6 @@ bool ctx_keydown(struct context *ctx, int key)
 
 bool ctx_loop(struct context *ctx)
 {
-	double t = glfwGetTime();
-
-	ctx->frametime = (t - ctx->lastframe) * 1000.0f;
-	ctx->lastframe = t;
-
 	return ! glfwWindowShouldClose(ctx->win);
 }
 
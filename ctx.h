@@ -8,7 +8,8 @@
 #include "linmath.h"
 #include "cursor.h"
 
-typedef struct list *list_t;
+#define MAX_TRANSFORMS   32
+
 struct               font;
 
 struct blend {
@@ -16,25 +17,48 @@ struct blend {
 	vec4_t            color;
 };
 
+enum pacing {
+	PACE_VSYNC        = 0,      /* Limit to the target rate, and wait for vsync */
+	PACE_LOWLATENCY   = 1,      /* Limit to the target rate, without vsync */
+	PACE_UNCAPPED     = 2       /* Draw frames as fast as possible, for benchmarking */
+};
+
+struct pacer {
+	enum pacing       mode;
+	double            rate;         /* Target frame rate, in Hz */
+	double            deadline;     /* Time at which the next frame is due */
+	double            start;        /* Time at which the current frame started */
+	double            last;         /* Time at which the last frame was presented */
+	unsigned long     frames;       /* Number of frames presented */
+	double            frametime;    /* Time spent on the last frame, in ms */
+	double            interval;     /* Time between the last two frames, in ms */
+	double            average;      /* Moving average of `interval` */
+	double            jitter;       /* Largest deviation of `interval` from the target */
+};
+
 struct context {
 	GLFWwindow               *win;
 	const GLFWvidmode        *vidmode;
 	struct font              *font;
-	double                    lastframe;
-	double                    frametime;
+	struct pacer              pacer;
 	int                       winw, winh;
 	int                       width, height;
 	double                    cursorx, cursory;
-	list_t                    transforms;
+	mat4_t                    transforms[MAX_TRANSFORMS];
+	int                       ntransforms;
 	mat4_t                   *transform;
 	mat4_t                    ortho;
 	struct blend              blend;
 	struct framebuffer       *screen;
 	double                    dpi;
 	bool                      hidpi;
+	bool                      hidden;            /* Whether the window is hidden, eg. when
+	                                              * running tests. Set before `ctx_init`. */
 
-	list_t                    programs;
+	struct program           *programs[PROGRAM_MAX];
 	struct program           *program;
+	struct glstats            glstats;           /* GL statistics for the last frame */
+	struct gltimer           *gputimer;          /* Measures the GPU time of frames, if set */
 
 	// Input callbacks
 
@@ -45,6 +69,7 @@ struct context {
 	void                    (*on_resize)  (struct context *, int, int);
 	void                    (*on_move)    (struct context *, int, int);
 	void                    (*on_char)    (struct context *, unsigned int);
+	void                    (*on_refresh) (struct context *);
 
 	void                     *extra;
 };
@@ -54,6 +79,11 @@ void               ctx_destroy(struct context *, const char *);
 void               ctx_present(struct context *);
 void               ctx_tick(struct context *);
 void               ctx_tick_wait(struct context *);
+void               ctx_tick_timeout(struct context *, double);
+void               ctx_tick_until(struct context *, double);
+void               ctx_pace(struct context *, enum pacing, double);
+bool               ctx_frame_due(struct context *);
+void               ctx_frame_begin(struct context *);
 void               ctx_poll(struct context *);
 void               ctx_closewindow(struct context *);
 void               ctx_fullscreen(struct context *);
@@ -62,8 +92,9 @@ rect_t             ctx_windowrect(struct context *);
 bool               ctx_keydown(struct context *, int);
 bool               ctx_loop(struct context *);
 void               ctx_prepare(struct context *);
-void               ctx_load_program(struct context *, const char *, const char *, const char *);
-void               ctx_program(struct context *, const char *);
+void               ctx_clip(struct context *, rect_t *);
+void               ctx_load_program(struct context *, enum programid, const char *, const char *, const char *);
+void               ctx_program(struct context *, enum programid);
 void               ctx_scale(struct context *, float, float);
 void               ctx_translation(struct context *, float, float);
 void               ctx_translate(struct context *, float, float);
@@ -12,12 +12,13 @@
 #include "texture.h"
 #include "assert.h"
 #include "gl.h"
+#include "trace.h"
+#include "program.h"
 #include "ctx.h"
 #include "polygon.h"
 #include "text.h"
 #include "framebuffer.h"
 #include "util.h"
-#include "program.h"
 
 struct framebuffer *framebuffer_screen(int w, int h, void *pixels)
 {
@@ -68,7 +69,7 @@ struct framebuffer *framebuffer_from(struct texture *t)
 void framebuffer_free(struct framebuffer *fb)
 {
 	texture_free(fb->tex);
-	glDeleteFramebuffers(1, &fb->handle);
+	gl_delete_framebuffer(fb->handle);
 	free(fb);
 }
 
@@ -79,21 +80,21 @@ void framebuffer_attach(struct framebuffer *fb, struct texture *tex)
 	assert(tex->h);
 	assert(tex->handle);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, fb->handle);
+	gl_bind_framebuffer(fb->handle);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex->handle, 0);
 
 	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (status != GL_FRAMEBUFFER_COMPLETE) {
 		fatalf("framebuffer", "glCheckFramebufferStatus: error %u", status);
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gl_bind_framebuffer(0);
 }
 
 void framebuffer_bind(struct framebuffer *fb)
 {
 	assert(fb);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, fb->handle);
+	gl_bind_framebuffer(fb->handle);
 
 	/* NB: It's not clear why calling glViewport here breaks things.
 	 * Something must be awry in the way we use framebuffers.
@@ -104,55 +105,20 @@ void framebuffer_bind(struct framebuffer *fb)
 void framebuffer_draw(struct framebuffer *fb, struct context *ctx)
 {
 	struct texture *tex = fb->tex;
-	GLuint vao = fb->quad.vao;
-	GLuint vbo = fb->quad.vbo;
-	int nverts = (int)fb->quad.nverts;
 
 	// TODO: Get rid of distinction
-	if (fb->screen) ctx_program(ctx, "framebuffer");
-	else            ctx_program(ctx, "texture");
+	if (fb->screen) ctx_program(ctx, PROGRAM_FRAMEBUFFER);
+	else            ctx_program(ctx, PROGRAM_TEXTURE);
 
 	assert(tex->sampler);
 
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-	texture_bind(fb->tex);
-
-	vec4_t bcolor = ctx->blend.color;
-
-	// TODO: This should come from polygon, as it knows its data
-	glEnable(GL_BLEND);
-	glBlendColor(bcolor.r, bcolor.g, bcolor.b, bcolor.a);
-	glBlendFunc(ctx->blend.sfactor, ctx->blend.dfactor);
-	glEnableVertexAttribArray(VERTEX_ATTR);
-	glEnableVertexAttribArray(MULTIPLY_ATTR);
-	glVertexAttribPointer(
-		VERTEX_ATTR,                                  // Vertex attribute location
-		4,                                            // Number of vertex components
-		GL_FLOAT,                                     // Type
-		GL_FALSE,                                     // Normalized?
-		sizeof(struct vertex),                        // Stride
-		(void*)0                                      // Offset
-	);
-	glVertexAttribPointer(
-		MULTIPLY_ATTR,
-		4,
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(struct vertex),
-		(void*)offsetof(struct vertex, color)
-	);
-	glDrawArrays(GL_TRIANGLES, 0, nverts);                // Draw from vertex 0 to N
-	glDisableVertexAttribArray(VERTEX_ATTR);
-	glDisableVertexAttribArray(MULTIPLY_ATTR);
-	glDisable(GL_BLEND);
-
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	texture_bind(NULL);
-	ctx_program(ctx, NULL);
+	gl_bind_vertex_array(fb->quad.vao);
+	texture_bind(tex);
+
+	ctx_prepare(ctx);
+	gl_draw_triangles((int)fb->quad.nverts);
+
+	ctx_program(ctx, PROGRAM_NONE);
 }
 
 void framebuffer_draw_rect(struct context *ctx, struct framebuffer *fb, rect_t r, float sx, float sy)
@@ -175,7 +141,10 @@ rgba_t framebuffer_sample(struct framebuffer *fb, int x, int y)
 	framebuffer_bind(fb);
 
 	rgba_t color;
+	trace_begin("gl", "glReadPixels");
 	glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &color);
+	trace_end("gl", "glReadPixels");
+	gl_stats.readbacks ++;
 
 	return color;
 }
@@ -183,5 +152,8 @@ rgba_t framebuffer_sample(struct framebuffer *fb, int x, int y)
 void framebuffer_read(struct framebuffer *fb, rect_t r, rgba_t *buf)
 {
 	framebuffer_bind(fb);
+	trace_begin("gl", "glReadPixels");
 	glReadPixels((int)r.x1, (int)r.y1, (int)r.x2, (int)r.y2, GL_RGBA, GL_UNSIGNED_BYTE, buf);
+	trace_end("gl", "glReadPixels");
+	gl_stats.readbacks ++;
 }
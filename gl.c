@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <GL/glew.h>
 
 #include "linmath.h"
+#include "assert.h"
 #include "gl.h"
 #include "util.h"
+#include "program.h"
 
 static void initialize_debug_callback(void);
 
@@ -27,6 +31,32 @@ void _gl_errors(const char *file, int line)
 	}
 }
 
+/* Shadow of the GL state we change. Setting a piece of state to the value it
+ * already has is skipped, since most draw helpers set up the same state over
+ * and over again. Object deletion must go through `gl_delete_*`, so that a
+ * deleted name which is later reused isn't mistaken for being bound. */
+static struct {
+	GLuint      program;
+	GLuint      framebuffer;
+	GLuint      vao;
+	GLuint      vbo;
+	int         unit;
+	GLuint      textures[GL_MAX_UNITS];
+	GLuint      arrays[GL_MAX_UNITS];
+	GLuint      samplers[GL_MAX_UNITS];
+	vec4_t      bcolor;
+	GLenum      sfactor, dfactor;
+} state;
+
+struct glstats gl_stats;
+
+#define gl_shadow(field, value) \
+	if (state.field == (value)) { gl_stats.skipped ++; return; } \
+	state.field = (value); gl_stats.calls ++
+
+#define gl_forget(field, value) \
+	if (state.field == (value)) state.field = 0
+
 inline void gl_clear(float r, float g, float b, float a)
 {
 	glClearColor(r, g, b, a);
@@ -38,28 +68,247 @@ inline void gl_viewport(int w, int h)
 	glViewport(0, 0, w, h);
 }
 
-inline void gl_draw_triangles(int attrib, int nverts, int arity)
+/* Restrict drawing and clearing to the given area of the bound framebuffer. */
+void gl_scissor(int x, int y, int w, int h)
 {
-	gl_draw_triangles_blend(attrib, nverts, arity, vec4(0, 0, 0, 0), GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(x, y, w, h);
 }
 
-inline void gl_draw_triangles_blend(int attrib, int nverts, int arity, vec4_t bcolor, GLenum sfactor, GLenum dfactor)
+void gl_scissor_disable(void)
 {
-	glEnable(GL_BLEND);
-	glBlendColor(bcolor.r, bcolor.g, bcolor.b, bcolor.a);
-	glBlendFunc(sfactor, dfactor);
-	glEnableVertexAttribArray(attrib);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+void gl_draw_triangles(int nverts)
+{
+	gl_stats.calls ++;
+	gl_stats.draws ++;
+
+	glDrawArrays(GL_TRIANGLES, 0, nverts);                // Draw from vertex 0 to N
+}
+
+/* Set up the attributes of the bound vertex array, for the bound buffer.
+ * Vertices of arity 8 are laid out as a `struct vertex`. Since this state
+ * is stored in the vertex array, it only needs to be done once. */
+void gl_vertex_attribs(int arity)
+{
+	glEnableVertexAttribArray(VERTEX_ATTR);
+
+	if (arity != 8) {
+		glVertexAttribPointer(VERTEX_ATTR, arity, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		return;
+	}
+	glEnableVertexAttribArray(MULTIPLY_ATTR);
 	glVertexAttribPointer(
-		attrib,                                       // Vertex attribute location
-		arity,                                        // Number of vertex components
+		VERTEX_ATTR,                                  // Vertex attribute location
+		4,                                            // Number of vertex components
 		GL_FLOAT,                                     // Type
 		GL_FALSE,                                     // Normalized?
-		0,                                            // Stride
+		sizeof(struct vertex),                        // Stride
 		(void*)0                                      // Offset
 	);
-	glDrawArrays(GL_TRIANGLES, 0, nverts);                // Draw from vertex 0 to N
-	glDisableVertexAttribArray(attrib);
-	glDisable(GL_BLEND);
+	glVertexAttribPointer(
+		MULTIPLY_ATTR,
+		4,
+		GL_FLOAT,
+		GL_FALSE,
+		sizeof(struct vertex),
+		(void*)offsetof(struct vertex, color)
+	);
+}
+
+void gl_blend(vec4_t bcolor, GLenum sfactor, GLenum dfactor)
+{
+	if (state.sfactor != sfactor || state.dfactor != dfactor) {
+		glBlendFunc(sfactor, dfactor);
+		state.sfactor = sfactor;
+		state.dfactor = dfactor;
+		gl_stats.calls ++;
+	} else {
+		gl_stats.skipped ++;
+	}
+	if (memcmp(&state.bcolor, &bcolor, sizeof(bcolor))) {
+		glBlendColor(bcolor.r, bcolor.g, bcolor.b, bcolor.a);
+		state.bcolor = bcolor;
+		gl_stats.calls ++;
+	} else {
+		gl_stats.skipped ++;
+	}
+}
+
+void gl_use_program(GLuint p)
+{
+	gl_shadow(program, p);
+	glUseProgram(p);
+}
+
+void gl_bind_framebuffer(GLuint fb)
+{
+	gl_shadow(framebuffer, fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+}
+
+/* Get the bound framebuffer, without querying GL. */
+GLuint gl_framebuffer(void)
+{
+	return state.framebuffer;
+}
+
+void gl_bind_vertex_array(GLuint vao)
+{
+	gl_shadow(vao, vao);
+	glBindVertexArray(vao);
+}
+
+void gl_bind_buffer(GLuint vbo)
+{
+	gl_shadow(vbo, vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+}
+
+static void gl_active_texture(int unit)
+{
+	if (state.unit == unit)
+		return;
+
+	glActiveTexture(GL_TEXTURE0 + (GLenum)unit);
+	state.unit = unit;
+	gl_stats.calls ++;
+}
+
+void gl_bind_texture(int unit, GLuint t)
+{
+	assert(unit < GL_MAX_UNITS);
+
+	gl_shadow(textures[unit], t);
+	gl_active_texture(unit);
+	glBindTexture(GL_TEXTURE_2D, t);
+}
+
+void gl_bind_texture_array(int unit, GLuint t)
+{
+	assert(unit < GL_MAX_UNITS);
+
+	gl_shadow(arrays[unit], t);
+	gl_active_texture(unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, t);
+}
+
+void gl_bind_sampler(int unit, GLuint s)
+{
+	assert(unit < GL_MAX_UNITS);
+
+	gl_shadow(samplers[unit], s);
+	glBindSampler((GLuint)unit, s);
+}
+
+void gl_delete_program(GLuint p)
+{
+	gl_forget(program, p);
+	glDeleteProgram(p);
+}
+
+void gl_delete_framebuffer(GLuint fb)
+{
+	gl_forget(framebuffer, fb);
+	glDeleteFramebuffers(1, &fb);
+}
+
+void gl_delete_vertex_array(GLuint vao)
+{
+	gl_forget(vao, vao);
+	glDeleteVertexArrays(1, &vao);
+}
+
+void gl_delete_buffer(GLuint vbo)
+{
+	gl_forget(vbo, vbo);
+	glDeleteBuffers(1, &vbo);
+}
+
+void gl_delete_texture(GLuint t)
+{
+	for (int i = 0; i < GL_MAX_UNITS; i++) {
+		gl_forget(textures[i], t);
+		gl_forget(arrays[i], t);
+	}
+
+	glDeleteTextures(1, &t);
+}
+
+void gl_delete_sampler(GLuint s)
+{
+	for (int i = 0; i < GL_MAX_UNITS; i++)
+		gl_forget(samplers[i], s);
+
+	glDeleteSamplers(1, &s);
+}
+
+/* Copy the statistics gathered since the last call into `out`, and reset
+ * them. Meant to be called once per frame. */
+void gl_stats_frame(struct glstats *out)
+{
+	*out = gl_stats;
+	memset(&gl_stats, 0, sizeof(gl_stats));
+}
+
+void gl_timer_init(struct gltimer *t)
+{
+	*t = (struct gltimer){0};
+	glGenQueries(GL_TIMER_QUERIES, t->queries);
+}
+
+void gl_timer_free(struct gltimer *t)
+{
+	glDeleteQueries(GL_TIMER_QUERIES, t->queries);
+	*t = (struct gltimer){0};
+}
+
+/* Start timing. If every query is still waiting for its result, this
+ * measurement is skipped. */
+void gl_timer_begin(struct gltimer *t)
+{
+	if (t->pending == GL_TIMER_QUERIES)
+		return;
+
+	glBeginQuery(GL_TIME_ELAPSED, t->queries[t->next]);
+	t->running = true;
+}
+
+void gl_timer_end(struct gltimer *t)
+{
+	if (! t->running)
+		return;
+
+	glEndQuery(GL_TIME_ELAPSED);
+
+	t->running = false;
+	t->next    = (t->next + 1) % GL_TIMER_QUERIES;
+	t->pending ++;
+}
+
+/* Read the oldest measurement, in milliseconds, if it's available. */
+bool gl_timer_read(struct gltimer *t, double *ms)
+{
+	if (t->pending == 0)
+		return false;
+
+	GLuint   q = t->queries[(t->next - t->pending + GL_TIMER_QUERIES) % GL_TIMER_QUERIES];
+	GLint    available = 0;
+	GLuint64 ns;
+
+	glGetQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (! available)
+		return false;
+
+	glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+
+	*ms = (double)ns / 1e6;
+	t->pending --;
+
+	return true;
 }
 
 void gl_init(int w, int h, bool debug)
@@ -68,9 +317,16 @@ void gl_init(int w, int h, bool debug)
 	glewInit();
 
 	glViewport(0, 0, w, h);
+	glActiveTexture(GL_TEXTURE0);
+
+	/* Blending is always on. Draws which shouldn't blend use
+	 * `GL_ONE, GL_ZERO`. */
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+	state.sfactor = GL_SRC_ALPHA;
+	state.dfactor = GL_ONE_MINUS_SRC_ALPHA;
+
 	if (debug)
 		initialize_debug_callback();
 }
@@ -1,10 +1,58 @@
 #include <stdio.h>
 
+#define GL_MAX_UNITS     4
+#define GL_TIMER_QUERIES 4          /* Queries in flight, ie. frames results lag by */
+
+struct glstats {
+	unsigned long    calls;      /* State changes and draws issued */
+	unsigned long    skipped;    /* Redundant state changes skipped */
+	unsigned long    draws;
+	unsigned long    uniforms;   /* Uniform uploads */
+	unsigned long    buffers;    /* Buffer allocations */
+	unsigned long    uploads;    /* Texture uploads */
+	unsigned long    readbacks;  /* Pixel reads back from the GPU */
+};
+
+/* Measures GPU time with `GL_TIME_ELAPSED` queries. Results are read a few
+ * frames later, once they're available, so that measuring doesn't stall
+ * the pipeline. Only one timer can be running at a time. */
+struct gltimer {
+	GLuint           queries[GL_TIMER_QUERIES];
+	int              next;       /* Query to use next */
+	int              pending;    /* Queries ended, with results not yet read */
+	bool             running;
+};
+
+extern struct glstats gl_stats;
+
 void       gl_init(int, int, bool);
 void       gl_clear(float, float, float, float);
 void       gl_viewport(int, int);
-void       gl_draw_triangles(int, int, int);
-void       gl_draw_triangles_blend(int, int, int, vec4_t, GLenum, GLenum);
+void       gl_scissor(int, int, int, int);
+void       gl_scissor_disable(void);
+void       gl_draw_triangles(int);
+void       gl_vertex_attribs(int);
+void       gl_blend(vec4_t, GLenum, GLenum);
+void       gl_use_program(GLuint);
+void       gl_bind_framebuffer(GLuint);
+GLuint     gl_framebuffer(void);
+void       gl_bind_vertex_array(GLuint);
+void       gl_bind_buffer(GLuint);
+void       gl_bind_texture(int, GLuint);
+void       gl_bind_texture_array(int, GLuint);
+void       gl_bind_sampler(int, GLuint);
+void       gl_delete_program(GLuint);
+void       gl_delete_framebuffer(GLuint);
+void       gl_delete_vertex_array(GLuint);
+void       gl_delete_buffer(GLuint);
+void       gl_delete_texture(GLuint);
+void       gl_delete_sampler(GLuint);
+void       gl_stats_frame(struct glstats *);
+void       gl_timer_init(struct gltimer *);
+void       gl_timer_free(struct gltimer *);
+void       gl_timer_begin(struct gltimer *);
+void       gl_timer_end(struct gltimer *);
+bool       gl_timer_read(struct gltimer *, double *);
 
 void _gl_errors(const char *, int);
 
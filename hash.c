@@ -4,6 +4,14 @@
 //
 // (c) 2014, Alexis Sellier
 //
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
 #include "hash.h"
 
 //
@@ -22,3 +30,97 @@ unsigned long hash(const char *input, unsigned long len)
 	}
 	return hash;
 }
+
+//
+// Fast 64-bit hash function, for large inputs such as pixel data.
+//
+// The input is consumed 64 bytes at a time, as sixteen independent 32-bit
+// lanes, each mixed with the xxHash32 round. With SSE4.1, four lanes are
+// mixed per instruction. The scalar version computes the exact same result,
+// so digests are the same on every machine. The lanes are then folded into
+// 64 bits, along with the tail of the input, and the length.
+//
+// Not suitable for anything adversarial.
+//
+#define P32_1  0x9E3779B1u
+#define P32_2  0x85EBCA77u
+#define P64_1  0x9E3779B185EBCA87ull
+#define P64_2  0xC2B2AE3D27D4EB4Full
+#define P64_3  0x165667B19E3779F9ull
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix64(uint64_t h, uint64_t v)
+{
+	h ^= rotl64(v * P64_2, 31) * P64_1;
+	return rotl64(h, 27) * P64_1 + P64_3;
+}
+
+uint64_t hash64(const void *input, size_t len)
+{
+	const uint8_t *p      = input;
+	size_t         rounds = len / 64;
+	uint32_t       lanes[16];
+
+	for (int i = 0; i < 16; i++)
+		lanes[i] = P32_1 * (uint32_t)(i + 1);
+
+#if defined(__SSE4_1__)
+	__m128i acc[4], prime1 = _mm_set1_epi32((int)P32_1),
+	                prime2 = _mm_set1_epi32((int)P32_2);
+
+	for (int i = 0; i < 4; i++)
+		acc[i] = _mm_loadu_si128((const __m128i *)lanes + i);
+
+	for (size_t r = 0; r < rounds; r++, p += 64) {
+		for (int i = 0; i < 4; i++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)p + i);
+			__m128i a = _mm_add_epi32(acc[i], _mm_mullo_epi32(v, prime2));
+
+			a      = _mm_or_si128(_mm_slli_epi32(a, 13), _mm_srli_epi32(a, 19));
+			acc[i] = _mm_mullo_epi32(a, prime1);
+		}
+	}
+	for (int i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i *)lanes + i, acc[i]);
+#else
+	for (size_t r = 0; r < rounds; r++, p += 64) {
+		for (int i = 0; i < 16; i++) {
+			uint32_t v;
+			memcpy(&v, p + i * 4, sizeof(v));
+
+			lanes[i] = rotl32(lanes[i] + v * P32_2, 13) * P32_1;
+		}
+	}
+#endif
+	uint64_t h = P64_3 ^ (uint64_t)len;
+
+	for (int i = 0; i < 16; i += 2)
+		h = mix64(h, (uint64_t)lanes[i] << 32 | lanes[i + 1]);
+
+	for (size_t rest = len % 64; rest >= 8; rest -= 8, p += 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+
+		h = mix64(h, v);
+	}
+	for (const uint8_t *end = (const uint8_t *)input + len; p < end; p++)
+		h = rotl64(h ^ (*p * P64_3), 11) * P64_1;
+
+	/* Avalanche, so that every input bit affects every output bit. */
+	h ^= h >> 33;
+	h *= P64_2;
+	h ^= h >> 29;
+	h *= P64_3;
+	h ^= h >> 32;
+
+	return h;
+}
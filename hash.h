@@ -3,3 +3,4 @@
 // hash functions
 //
 extern unsigned long hash(const char *, unsigned long);
+extern uint64_t      hash64(const void *, size_t);
@@ -0,0 +1,201 @@
+//
+// histogram.c
+// color histograms
+//
+// Colors are counted in an open-addressing hash table, keyed by the color
+// packed into 32 bits. Keys, counts and order live in separate arrays, so
+// that probing only touches the keys. Runs of the same color, which are
+// common in pixel art, are counted with a single lookup. Fully transparent
+// pixels aren't counted, which frees up the zero key to mark empty slots.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "color.h"
+#include "histogram.h"
+
+#define HISTOGRAM_INITIAL   1024
+
+static inline uint32_t pack(rgba_t c)
+{
+	uint32_t k;
+	memcpy(&k, &c, sizeof(k));
+
+	return k;
+}
+
+static inline rgba_t unpack(uint32_t k)
+{
+	rgba_t c;
+	memcpy(&c, &k, sizeof(c));
+
+	return c;
+}
+
+static inline uint32_t slot(const struct histogram *h, uint32_t key)
+{
+	return (key * 0x9E3779B1u) & (uint32_t)(h->cap - 1);
+}
+
+static void histogram_alloc(struct histogram *h, int cap)
+{
+	h->cap    = cap;
+	h->keys   = calloc((size_t)cap, sizeof(*h->keys));
+	h->counts = calloc((size_t)cap, sizeof(*h->counts));
+	h->order  = calloc((size_t)cap, sizeof(*h->order));
+}
+
+void histogram_init(struct histogram *h)
+{
+	histogram_alloc(h, HISTOGRAM_INITIAL);
+
+	h->len   = 0;
+	h->total = 0;
+}
+
+void histogram_free(struct histogram *h)
+{
+	free(h->keys);
+	free(h->counts);
+	free(h->order);
+}
+
+/* Double the number of slots, and re-insert every color. */
+static void histogram_grow(struct histogram *h)
+{
+	struct histogram old = *h;
+
+	histogram_alloc(h, old.cap * 2);
+
+	for (int i = 0; i < old.cap; i++) {
+		if (! old.keys[i])
+			continue;
+
+		uint32_t s = slot(h, old.keys[i]);
+
+		while (h->keys[s])
+			s = (s + 1) & (uint32_t)(h->cap - 1);
+
+		h->keys[s]   = old.keys[i];
+		h->counts[s] = old.counts[i];
+		h->order[s]  = old.order[i];
+	}
+	histogram_free(&old);
+}
+
+static void histogram_count(struct histogram *h, uint32_t key, uint32_t n)
+{
+	if (unpack(key).a == 0)
+		return;
+
+	uint32_t s = slot(h, key);
+
+	while (h->keys[s] && h->keys[s] != key)
+		s = (s + 1) & (uint32_t)(h->cap - 1);
+
+	if (! h->keys[s]) {
+		/* Keep the load factor under one half, so that probes stay short. */
+		if ((h->len + 1) * 2 > h->cap) {
+			histogram_grow(h);
+			histogram_count(h, key, n);
+			return;
+		}
+		h->keys[s]  = key;
+		h->order[s] = (uint32_t)h->len ++;
+	}
+	h->counts[s] += n;
+	h->total     += n;
+}
+
+/* Count `n` pixels. */
+void histogram_add(struct histogram *h, const rgba_t *pixels, size_t n)
+{
+	if (n == 0)
+		return;
+
+	uint32_t run = pack(pixels[0]),
+	         len = 1;
+
+	for (size_t i = 1; i < n; i++) {
+		uint32_t key = pack(pixels[i]);
+
+		if (key == run) {
+			len ++;
+			continue;
+		}
+		histogram_count(h, run, len);
+
+		run = key;
+		len = 1;
+	}
+	histogram_count(h, run, len);
+}
+
+/* Count the colors of another histogram. Colors `src` has seen first are
+ * ordered after those already in `h`, so merging histograms of consecutive
+ * runs of pixels gives the same order as counting them in one go. */
+void histogram_merge(struct histogram *h, struct histogram *src)
+{
+	struct hcolor *colors = histogram_colors(src, false);
+
+	for (int i = 0; i < src->len; i++)
+		histogram_count(h, pack(colors[i].color), colors[i].count);
+
+	free(colors);
+}
+
+/* Get the order in which a color was first seen, or -1 if it wasn't. */
+int histogram_find(const struct histogram *h, rgba_t c)
+{
+	uint32_t key = pack(c),
+	         s   = slot(h, key);
+
+	if (! key)
+		return -1;
+
+	while (h->keys[s]) {
+		if (h->keys[s] == key)
+			return (int)h->order[s];
+
+		s = (s + 1) & (uint32_t)(h->cap - 1);
+	}
+	return -1;
+}
+
+static int hcolor_cmp_count(const void *a, const void *b)
+{
+	const struct hcolor *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+
+	return x->order < y->order ? -1 : 1;
+}
+
+static int hcolor_cmp_order(const void *a, const void *b)
+{
+	const struct hcolor *x = a, *y = b;
+
+	return x->order < y->order ? -1 : 1;
+}
+
+/* Get the colors counted, most frequent first if `byfreq` is set, otherwise
+ * in the order they were first seen. The caller frees the result, which
+ * has `len` entries. */
+struct hcolor *histogram_colors(struct histogram *h, bool byfreq)
+{
+	struct hcolor *colors = malloc(sizeof(*colors) * (size_t)(h->len ? h->len : 1));
+	int            n      = 0;
+
+	for (int i = 0; i < h->cap; i++) {
+		if (! h->keys[i])
+			continue;
+
+		colors[n ++] = (struct hcolor){ unpack(h->keys[i]), h->counts[i], h->order[i] };
+	}
+	qsort(colors, (size_t)n, sizeof(*colors), byfreq ? hcolor_cmp_count : hcolor_cmp_order);
+
+	return colors;
+}
@@ -0,0 +1,25 @@
+//
+// histogram.h
+// color histograms
+//
+struct histogram {
+	uint32_t        *keys;      /* Packed colors, 0 for empty slots */
+	uint32_t        *counts;
+	uint32_t        *order;     /* Order in which colors were first seen */
+	int              cap;       /* Number of slots, a power of two */
+	int              len;       /* Number of colors */
+	unsigned long    total;     /* Number of pixels counted */
+};
+
+struct hcolor {
+	rgba_t           color;
+	uint32_t         count;
+	uint32_t         order;
+};
+
+void             histogram_init(struct histogram *);
+void             histogram_free(struct histogram *);
+void             histogram_add(struct histogram *, const rgba_t *, size_t);
+void             histogram_merge(struct histogram *, struct histogram *);
+int              histogram_find(const struct histogram *, rgba_t);
+struct hcolor   *histogram_colors(struct histogram *, bool);
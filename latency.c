@@ -0,0 +1,208 @@
+//
+// latency.c
+// input-to-photon latency of painting and other input
+//
+// Inputs are timestamped as they arrive in the GLFW callbacks. If handling
+// one changes what's on screen, it's carried over to the next frame that's
+// presented, and its latency is taken when the buffer swap returns. A fence
+// and a timestamp query are issued after the swap, and once the fence is
+// signaled, the query tells when the GPU was done with the frame, which is
+// as close to the photons as we can see. GPU timestamps are converted to
+// CPU time with an offset taken when measuring starts.
+//
+// Painting is told apart from other motion and button input by `brush_tick`
+// calling `latency_result` while the input is being handled.
+//
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "bench.h"
+#include "latency.h"
+
+struct latency latency;
+
+const char *latency_inputs[INPUT_TYPES] = {
+	[INPUT_KEY]    = "key",
+	[INPUT_BUTTON] = "button",
+	[INPUT_MOTION] = "motion",
+	[INPUT_STROKE] = "stroke",
+};
+
+static void latency_frame_drop(struct latencyframe *f)
+{
+	if (f->fence) {
+		glDeleteSync(f->fence);
+		f->fence = NULL;
+		latency.dropped += (unsigned long)f->ninputs;
+	}
+	f->ninputs = 0;
+}
+
+/* Start or stop measuring. Starting discards earlier measurements. Must be
+ * called with a GL context current. */
+void latency_enable(bool enabled)
+{
+	if (enabled == latency.enabled)
+		return;
+
+	for (int i = 0; i < LATENCY_FRAMES; i++) {
+		struct latencyframe *f = &latency.frames[i];
+
+		if (enabled) {
+			glGenQueries(1, &f->query);
+		} else {
+			latency_frame_drop(f);
+			glDeleteQueries(1, &f->query);
+		}
+	}
+	if (enabled) {
+		GLint64 t;
+
+		glGetInteger64v(GL_TIMESTAMP, &t);
+
+		latency.offset  = glfwGetTime() - (double)t / 1e9;
+		latency.dropped = 0;
+		latency.head    = 0;
+
+		for (int i = 0; i < INPUT_TYPES; i++) {
+			latency.swap[i].len = 0;
+			latency.gpu[i].len  = 0;
+		}
+	}
+	latency.next.ninputs = 0;
+	latency.handling     = false;
+	latency.enabled      = enabled;
+}
+
+/* Called as an input arrives, before it's handled. */
+void latency_input(enum inputtype t)
+{
+	if (! latency.enabled)
+		return;
+
+	latency.current  = (struct latencyinput){ .type = t, .time = glfwGetTime() };
+	latency.handling = true;
+	latency.changed  = false;
+}
+
+/* Called once the input has been handled. */
+void latency_input_end(void)
+{
+	if (! latency.handling)
+		return;
+
+	struct latencyframe *f = &latency.next;
+
+	if (latency.changed) {
+		if (f->ninputs < LATENCY_INPUTS)
+			f->inputs[f->ninputs++] = latency.current;
+		else
+			latency.dropped ++;
+	}
+	latency.handling = false;
+}
+
+/* Called when handling the current input changes what's on screen, with
+ * `stroke` set if it painted. Does nothing outside of input handling. */
+void latency_result(bool stroke)
+{
+	if (! latency.handling)
+		return;
+
+	latency.changed = true;
+
+	if (stroke)
+		latency.current.type = INPUT_STROKE;
+}
+
+/* Called when the buffer swap returns. */
+void latency_present(void)
+{
+	struct latencyframe *next = &latency.next;
+
+	if (! latency.enabled || next->ninputs == 0)
+		return;
+
+	double now = glfwGetTime();
+
+	for (int i = 0; i < next->ninputs; i++) {
+		struct latencyinput *in = &next->inputs[i];
+
+		samples_add(&latency.swap[in->type], (now - in->time) * 1000.);
+	}
+	struct latencyframe *f = &latency.frames[latency.head];
+
+	latency_frame_drop(f);
+
+	f->ninputs = next->ninputs;
+	memcpy(f->inputs, next->inputs, sizeof(*f->inputs) * (size_t)next->ninputs);
+
+	glQueryCounter(f->query, GL_TIMESTAMP);
+	f->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	latency.head  = (latency.head + 1) % LATENCY_FRAMES;
+	next->ninputs = 0;
+}
+
+/* Take the GPU latency of frames the GPU is done with, without waiting. */
+void latency_poll(void)
+{
+	if (! latency.enabled)
+		return;
+
+	for (int i = 0; i < LATENCY_FRAMES; i++) {
+		struct latencyframe *f = &latency.frames[i];
+
+		if (! f->fence)
+			continue;
+
+		GLenum status = glClientWaitSync(f->fence, 0, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		GLuint64 ns;
+
+		glGetQueryObjectui64v(f->query, GL_QUERY_RESULT, &ns);
+		glDeleteSync(f->fence);
+		f->fence = NULL;
+
+		double done = (double)ns / 1e9 + latency.offset;
+
+		for (int j = 0; j < f->ninputs; j++) {
+			struct latencyinput *in = &f->inputs[j];
+
+			samples_add(&latency.gpu[in->type], (done - in->time) * 1000.);
+		}
+		f->ninputs = 0;
+	}
+}
+
+static void latency_report_table(FILE *fp, const char *title, struct samples *samples)
+{
+	fprintf(fp, "%s\n", title);
+	fprintf(fp, "%-8s %8s %8s %8s %8s %8s\n", "input", "count", "p50", "p95", "p99", "max");
+
+	for (int i = 0; i < INPUT_TYPES; i++) {
+		struct samples *s = &samples[i];
+
+		fprintf(fp, "%-8s %8zu %8.2f %8.2f %8.2f %8.2f\n", latency_inputs[i], s->len,
+			samples_percentile(s, 50), samples_percentile(s, 95), samples_percentile(s, 99),
+			samples_percentile(s, 100));
+	}
+}
+
+/* Write the latency distribution of each input type, in milliseconds. */
+void latency_report(FILE *fp)
+{
+	latency_report_table(fp, "input to swap", latency.swap);
+	fprintf(fp, "\n");
+	latency_report_table(fp, "input to GPU done", latency.gpu);
+
+	if (latency.dropped)
+		fprintf(fp, "\n%lu inputs dropped\n", latency.dropped);
+}
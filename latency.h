@@ -0,0 +1,52 @@
+//
+// latency.h
+// input-to-photon latency of painting and other input
+//
+#define LATENCY_FRAMES   4          /* Frames waited on at once */
+#define LATENCY_INPUTS   256        /* Inputs measured per frame */
+
+enum inputtype {
+	INPUT_KEY        = 0,
+	INPUT_BUTTON     = 1,
+	INPUT_MOTION     = 2,
+	INPUT_STROKE     = 3,       /* Motion or button input which painted */
+	INPUT_TYPES      = 4
+};
+
+struct latencyinput {
+	enum inputtype   type;
+	double           time;      /* Time at which the input arrived, in seconds */
+};
+
+/* Inputs shown by a frame. */
+struct latencyframe {
+	struct latencyinput inputs[LATENCY_INPUTS];
+	int              ninputs;
+	GLsync           fence;     /* Signaled once the GPU is done with the frame */
+	GLuint           query;     /* GPU time at which it was done */
+};
+
+struct latency {
+	bool             enabled;
+	double           offset;    /* CPU time minus GPU time, in seconds */
+	bool             handling;  /* Whether `current` is being handled */
+	bool             changed;   /* Whether `current` changed what's on screen */
+	struct latencyinput  current;
+	struct latencyframe  next;                   /* Inputs not yet presented */
+	struct latencyframe  frames[LATENCY_FRAMES]; /* Frames presented, waiting on the GPU */
+	int              head;
+	struct samples   swap[INPUT_TYPES];   /* Latency until the buffer swap returned, in ms */
+	struct samples   gpu[INPUT_TYPES];    /* Latency until the GPU was done, in ms */
+	unsigned long    dropped;             /* Inputs which couldn't be measured */
+};
+
+extern struct latency   latency;
+extern const char      *latency_inputs[INPUT_TYPES];
+
+void             latency_enable(bool);
+void             latency_input(enum inputtype);
+void             latency_input_end(void);
+void             latency_result(bool);
+void             latency_present(void);
+void             latency_poll(void);
+void             latency_report(FILE *);
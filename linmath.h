@@ -14,6 +14,10 @@
 #include <smmintrin.h>
 #endif
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 static const float PI = 3.14149265359f;
 
 #define vnorm(A) _Generic((A), vec3_t: vec3norm, vec4_t: vec4norm)
@@ -198,6 +202,19 @@ static inline bool rect_isempty(rect_t r)
 	return r.x1 == r.x2 || r.y1 == r.y2;
 }
 
+static inline rect_t rect_union(rect_t a, rect_t b)
+{
+	if (rect_isempty(a)) return b;
+	if (rect_isempty(b)) return a;
+
+	return rect(
+		fminf(a.x1, b.x1),
+		fminf(a.y1, b.y1),
+		fmaxf(a.x2, b.x2),
+		fmaxf(a.y2, b.y2)
+	);
+}
+
 static inline rect_t rect_flipy(rect_t r)
 {
 	return rect(r.x1, -r.y1, r.x2, -r.y2);
@@ -468,6 +485,21 @@ static inline mat4_t mat4mul(mat4_t a, mat4_t b)
 {
 	mat4_t out;
 
+#if defined(__SSE__)
+	/* Each output column is a linear combination of the columns of `a`. */
+	__m128 a0 = _mm_loadu_ps(a.cols[0].n);
+	__m128 a1 = _mm_loadu_ps(a.cols[1].n);
+	__m128 a2 = _mm_loadu_ps(a.cols[2].n);
+	__m128 a3 = _mm_loadu_ps(a.cols[3].n);
+
+	for (int c = 0; c < 4; ++c) {
+		__m128 col = _mm_mul_ps(a0, _mm_set1_ps(b.cols[c].n[0]));
+		col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(b.cols[c].n[1])));
+		col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(b.cols[c].n[2])));
+		col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(b.cols[c].n[3])));
+		_mm_storeu_ps(out.cols[c].n, col);
+	}
+#else
 	for (int c = 0; c < 4; ++c) {
 		for (int r = 0; r < 4; ++r) {
 			out.cols[c].n[r] = 0.0f;
@@ -476,18 +508,46 @@ static inline mat4_t mat4mul(mat4_t a, mat4_t b)
 			}
 		}
 	}
+#endif
 	return out;
 }
 
 static inline mat4_t mat4translate(mat4_t a, vec3_t t)
 {
 	mat4_t out = a;
+#if defined(__SSE__)
+	_mm_storeu_ps(out.cols[3].n, _mm_setr_ps(t.x, t.y, t.z, a.cols[3].w));
+#else
 	out.cols[3].x = t.x;
 	out.cols[3].y = t.y;
 	out.cols[3].z = t.z;
+#endif
 	return out;
 }
 
+static inline bool mat4eq(mat4_t *a, mat4_t *b)
+{
+#if defined(__SSE__)
+	__m128 eq = _mm_and_ps(
+		_mm_and_ps(
+			_mm_cmpeq_ps(_mm_loadu_ps(a->cols[0].n), _mm_loadu_ps(b->cols[0].n)),
+			_mm_cmpeq_ps(_mm_loadu_ps(a->cols[1].n), _mm_loadu_ps(b->cols[1].n))),
+		_mm_and_ps(
+			_mm_cmpeq_ps(_mm_loadu_ps(a->cols[2].n), _mm_loadu_ps(b->cols[2].n)),
+			_mm_cmpeq_ps(_mm_loadu_ps(a->cols[3].n), _mm_loadu_ps(b->cols[3].n))));
+
+	return _mm_movemask_ps(eq) == 0xf;
+#else
+	for (int c = 0; c < 4; ++c) {
+		for (int r = 0; r < 4; ++r) {
+			if (a->cols[c].n[r] != b->cols[c].n[r])
+				return false;
+		}
+	}
+	return true;
+#endif
+}
+
 static inline vec3_t mat4translation(mat4_t *a)
 {
 	return vec3(a->cols[3].x, a->cols[3].y, a->cols[3].z);
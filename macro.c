@@ -0,0 +1,387 @@
+//
+// macro.c
+// recording and playback of macros
+//
+// Macros are recorded in a compact binary encoding, appended to a list of
+// large chunks, so that recording doesn't allocate for each step. Each step
+// is an opcode followed by the delay since the previous step, in
+// milliseconds, and the step's operands, all as varints. Cursor moves, which
+// make up most of a recording, are stored relative to the previous position,
+// and command names are stored once, the first time they're used, and then
+// referred to by index.
+//
+// Playback turns each step back into a command, with delays turned into
+// `sleep` commands, which is also how macros are written out as text. Macro
+// files in either encoding can be played, and converted to the other.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "util.h"
+#include "macro.h"
+
+#define MACRO_MAGIC      "PXM\x01"
+
+enum macroop {
+	OP_MOVE,                    /* Cursor move, relative to the last position */
+	OP_DOWN,                    /* Mouse button press */
+	OP_UP,                      /* Mouse button release */
+	OP_COMMAND,                 /* Command name index, and its arguments */
+	OP_SLEEP                    /* Delay, with nothing following it */
+};
+
+static void names_free(struct macronames *n)
+{
+	for (int i = 0; i < n->len; i++)
+		free(n->names[i]);
+	free(n->names);
+
+	*n = (struct macronames){0};
+}
+
+static int names_find(struct macronames *n, const char *name, size_t len)
+{
+	for (int i = 0; i < n->len; i++) {
+		if (strlen(n->names[i]) == len && ! memcmp(n->names[i], name, len))
+			return i;
+	}
+	return -1;
+}
+
+static int names_add(struct macronames *n, const char *name, size_t len)
+{
+	if (n->len == n->cap) {
+		n->cap   = n->cap ? n->cap * 2 : 32;
+		n->names = realloc(n->names, sizeof(*n->names) * (size_t)n->cap);
+	}
+	char *s = malloc(len + 1);
+
+	memcpy(s, name, len);
+	s[len] = '\0';
+
+	n->names[n->len] = s;
+
+	return n->len ++;
+}
+
+/** RECORDING *****************************************************************/
+
+void macro_init(struct macro *m)
+{
+	*m = (struct macro){0};
+}
+
+void macro_free(struct macro *m)
+{
+	struct macrochunk *c = m->head, *next;
+
+	for (; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	names_free(&m->names);
+	macro_init(m);
+}
+
+static void put(struct macro *m, uint8_t b)
+{
+	if (! m->tail || m->tail->len == MACRO_CHUNK) {
+		struct macrochunk *c = malloc(sizeof(*c));
+
+		c->next = NULL;
+		c->len  = 0;
+
+		if (m->tail)
+			m->tail->next = c;
+		else
+			m->head = c;
+		m->tail = c;
+	}
+	m->tail->data[m->tail->len ++] = b;
+	m->size ++;
+}
+
+static void put_varint(struct macro *m, unsigned long v)
+{
+	for (; v >= 0x80; v >>= 7)
+		put(m, (uint8_t)(v | 0x80));
+	put(m, (uint8_t)v);
+}
+
+/* Small values of either sign are stored in few bytes. */
+static void put_signed(struct macro *m, long v)
+{
+	put_varint(m, v < 0 ? ((unsigned long)(-(v + 1)) << 1) | 1 : (unsigned long)v << 1);
+}
+
+static void put_bytes(struct macro *m, const char *s, size_t len)
+{
+	put_varint(m, len);
+
+	for (size_t i = 0; i < len; i++)
+		put(m, (uint8_t)s[i]);
+}
+
+/* Record a command, run `delay` milliseconds after the previous one. */
+void macro_add(struct macro *m, unsigned long delay, const char *cmd)
+{
+	int  x, y, n = 0;
+
+	if (sscanf(cmd, "cursor/move %d %d%n", &x, &y, &n) == 2 && cmd[n] == '\0') {
+		put(m, OP_MOVE);
+		put_varint(m, delay);
+		put_signed(m, (long)x - m->x);
+		put_signed(m, (long)y - m->y);
+
+		m->x = x;
+		m->y = y;
+	} else if (! strcmp(cmd, "cursor/down")) {
+		put(m, OP_DOWN);
+		put_varint(m, delay);
+	} else if (! strcmp(cmd, "cursor/up")) {
+		put(m, OP_UP);
+		put_varint(m, delay);
+	} else if (! strcmp(cmd, "")) {
+		put(m, OP_SLEEP);
+		put_varint(m, delay);
+	} else {
+		size_t      len  = strcspn(cmd, " ");
+		const char *args = cmd[len] ? cmd + len + 1 : cmd + len;
+		int         idx  = names_find(&m->names, cmd, len);
+
+		put(m, OP_COMMAND);
+		put_varint(m, delay);
+
+		if (idx < 0) {
+			put_varint(m, (unsigned long)names_add(&m->names, cmd, len));
+			put_bytes(m, cmd, len);
+		} else {
+			put_varint(m, (unsigned long)idx);
+		}
+		put_bytes(m, args, strlen(args));
+	}
+	m->steps ++;
+}
+
+/* Write a recording to a file, in the binary encoding. */
+bool macro_save(struct macro *m, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+
+	if (! fp)
+		return false;
+
+	fwrite(MACRO_MAGIC, 1, strlen(MACRO_MAGIC), fp);
+
+	for (struct macrochunk *c = m->head; c; c = c->next)
+		fwrite(c->data, 1, c->len, fp);
+
+	return fclose(fp) == 0;
+}
+
+/** PLAYBACK ******************************************************************/
+
+static bool get_varint(FILE *fp, unsigned long *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+
+	do {
+		if ((c = fgetc(fp)) == EOF || shift > 56)
+			return false;
+
+		*v    |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return true;
+}
+
+static bool get_signed(FILE *fp, long *v)
+{
+	unsigned long u;
+
+	if (! get_varint(fp, &u))
+		return false;
+
+	*v = u & 1 ? -(long)(u >> 1) - 1 : (long)(u >> 1);
+
+	return true;
+}
+
+/* Read `len` bytes into `buf`, which holds `n`, as a string. Longer strings
+ * are truncated. */
+static bool get_bytes(FILE *fp, char *buf, size_t n, unsigned long len)
+{
+	size_t keep = len < n ? (size_t)len : n - 1;
+
+	if (fread(buf, 1, keep, fp) != keep)
+		return false;
+	buf[keep] = '\0';
+
+	return fseek(fp, (long)(len - keep), SEEK_CUR) == 0;
+}
+
+/* Decode the next step into a command, along with its delay. */
+static bool macro_step(struct macroreader *r, char *cmd, size_t n, unsigned long *delay)
+{
+	int           op = fgetc(r->fp);
+	long          dx, dy;
+	unsigned long idx, len;
+
+	if (op == EOF || ! get_varint(r->fp, delay))
+		return false;
+
+	switch (op) {
+	case OP_MOVE:
+		if (! get_signed(r->fp, &dx) || ! get_signed(r->fp, &dy))
+			return false;
+
+		r->x += (int)dx;
+		r->y += (int)dy;
+
+		snprintf(cmd, n, "cursor/move %d %d", r->x, r->y);
+		return true;
+	case OP_DOWN:
+		snprintf(cmd, n, "cursor/down");
+		return true;
+	case OP_UP:
+		snprintf(cmd, n, "cursor/up");
+		return true;
+	case OP_SLEEP:
+		cmd[0] = '\0';
+		return true;
+	case OP_COMMAND: {
+		char name[MACRO_LINE], args[MACRO_LINE];
+
+		if (! get_varint(r->fp, &idx) || idx > (unsigned long)r->names.len)
+			return false;
+
+		if (idx == (unsigned long)r->names.len) {
+			if (! get_varint(r->fp, &len) || ! get_bytes(r->fp, name, sizeof(name), len))
+				return false;
+			names_add(&r->names, name, strlen(name));
+		}
+		if (! get_varint(r->fp, &len) || ! get_bytes(r->fp, args, sizeof(args), len))
+			return false;
+
+		snprintf(cmd, n, *args ? "%s %s" : "%s", r->names.names[idx], args);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/* Open a macro file for playback, in either encoding. */
+bool macro_open(struct macroreader *r, const char *path)
+{
+	char magic[4] = {0};
+
+	*r = (struct macroreader){0};
+
+	if (! (r->fp = fopen(path, "rb")))
+		return false;
+
+	r->binary = fread(magic, 1, sizeof(magic), r->fp) == sizeof(magic) &&
+	            ! memcmp(magic, MACRO_MAGIC, sizeof(magic));
+
+	if (! r->binary)
+		rewind(r->fp);
+
+	return true;
+}
+
+/* Read the next command of a macro, as text. Delays are read as `sleep`
+ * commands. Returns false at the end of the macro. */
+bool macro_read(struct macroreader *r, char *cmd, size_t n)
+{
+	unsigned long delay;
+
+	if (! r->binary)
+		return fgetstr(cmd, (int)n, r->fp) != NULL;
+
+	if (r->next[0]) {
+		snprintf(cmd, n, "%s", r->next);
+		r->next[0] = '\0';
+
+		return true;
+	}
+	if (! macro_step(r, r->next, sizeof(r->next), &delay))
+		return false;
+
+	if (delay > 0) {
+		snprintf(cmd, n, "sleep %lu", delay);
+	} else {
+		snprintf(cmd, n, "%s", r->next);
+		r->next[0] = '\0';
+	}
+	return true;
+}
+
+void macro_close(struct macroreader *r)
+{
+	if (r->fp)
+		fclose(r->fp);
+	names_free(&r->names);
+
+	*r = (struct macroreader){0};
+}
+
+/* Convert a macro file to the other encoding: binary files are written out
+ * as text, and text files are encoded. Returns the number of steps
+ * converted, or -1 if either file can't be opened. */
+int macro_convert(const char *src, const char *dst)
+{
+	struct macroreader r;
+	char               cmd[MACRO_LINE];
+	int                steps = 0;
+
+	if (! macro_open(&r, src))
+		return -1;
+
+	if (r.binary) {
+		FILE *fp = fopen(dst, "w");
+
+		if (! fp) {
+			macro_close(&r);
+			return -1;
+		}
+		for (; macro_read(&r, cmd, sizeof(cmd)); steps ++)
+			fprintf(fp, "%s\n", cmd);
+
+		fclose(fp);
+		macro_close(&r);
+
+		return steps;
+	}
+	/* Sleeps become the delay of the step following them. */
+	struct macro  m;
+	unsigned long delay = 0, ms;
+	int           k;
+
+	macro_init(&m);
+
+	while (macro_read(&r, cmd, sizeof(cmd))) {
+		if (sscanf(cmd, "sleep %lu%n", &ms, &k) == 1 && cmd[k] == '\0') {
+			delay += ms;
+		} else if (cmd[0]) {
+			macro_add(&m, delay, cmd);
+			delay = 0;
+		}
+	}
+	if (delay > 0)
+		macro_add(&m, delay, "");
+
+	macro_close(&r);
+
+	steps = macro_save(&m, dst) ? m.steps : -1;
+	macro_free(&m);
+
+	return steps;
+}
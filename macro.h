@@ -0,0 +1,45 @@
+//
+// macro.h
+// recording and playback of macros
+//
+#define MACRO_LINE       1024       /* Longest command of a macro */
+#define MACRO_CHUNK      65536      /* Size of each chunk of a recording */
+
+struct macrochunk {
+	struct macrochunk *next;
+	size_t             len;
+	uint8_t            data[MACRO_CHUNK];
+};
+
+/* Command names, each stored once and referred to by index. */
+struct macronames {
+	char             **names;
+	int                len, cap;
+};
+
+/* Macro being recorded, in the binary encoding. */
+struct macro {
+	struct macrochunk *head, *tail;
+	struct macronames  names;
+	int                x, y;      /* Last cursor position */
+	int                steps;
+	size_t             size;      /* Size of the encoding, in bytes */
+};
+
+/* Macro file being played, in either encoding, read a command at a time. */
+struct macroreader {
+	FILE              *fp;
+	bool               binary;
+	struct macronames  names;
+	int                x, y;
+	char               next[MACRO_LINE]; /* Command following a delay */
+};
+
+void             macro_init(struct macro *);
+void             macro_free(struct macro *);
+void             macro_add(struct macro *, unsigned long, const char *);
+bool             macro_save(struct macro *, const char *);
+bool             macro_open(struct macroreader *, const char *);
+bool             macro_read(struct macroreader *, char *, size_t);
+void             macro_close(struct macroreader *);
+int              macro_convert(const char *, const char *);
@@ -0,0 +1,85 @@
+//
+// parallel.c
+// splitting work across threads
+//
+// Items are split into contiguous ranges, one per worker, in order: worker
+// `i` always gets items before worker `i + 1`. Callers which keep a result
+// per worker can rely on this to combine results in item order. Threads are
+// started for each call, which is cheap next to the work they're given, and
+// the calling thread acts as the first worker.
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include "parallel.h"
+#include "trace.h"
+
+struct worker {
+	pthread_t        thread;
+	parallel_fn      fn;
+	void            *arg;
+	int              index;
+	int              lo, hi;
+};
+
+static void *parallel_run(void *arg)
+{
+	struct worker *w = arg;
+
+	trace_begin("parallel", "worker");
+	w->fn(w->arg, w->index, w->lo, w->hi);
+	trace_end("parallel", "worker");
+
+	return NULL;
+}
+
+/* Get the number of workers `n` items are split across. */
+int parallel_workers(int n)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int  w    = PARALLEL_MAX_WORKERS;
+
+	if (cpus > 0 && cpus < w)
+		w = (int)cpus;
+	if (n < w)
+		w = n;
+
+	return w > 1 ? w : 1;
+}
+
+/* Run `fn` over `n` items, on as many threads as there are processors. */
+void parallel_for(int n, parallel_fn fn, void *arg)
+{
+	struct worker workers[PARALLEL_MAX_WORKERS];
+	int           nworkers = parallel_workers(n);
+
+	if (n <= 0)
+		return;
+
+	for (int i = 0; i < nworkers; i++) {
+		struct worker *w = &workers[i];
+
+		w->fn      = fn;
+		w->arg     = arg;
+		w->index   = i;
+		w->lo      = (int)((long)n * i / nworkers);
+		w->hi      = (int)((long)n * (i + 1) / nworkers);
+
+		/* If a thread can't be started, do its share here instead. */
+		if (i > 0 && pthread_create(&w->thread, NULL, parallel_run, w) != 0)
+			w->index = -1;
+	}
+	trace_begin("parallel", "worker");
+	fn(arg, 0, workers[0].lo, workers[0].hi);
+	trace_end("parallel", "worker");
+
+	for (int i = 1; i < nworkers; i++) {
+		if (workers[i].index < 0)
+			fn(arg, i, workers[i].lo, workers[i].hi);
+		else
+			pthread_join(workers[i].thread, NULL);
+	}
+}
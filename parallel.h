@@ -0,0 +1,12 @@
+//
+// parallel.h
+// splitting work across threads
+//
+#define PARALLEL_MAX_WORKERS  16
+
+/* Called by each worker with its index, and the range of items [lo, hi) it
+ * should process. */
+typedef void   (*parallel_fn)(void *, int, int, int);
+
+int              parallel_workers(int);
+void             parallel_for(int, parallel_fn, void *);
@@ -0,0 +1,95 @@
+//
+// perf.c
+// per-stage frame timings, shown by the performance overlay
+//
+// Each stage of a frame is timed on the CPU, and on the GPU with its own
+// `GL_TIME_ELAPSED` queries. Since those can't be nested, stages must not
+// overlap. GPU times are read once available, so they lag a few frames
+// behind. Input is handled in between frames, so its time is added up
+// until the next frame is presented, and its GPU time is that of the
+// latest event measured.
+//
+#include <stdbool.h>
+#include <string.h>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "linmath.h"
+#include "gl.h"
+#include "perf.h"
+
+struct perf perf;
+
+const char *perf_stages[PERF_STAGES] = {
+	[PERF_INPUT]     = "input",
+	[PERF_VIEWS]     = "views",
+	[PERF_PALETTE]   = "palette",
+	[PERF_STATUSBAR] = "status",
+	[PERF_CURSOR]    = "cursor",
+	[PERF_PRESENT]   = "present",
+};
+
+/* Start or stop measuring. Must be called with a GL context current. */
+void perf_enable(bool enabled)
+{
+	if (enabled == perf.enabled)
+		return;
+
+	for (int i = 0; i < PERF_STAGES; i++) {
+		if (enabled) {
+			gl_timer_init(&perf.timers[i]);
+		} else {
+			if (perf.running[i])
+				_perf_end(i);
+			gl_timer_free(&perf.timers[i]);
+		}
+	}
+	memset(perf.cpu,     0, sizeof(perf.cpu));
+	memset(perf.last,    0, sizeof(perf.last));
+	memset(perf.gpu,     0, sizeof(perf.gpu));
+	memset(perf.history, 0, sizeof(perf.history));
+
+	perf.head    = 0;
+	perf.enabled = enabled;
+}
+
+/* Close the current frame, which took `frametime` milliseconds. */
+void perf_frame(double frametime)
+{
+	if (! perf.enabled)
+		return;
+
+	for (int i = 0; i < PERF_STAGES; i++) {
+		double ms;
+
+		while (gl_timer_read(&perf.timers[i], &ms))
+			perf.gpu[i] = ms;
+	}
+	memcpy(perf.last, perf.cpu, sizeof(perf.last));
+	memset(perf.cpu, 0, sizeof(perf.cpu));
+
+	perf.history[perf.head] = frametime;
+	perf.head = (perf.head + 1) % PERF_HISTORY;
+}
+
+void _perf_begin(enum perfstage s)
+{
+	if (perf.running[s])
+		return;
+
+	perf.running[s] = true;
+	perf.start[s]   = glfwGetTime();
+
+	gl_timer_begin(&perf.timers[s]);
+}
+
+void _perf_end(enum perfstage s)
+{
+	if (! perf.running[s])
+		return;
+
+	gl_timer_end(&perf.timers[s]);
+
+	perf.running[s] = false;
+	perf.cpu[s]    += (glfwGetTime() - perf.start[s]) * 1000.0;
+}
@@ -0,0 +1,47 @@
+//
+// perf.h
+// per-stage frame timings, shown by the performance overlay
+//
+#define PERF_HISTORY        120     /* Number of frame times kept */
+#define PERF_BAR_WIDTH      2       /* Width of each frame in the overlay graph */
+#define PERF_GRAPH_HEIGHT   40      /* Height of the overlay graph */
+
+enum perfstage {
+	PERF_INPUT       = 0,
+	PERF_VIEWS       = 1,
+	PERF_PALETTE     = 2,
+	PERF_STATUSBAR   = 3,
+	PERF_CURSOR      = 4,
+	PERF_PRESENT     = 5,
+	PERF_STAGES      = 6
+};
+
+struct perf {
+	bool             enabled;
+	bool             running[PERF_STAGES];
+	double           start[PERF_STAGES];     /* Time at which each running stage started */
+	double           cpu[PERF_STAGES];       /* CPU time of each stage so far this frame, in ms */
+	double           last[PERF_STAGES];      /* CPU time of each stage on the last frame */
+	double           gpu[PERF_STAGES];       /* Latest GPU time of each stage, in ms */
+	struct gltimer   timers[PERF_STAGES];
+	double           history[PERF_HISTORY];  /* Frame times, oldest first from `head` */
+	int              head;
+};
+
+extern struct perf        perf;
+extern const char        *perf_stages[PERF_STAGES];
+
+void             perf_enable(bool);
+void             perf_frame(double);
+void            _perf_begin(enum perfstage);
+void            _perf_end(enum perfstage);
+
+/* Stage timers compile out unless `PERF` is defined, and cost a branch
+ * while the overlay isn't shown. */
+#if defined(PERF)
+#define perf_begin(stage)   do { if (perf.enabled) _perf_begin(stage); } while (0)
+#define perf_end(stage)     do { if (perf.enabled) _perf_end(stage); } while (0)
+#else
+#define perf_begin(stage)   do {} while (0)
+#define perf_end(stage)     do {} while (0)
+#endif
@@ -9,10 +9,10 @@
 #include "linmath.h"
 #include "texture.h"
 #include "gl.h"
+#include "program.h"
 #include "ctx.h"
 #include "polygon.h"
 #include "assert.h"
-#include "program.h"
 
 struct polygon polygon(GLfloat *verts, size_t nverts, size_t arity)
 {
@@ -21,8 +21,8 @@ struct polygon polygon(GLfloat *verts, size_t nverts, size_t arity)
 	glGenVertexArrays(1, &poly.vao);
 	glGenBuffers(1, &poly.vbo);
 
-	glBindVertexArray(poly.vao);
-	glBindBuffer(GL_ARRAY_BUFFER, poly.vbo);
+	gl_bind_vertex_array(poly.vao);
+	gl_bind_buffer(poly.vbo);
 
 	glBufferData(
 		GL_ARRAY_BUFFER,
@@ -30,8 +30,8 @@ struct polygon polygon(GLfloat *verts, size_t nverts, size_t arity)
 		verts,
 		GL_STATIC_DRAW
 	);
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gl_stats.buffers ++;
+	gl_vertex_attribs((int)arity);
 
 	return poly;
 }
@@ -110,8 +110,8 @@ struct polygon rectangle(rect_t r)
 
 void polygon_release(struct polygon *p)
 {
-	glDeleteBuffers(1, &p->vbo);
-	glDeleteVertexArrays(1, &p->vao);
+	gl_delete_buffer(p->vbo);
+	gl_delete_vertex_array(p->vao);
 }
 
 void polygon_draw(struct context *ctx, struct polygon *poly)
@@ -120,18 +120,8 @@ void polygon_draw(struct context *ctx, struct polygon *poly)
 	assert(poly->vbo > 0);
 	assert(poly->nverts > 0);
 
-	glBindVertexArray(poly->vao);
-	glBindBuffer(GL_ARRAY_BUFFER, poly->vbo);
-
-	gl_draw_triangles_blend(
-		VERTEX_ATTR,
-		(int)poly->nverts,
-		(int)poly->arity,
-		ctx->blend.color,
-		ctx->blend.sfactor,
-		ctx->blend.dfactor
-	);
+	gl_bind_vertex_array(poly->vao);
 
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	ctx_prepare(ctx);
+	gl_draw_triangles((int)poly->nverts);
 }
@@ -11,6 +11,7 @@
 
 #include "util.h"
 #include "linmath.h"
+#include "gl.h"
 #include "program.h"
 
 //
@@ -32,18 +33,108 @@ static void printlog_program(GLuint program)
 
 void program_use(struct program *s)
 {
-	if (s) { glUseProgram(s->handle); }
-	else   { glUseProgram(0); }
+	gl_use_program(s ? s->handle : 0);
 }
 
 void program_free(struct program *s)
 {
-	glDeleteProgram(s->handle);
+	gl_delete_program(s->handle);
 	free(s);
 }
 
+static const char *uniforms[UNIFORM_MAX] = {
+	[UNIFORM_ADJUSTAREA] = "adjustarea",
+	[UNIFORM_ADJUSTMENT] = "adjustment",
+	[UNIFORM_AREA]       = "area",
+	[UNIFORM_BORDER]     = "border",
+	[UNIFORM_CELL]       = "cell",
+	[UNIFORM_CHECKER]    = "checker",
+	[UNIFORM_COLOR]      = "color",
+	[UNIFORM_COUNT]      = "count",
+	[UNIFORM_FALLOFF]    = "falloff",
+	[UNIFORM_FLIP]       = "flip",
+	[UNIFORM_GRID]       = "grid",
+	[UNIFORM_GRIDCOLOR]  = "gridcolor",
+	[UNIFORM_INDEXED]    = "indexed",
+	[UNIFORM_LAYER]      = "layer",
+	[UNIFORM_LEVEL]      = "level",
+	[UNIFORM_LOWRES]     = "lowres",
+	[UNIFORM_LUT]        = "lut",
+	[UNIFORM_NEXT]       = "next",
+	[UNIFORM_NEXTCELLS]  = "nextcells",
+	[UNIFORM_NEXTLAYERS] = "nextlayers",
+	[UNIFORM_NEXTTINT]   = "nexttint",
+	[UNIFORM_NFRAMES]    = "nframes",
+	[UNIFORM_OPACITY]    = "opacity",
+	[UNIFORM_ORIGIN]     = "origin",
+	[UNIFORM_ORTHO]      = "ortho",
+	[UNIFORM_PREV]       = "prev",
+	[UNIFORM_PREVCELLS]  = "prevcells",
+	[UNIFORM_PREVLAYERS] = "prevlayers",
+	[UNIFORM_PREVTINT]   = "prevtint",
+	[UNIFORM_SAMPLER]    = "sampler",
+	[UNIFORM_SELCOLOR]   = "selcolor",
+	[UNIFORM_SELECTION]  = "selection",
+	[UNIFORM_SEPARATOR]  = "separator",
+	[UNIFORM_SIZE]       = "size",
+	[UNIFORM_SLOT]       = "slot",
+	[UNIFORM_TRANSFORM]  = "transform",
+	[UNIFORM_ZOOM]       = "zoom",
+};
+
+//
+// Resolve the locations of all active uniforms, so that setting a uniform
+// is an array lookup. Array uniforms are reported as `name[0]`, and are
+// stored under their plain name.
+//
+static void program_uniforms(struct program *p)
+{
+	GLint n = 0;
+	glGetProgramiv(p->handle, GL_ACTIVE_UNIFORMS, &n);
+
+	for (int i = 0; i < UNIFORM_MAX; i++)
+		p->uniforms[i] = -1;
+
+	for (GLint i = 0; i < n; i++) {
+		char   name[64];
+		GLint  size;
+		GLenum type;
+
+		glGetActiveUniform(p->handle, (GLuint)i, sizeof(name), NULL, &size, &type, name);
+
+		char *bracket = strstr(name, "[0]");
+
+		if (bracket && bracket[3] == '\0')
+			*bracket = '\0';
+
+		int id = 0;
+
+		while (id < UNIFORM_MAX && strcmp(uniforms[id], name))
+			id ++;
+
+		if (id == UNIFORM_MAX) {
+			errorf("program", "program '%s' has an unknown uniform '%s'", p->name, name);
+			continue;
+		}
+		p->uniforms[id] = glGetUniformLocation(p->handle, name);
+	}
+}
+
+GLint program_uniform(struct program *p, enum uniformid id)
+{
+	return p->uniforms[id];
+}
+
+//
+// Functions shared by all fragment shaders, read once
+//
+#define SHADER_PRELUDE "shaders/color.glsl"
+
+static GLchar *prelude;
+
 //
-// Compile the shader from file `filename`
+// Compile the shader from file `filename`. Fragment shaders have the
+// prelude inserted after their `#version` line, which must come first.
 //
 static GLuint shader_load(const char *filename, GLenum type)
 {
@@ -53,9 +144,22 @@ static GLuint shader_load(const char *filename, GLenum type)
 		fprintf(stderr, "error opening %s", filename);
 		return 0;
 	}
+	if (type == GL_FRAGMENT_SHADER && ! prelude && ! (prelude = readfile(SHADER_PRELUDE))) {
+		fprintf(stderr, "error opening %s", SHADER_PRELUDE);
+		free(source);
+		return 0;
+	}
 	GLuint handle = glCreateShader(type);
 
-	glShaderSource(handle, 1, (const char * const *)&source, NULL);
+	if (type == GL_FRAGMENT_SHADER) {
+		char       *body      = strchr(source, '\n');
+		const char *parts[]   = { source, prelude, "\n#line 2\n", body ? body + 1 : "" };
+		GLint       lengths[] = { body ? (GLint)(body + 1 - source) : -1, -1, -1, -1 };
+
+		glShaderSource(handle, (GLsizei)elems(parts), parts, lengths);
+	} else {
+		glShaderSource(handle, 1, (const char * const *)&source, NULL);
+	}
 	glCompileShader(handle);
 
 	free(source);
@@ -79,6 +183,9 @@ struct program *program(const char *name, GLuint handle)
 
 	p->name   = name;
 	p->handle = handle;
+	p->synced = false;
+
+	program_uniforms(p);
 
 	return p;
 }
@@ -114,57 +221,83 @@ struct program *program_load(const char *name, const char *vertpath, const char
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void set_uniform_mat4(struct program *s, const char *name, mat4_t *m)
+void set_uniform_mat4(struct program *s, enum uniformid id, mat4_t *m)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = program_uniform(s, id)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
+	gl_stats.uniforms ++;
 	glUniformMatrix4fv(loc, 1, GL_FALSE, (float *)m);
 }
 
-void set_uniform_vec2(struct program *s, const char *name, vec2_t *v)
+void set_uniform_vec2(struct program *s, enum uniformid id, vec2_t *v)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = program_uniform(s, id)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
+	gl_stats.uniforms ++;
 	glUniform2fv(loc, 1, (float *)v);
 }
 
-void set_uniform_vec3(struct program *s, const char *name, vec3_t *v)
+void set_uniform_vec3(struct program *s, enum uniformid id, vec3_t *v)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = program_uniform(s, id)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
+	gl_stats.uniforms ++;
 	glUniform3fv(loc, 1, (float *)v);
 }
 
-void set_uniform_vec4(struct program *s, const char *name, vec4_t *v)
+void set_uniform_vec4(struct program *s, enum uniformid id, vec4_t *v)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
+	if ((loc = program_uniform(s, id)) == -1) {
 		// TODO(cloudhead): Log error.
 		return;
 	}
+	gl_stats.uniforms ++;
 	glUniform4fv(loc, 1, (float *)v);
 }
 
-void set_uniform_i32(struct program *s, const char *name, GLint i)
+void set_uniform_i32(struct program *s, enum uniformid id, GLint i)
 {
 	GLint loc;
 
-	if ((loc = glGetUniformLocation(s->handle, name)) == -1) {
-		// TODO(cloudhead): Log error.
+	if ((loc = program_uniform(s, id)) == -1)
 		return;
-	}
+
+	gl_stats.uniforms ++;
 	glUniform1i(loc, i);
 }
+
+void set_uniform_f32(struct program *s, enum uniformid id, GLfloat f)
+{
+	GLint loc;
+
+	if ((loc = program_uniform(s, id)) == -1)
+		return;
+
+	gl_stats.uniforms ++;
+	glUniform1f(loc, f);
+}
+
+void set_uniform_i32v(struct program *s, enum uniformid id, int n, const GLint *v)
+{
+	GLint loc;
+
+	if ((loc = program_uniform(s, id)) == -1)
+		return;
+
+	gl_stats.uniforms ++;
+	glUniform1iv(loc, n, v);
+}
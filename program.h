@@ -8,19 +8,81 @@ enum attr {
 	MULTIPLY_ATTR = 1
 };
 
+enum programid {
+	PROGRAM_NONE = 0,
+	PROGRAM_TEXT,
+	PROGRAM_TEXTURE,
+	PROGRAM_CONSTANT,
+	PROGRAM_FRAMEBUFFER,
+	PROGRAM_OVERLAY,
+	PROGRAM_ONION,
+	PROGRAM_DOWNSAMPLE,
+	PROGRAM_RECOLOR,
+	PROGRAM_ADJUST,
+	PROGRAM_MAX
+};
+
+/* Uniforms of all programs. Their locations are resolved once, when a
+ * program is loaded. */
+enum uniformid {
+	UNIFORM_ADJUSTAREA,
+	UNIFORM_ADJUSTMENT,
+	UNIFORM_AREA,
+	UNIFORM_BORDER,
+	UNIFORM_CELL,
+	UNIFORM_CHECKER,
+	UNIFORM_COLOR,
+	UNIFORM_COUNT,
+	UNIFORM_FALLOFF,
+	UNIFORM_FLIP,
+	UNIFORM_GRID,
+	UNIFORM_GRIDCOLOR,
+	UNIFORM_INDEXED,
+	UNIFORM_LAYER,
+	UNIFORM_LEVEL,
+	UNIFORM_LOWRES,
+	UNIFORM_LUT,
+	UNIFORM_NEXT,
+	UNIFORM_NEXTCELLS,
+	UNIFORM_NEXTLAYERS,
+	UNIFORM_NEXTTINT,
+	UNIFORM_NFRAMES,
+	UNIFORM_OPACITY,
+	UNIFORM_ORIGIN,
+	UNIFORM_ORTHO,
+	UNIFORM_PREV,
+	UNIFORM_PREVCELLS,
+	UNIFORM_PREVLAYERS,
+	UNIFORM_PREVTINT,
+	UNIFORM_SAMPLER,
+	UNIFORM_SELCOLOR,
+	UNIFORM_SELECTION,
+	UNIFORM_SEPARATOR,
+	UNIFORM_SIZE,
+	UNIFORM_SLOT,
+	UNIFORM_TRANSFORM,
+	UNIFORM_ZOOM,
+	UNIFORM_MAX
+};
+
 struct program {
 	const char      *name;
 	GLuint           handle;
-	bool             bound;
+	bool             synced;        /* Whether `transform` was uploaded */
+	mat4_t           transform;     /* Last uploaded transform */
+	GLint            uniforms[UNIFORM_MAX]; /* Location of each uniform, or -1 */
 };
 
 struct program               *program(const char *, GLenum);
 struct program               *program_load(const char *, const char *, const char *);
 void                          program_free(struct program *);
 void                          program_use(struct program *);
+GLint                         program_uniform(struct program *, enum uniformid);
 
-extern void                   set_uniform_mat4(struct program *, const char *, mat4_t *);
-extern void                   set_uniform_vec2(struct program *, const char *, vec2_t *);
-extern void                   set_uniform_vec3(struct program *, const char *, vec3_t *);
-extern void                   set_uniform_vec4(struct program *, const char *, vec4_t *);
-extern void                   set_uniform_i32(struct program *, const char *, int32_t);
+extern void                   set_uniform_mat4(struct program *, enum uniformid, mat4_t *);
+extern void                   set_uniform_vec2(struct program *, enum uniformid, vec2_t *);
+extern void                   set_uniform_vec3(struct program *, enum uniformid, vec3_t *);
+extern void                   set_uniform_vec4(struct program *, enum uniformid, vec4_t *);
+extern void                   set_uniform_i32(struct program *, enum uniformid, int32_t);
+extern void                   set_uniform_f32(struct program *, enum uniformid, float);
+extern void                   set_uniform_i32v(struct program *, enum uniformid, int, const int32_t *);
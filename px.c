@@ -3,7 +3,6 @@
  * pixel editor
  *
  * TODO: (bug) Palette is cut off on small windows.
- * TODO: (bug) Checker should be same size no matter view size.
  * TODO: (bug) Sometimes, eg. with a #ff00ff background, you can't see the selection.
  * TODO: (bug) `window` command does weird shit.
  * TODO: (bug) If 'cursor/down' is the first event, the replay doesn't happen properly.
@@ -33,6 +32,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -55,16 +55,28 @@
 #include "text.h"
 #include "sprite.h"
 #include "gl.h"
+#include "program.h"
 #include "ctx.h"
 #include "util.h"
 #include "tga.h"
 #include "polygon.h"
-#include "program.h"
 #include "texture.h"
 #include "ui.h"
 #include "animation.h"
 #include "framebuffer.h"
+#include "canvas.h"
 #include "hash.h"
+#include "readback.h"
+#include "histogram.h"
+#include "quantize.h"
+#include "parallel.h"
+#include "remap.h"
+#include "macro.h"
+#include "runner.h"
+#include "bench.h"
+#include "perf.h"
+#include "trace.h"
+#include "latency.h"
 
 typedef float    f32;
 typedef double   f64;
@@ -95,13 +107,20 @@ typedef int8_t   i8;
 #define GRID_COLOR                      rgba(0, 0, 255, 128)
 #define vw(v)                           (v->fw * v->nframes)
 #define vh(v)                           (v->fh)
+#define CURSOR_EXTENT                   32
+#define MAX_ONION_DEPTH                 16
 
 static bool source(struct session *, const char *);
 static void session_view_blank(struct session *, char *, enum filestatus, int, int);
 static void view_readpixels(struct view *s, rgba_t *);
 static void palette_addcolor(struct palette *, rgba_t color);
 static void palette_setcolor(struct palette *, rgba_t color, int);
+static void session_palette_load(struct session *, const rgba_t *, int);
 static void draw_boundary(rgba_t color, int x, int y, int w, int h);
+static void session_damage(struct session *, unsigned);
+static void session_damage_area(struct session *, rect_t);
+static rect_t view_screen_rect(struct session *, struct view *);
+static bool session_perf_toggle(struct session *);
 
 static void kb_create_frame(struct session *, const union arg *);
 static void kb_create_view(struct session *, const union arg *);
@@ -129,11 +148,13 @@ static void kb_redo(struct session *, const union arg *);
 static void kb_pause(struct session *, const union arg *);
 static void kb_brush_size(struct session *, const union arg *);
 static void kb_adjust_fps(struct session *, const union arg *);
+static void kb_adjust(struct session *, const union arg *);
 static void kb_brush(struct session *, const union arg *);
 static void kb_eraser(struct session *, const union arg *);
 static void kb_cmdmode(struct session *, const union arg *);
 static void kb_pixelmode(struct session *, const union arg *);
 static void kb_presentmode(struct session *, const union arg *);
+static void kb_toggle_perf(struct session *, const union arg *);
 static void kb_help(struct session *, const union arg *);
 
 static struct session *session;
@@ -148,6 +169,11 @@ static bool cmd_read(struct session *, int, char **);
 static bool cmd_resize(struct session *, int, char **);
 static bool cmd_slice(struct session *, int, char **);
 static bool cmd_slice_all(struct session *, int, char **);
+static bool cmd_frame_add(struct session *, int, char **);
+static bool cmd_frame_insert(struct session *, int, char **);
+static bool cmd_frame_dup(struct session *, int, char **);
+static bool cmd_frame_delete(struct session *, int, char **);
+static bool cmd_frame_move(struct session *, int, char **);
 static bool cmd_checker(struct session *, int, char **);
 static bool cmd_source(struct session *, int, char **);
 static bool cmd_fullscreen(struct session *, int, char **);
@@ -156,7 +182,21 @@ static bool cmd_echo(struct session *, int, char **);
 static bool cmd_palette_add(struct session *, int, char **);
 static bool cmd_palette_clear(struct session *, int, char **);
 static bool cmd_palette_sample(struct session *, int, char **);
+static bool cmd_palette_set(struct session *, int, char **);
+static bool cmd_quantize(struct session *, int, char **);
+static bool cmd_indexed(struct session *, int, char **);
+static bool cmd_recolor(struct session *, int, char **);
+static bool cmd_remap(struct session *, int, char **);
+static bool cmd_adjust_hue(struct session *, int, char **);
+static bool cmd_adjust_saturation(struct session *, int, char **);
+static bool cmd_adjust_lightness(struct session *, int, char **);
+static bool cmd_adjust_apply(struct session *, int, char **);
+static bool cmd_adjust_cancel(struct session *, int, char **);
 static bool cmd_grid(struct session *, int, char **);
+static bool cmd_onion_depth(struct session *, int, char **);
+static bool cmd_onion_direction(struct session *, int, char **);
+static bool cmd_onion_falloff(struct session *, int, char **);
+static bool cmd_onion_tint(struct session *, int, char **);
 static bool cmd_pause(struct session *, int, char **);
 static bool cmd_zoom(struct session *, int, char **);
 static bool cmd_center(struct session *, int, char **);
@@ -164,6 +204,7 @@ static bool cmd_fill(struct session *, int, char **);
 static bool cmd_crop(struct session *, int, char **);
 static bool cmd_record(struct session *, int, char **);
 static bool cmd_play(struct session *, int, char **);
+static bool cmd_macro_convert(struct session *, int, char **);
 static bool cmd_cursormove(struct session *, int, char **);
 static bool cmd_cursordown(struct session *, int, char **);
 static bool cmd_cursorup(struct session *, int, char **);
@@ -174,6 +215,19 @@ static bool cmd_test_play(struct session *, int, char **);
 static bool cmd_test_save(struct session *, int, char **);
 static bool cmd_test_discard(struct session *, int, char **);
 static bool cmd_test_check(struct session *, int, char **);
+static bool cmd_test_vdigest(struct session *, int, char **);
+static bool cmd_test_vcheck(struct session *, int, char **);
+static bool cmd_test_tile(struct session *, int, char **);
+static bool cmd_test_drawn(struct session *, int, char **);
+static bool cmd_stats_gl(struct session *, int, char **);
+static bool cmd_stats_frame(struct session *, int, char **);
+static bool cmd_stats_overlay(struct session *, int, char **);
+static bool cmd_trace_start(struct session *, int, char **);
+static bool cmd_trace_stop(struct session *, int, char **);
+static bool cmd_latency_start(struct session *, int, char **);
+static bool cmd_latency_stop(struct session *, int, char **);
+static bool cmd_stats_colors(struct session *, int, char **);
+static bool cmd_pace(struct session *, int, char **);
 
 static struct command commands[] = {
 	{"q",                  "quit",                            cmd_quit,                0},
@@ -185,6 +239,11 @@ static struct command commands[] = {
 	{"resize",             "resize canvas",                   cmd_resize,              1},
 	{"slice",              "slice canvas",                    cmd_slice,               1},
 	{"slice!",             "slice canvas (all)",              cmd_slice_all,           1},
+	{"f/add",              "add a frame",                     cmd_frame_add,           0},
+	{"f/insert",           "insert a blank frame",            cmd_frame_insert,        1},
+	{"f/dup",              "duplicate a frame",               cmd_frame_dup,           1},
+	{"f/delete",           "delete a frame",                  cmd_frame_delete,        1},
+	{"f/move",             "move a frame",                    cmd_frame_move,          2},
 	{"checker",            "toggle checker",                  cmd_checker,             0},
 	{"source",             "source script",                   cmd_source,              1},
 	{"fullscreen",         "toggle fullscreen",               cmd_fullscreen,          0},
@@ -192,8 +251,22 @@ static struct command commands[] = {
 	{"echo",               "echo a message",                  cmd_echo,                0},
 	{"p/add",              "add a palette color",             cmd_palette_add,         1},
 	{"p/clear",            "clear the palette",               cmd_palette_clear,       0},
-	{"p/sample",           "sample a palette",                cmd_palette_sample,      0},
+	{"p/sample",           "sample a palette from the view",  cmd_palette_sample,      0},
+	{"p/set",              "set a palette color by index",    cmd_palette_set,         2},
+	{"quantize",           "reduce the view to N colors",     cmd_quantize,            1},
+	{"indexed",            "store the view as color indices", cmd_indexed,             0},
+	{"recolor",            "replace colors",                  cmd_recolor,             2},
+	{"remap",              "map colors to the palette",       cmd_remap,               0},
+	{"adjust/hue",         "preview a hue rotation",          cmd_adjust_hue,          1},
+	{"adjust/saturation",  "preview a saturation change",     cmd_adjust_saturation,   1},
+	{"adjust/lightness",   "preview a lightness change",      cmd_adjust_lightness,    1},
+	{"adjust/apply",       "apply the previewed adjustment",  cmd_adjust_apply,        0},
+	{"adjust/cancel",      "cancel the previewed adjustment", cmd_adjust_cancel,       0},
 	{"grid",               "toggle grid",                     cmd_grid,                0},
+	{"onion/depth",        "onion skin depth",                cmd_onion_depth,         1},
+	{"onion/direction",    "onion skin direction",            cmd_onion_direction,     1},
+	{"onion/falloff",      "onion skin falloff",              cmd_onion_falloff,       1},
+	{"onion/tint",         "onion skin tint",                 cmd_onion_tint,          2},
 	{"pause",              "pause animation",                 cmd_pause,               0},
 	{"zoom",               "zoom view",                       cmd_zoom,                1},
 	{"center",             "center view",                     cmd_center,              0},
@@ -201,6 +274,7 @@ static struct command commands[] = {
 	{"crop",               "crop view",                       cmd_crop,                0},
 	{"record",             "record macro",                    cmd_record,              0},
 	{"play",               "play macro",                      cmd_play,                1},
+	{"macro/convert",      "convert a macro to/from text",    cmd_macro_convert,       2},
 	{"cursor/move",        "cursor move",                     cmd_cursormove,          2},
 	{"cursor/down",        "cursor down",                     cmd_cursordown,          0},
 	{"cursor/up",          "cursor up",                       cmd_cursorup,            0},
@@ -211,6 +285,19 @@ static struct command commands[] = {
 	{"test/save",          "test/save",                       cmd_test_save,           0},
 	{"test/discard",       "test/discard",                    cmd_test_discard,        0},
 	{"test/check",         "test/check",                      cmd_test_check,          1},
+	{"test/vdigest",       "test/vdigest",                    cmd_test_vdigest,        0},
+	{"test/vcheck",        "test/vcheck",                     cmd_test_vcheck,         1},
+	{"test/tile",          "test/tile",                       cmd_test_tile,           4},
+	{"test/drawn",         "test/drawn",                      cmd_test_drawn,          0},
+	{"stats/gl",           "show GL statistics",              cmd_stats_gl,            0},
+	{"stats/frame",        "show frame statistics",           cmd_stats_frame,         0},
+	{"stats/colors",       "show color statistics",           cmd_stats_colors,        0},
+	{"stats/overlay",      "toggle the performance overlay",  cmd_stats_overlay,       0},
+	{"trace/start",        "start a trace capture",           cmd_trace_start,         0},
+	{"trace/stop",         "stop and save a trace capture",   cmd_trace_stop,          1},
+	{"latency/start",      "start measuring input latency",   cmd_latency_start,       0},
+	{"latency/stop",       "stop measuring input latency",    cmd_latency_stop,        0},
+	{"pace",               "set frame pacing",                cmd_pace,                1},
 };
 
 #include "config.h"
@@ -231,9 +318,19 @@ static void ui_drawtext(struct context *ctx, float *offset, float sx, float sy,
 }
 
 /* TODO: Take rect_t as argument */
-static void fill_rect(struct context *ctx, int x1, int y1, int x2, int y2, rgba_t color)
+static void fill_triangles(struct context *ctx, float *verts, size_t nverts, rgba_t color)
 {
 	vec4_t v = rgba2vec4(color);
+	struct polygon p = polygon(verts, nverts, 2);
+
+	ctx_program(ctx, PROGRAM_CONSTANT);
+	set_uniform_vec4(ctx->program, UNIFORM_COLOR, &v);
+	polygon_draw(ctx, &p);
+	polygon_release(&p);
+}
+
+static void fill_rect(struct context *ctx, int x1, int y1, int x2, int y2, rgba_t color)
+{
 	float verts[] = {
 		x1,  y1,
 		x2,  y1,
@@ -242,12 +339,7 @@ static void fill_rect(struct context *ctx, int x1, int y1, int x2, int y2, rgba_
 		x2,  y1,
 		x2,  y2,
 	};
-	struct polygon p = polygon(verts, 6, 2);
-
-	ctx_program(ctx, "constant");
-	set_uniform_vec4(ctx->program, "color", &v);
-	polygon_draw(ctx, &p);
-	polygon_release(&p);
+	fill_triangles(ctx, verts, 6, color);
 }
 
 static void draw_boundary(rgba_t color, int x1, int y1, int x2, int y2)
@@ -255,33 +347,6 @@ static void draw_boundary(rgba_t color, int x1, int y1, int x2, int y2)
 	ui_drawbox(session->ctx, rect(x1, y1, x2, y2), 1, color);
 }
 
-static void draw_vline(rgba_t color, int x, int y1, int y2)
-{
-	draw_boundary(
-		color,
-		x,     y1,
-		x + 1, y2
-	);
-}
-
-static void draw_hline(rgba_t color, int x1, int x2, int y)
-{
-	draw_boundary(
-		color,
-		x1,    y,
-		x2   , y + 1
-	);
-}
-
-static void draw_grid(rgba_t color, int gw, int gh, int totalw, int totalh)
-{
-	for (int i = gw; i < totalw; i += gw)
-		draw_vline(color, i, 0, totalh);
-
-	for (int i = gh; i < totalh; i += gh)
-		draw_hline(color, 0, totalw, i);
-}
-
 static void message(enum msgtype t, const char *fmt, ...)
 {
 	va_list ap;
@@ -289,6 +354,8 @@ static void message(enum msgtype t, const char *fmt, ...)
 	vsnprintf(session->message, sizeof(session->message) - 1, fmt, ap);
 	va_end(ap);
 
+	session_damage(session, DAMAGE_STATUS);
+
 	switch (t) {
 	case MSG_INFO:   session->messagecolor = MSG_COLOR_WHITE;
 			 infof("info", "%s", session->message); break;
@@ -305,6 +372,30 @@ static void message(enum msgtype t, const char *fmt, ...)
 static void message_clear(struct session *s)
 {
 	s->message[0] = '\0';
+	session_damage(s, DAMAGE_STATUS);
+}
+
+/* Mark parts of the screen as needing to be redrawn on the next frame. */
+static void session_damage(struct session *s, unsigned damage)
+{
+	s->damage |= damage;
+	latency_result(false);
+}
+
+/* Mark an arbitrary area of the screen as needing to be redrawn. */
+static void session_damage_area(struct session *s, rect_t r)
+{
+	s->damaged = rect_union(s->damaged, r);
+	latency_result(false);
+}
+
+/* Screen area covered by the cursor, the brush outline or the sampler
+ * outline, when drawn at the given position. */
+static rect_t session_cursor_rect(struct session *s, int x, int y)
+{
+	int r = max(CURSOR_EXTENT, (int)((float)(s->tool.brush.size + 1) * s->zoom) + 1);
+
+	return rect(x - r, y - r, x + r, y + r);
 }
 
 static struct polygon brush_quad(float s)
@@ -324,8 +415,7 @@ static struct polygon brush_quad(float s)
 
 static void view_filename(struct view *, const char *);
 static void view_snapshot_save(struct context *, struct view *, bool);
-static void view_draw_onionskin(struct context *, struct view *, int);
-static void view_draw_checker(struct context *, struct view *, int);
+static void view_draw_onionskin(struct context *, struct view *, int, rect_t);
 static void view_dirty(struct view *);
 
 static struct view *view
@@ -335,6 +425,7 @@ static struct view *view
 	, int fw
 	, int fh
 	, uint8_t *pixels
+	, struct colormap *cm
 	, int start
 	, int end
 	)
@@ -350,7 +441,9 @@ static struct view *view
 	v->hover        = false;
 	v->nframes      = (end - start) + 1;
 	v->snapshot     = NULL;
-	v->fb           = framebuffer(fw * v->nframes, fh, pixels);
+	v->canvas       = canvas(fw, fh, v->nframes, pixels, cm ? GL_R8 : GL_RGBA);
+	v->colormap     = cm;
+	v->clean        = calloc((size_t)(v->nframes * v->canvas->ntiles), sizeof(*v->clean));
 	v->prev         = NULL;
 	v->next         = NULL;
 	v->filestatus   = fs;
@@ -398,10 +491,103 @@ static rect_t view_frame_rect(struct view *v, int frame)
 	return rect(frame * v->fw, 0, (frame + 1) * v->fw, vh(v));
 }
 
-static void view_free(struct view *v)
+static struct colormap *colormap(const rgba_t *colors, int ncolors)
+{
+	struct colormap *cm = calloc(1, sizeof(*cm));
+
+	memcpy(cm->colors, colors, sizeof(*colors) * (size_t)ncolors);
+
+	cm->ncolors = ncolors;
+	cm->lut     = texture(cm->colors, (int)elems(cm->colors), 1, GL_RGBA);
+
+	return cm;
+}
+
+static void colormap_free(struct colormap *cm)
+{
+	if (cm) {
+		texture_free(cm->lut);
+		free(cm);
+	}
+}
+
+/* Set a color, which shows up right away wherever its index is used. */
+static void colormap_set(struct colormap *cm, int idx, rgba_t color)
+{
+	assert(idx >= 0 && idx < (int)elems(cm->colors));
+
+	cm->colors[idx] = color;
+	cm->ncolors     = max(cm->ncolors, idx + 1);
+
+	texture_update(cm->lut, idx, 0, 1, 1, &color);
+}
+
+/* Get the index of a color, or -1 if it's missing. */
+static int colormap_find(struct colormap *cm, rgba_t color)
+{
+	for (int i = 0; i < cm->ncolors; i++) {
+		if (! rgbacmp(cm->colors[i], color))
+			return i;
+	}
+	return -1;
+}
+
+/* Get the index of a color, adding the color if it's missing. Returns -1 if
+ * there's no room left for it. */
+static int colormap_index(struct colormap *cm, rgba_t color)
+{
+	int idx = colormap_find(cm, color);
+
+	if (idx >= 0)
+		return idx;
+	if (cm->ncolors == (int)elems(cm->colors))
+		return -1;
+
+	colormap_set(cm, cm->ncolors, color);
+
+	return cm->ncolors - 1;
+}
+
+/* Bind the colormap of an indexed view to the second texture unit, for the
+ * view shaders to look colors up in. */
+static void view_bind_colormap(struct context *ctx, struct view *v)
+{
+	set_uniform_i32(ctx->program, UNIFORM_INDEXED, v->colormap != NULL);
+	set_uniform_i32(ctx->program, UNIFORM_LUT,     1);
+
+	if (v->colormap) {
+		gl_bind_texture(1, v->colormap->lut->handle);
+		gl_bind_sampler(1, v->colormap->lut->sampler);
+	}
+}
+
+static struct tilecopy *tilecopy(rgba_t *pixels)
+{
+	struct tilecopy *tc = malloc(sizeof(*tc));
+
+	tc->pixels = pixels;
+	tc->refs   = 1;
+
+	return tc;
+}
+
+static struct tilecopy *tilecopy_retain(struct tilecopy *tc)
 {
-	framebuffer_free(v->fb);
+	tc->refs ++;
+	return tc;
+}
+
+static void tilecopy_release(struct tilecopy *tc)
+{
+	if (tc && -- tc->refs == 0) {
+		free(tc->pixels);
+		free(tc);
+	}
+}
 
+/* Free every snapshot of the view, and with it its undo history. */
+static void view_snapshots_free(struct view *v)
+{
 	struct snapshot *s = v->snapshot, *next;
 
 	while (s && s->prev)
@@ -410,21 +596,55 @@ static void view_free(struct view *v)
 	while (s) {
 		next = s->next;
 
-		texture_free(s->pixels);
+		for (int i = 0; i < s->nframes * s->ntiles; i++)
+			tilecopy_release(s->tiles[i]);
+
+		free(s->tiles);
+		free(s->colors);
 		free(s);
 
 		s = next;
 	}
+	v->snapshot = NULL;
+}
+
+static void view_free(struct view *v)
+{
+	for (int i = 0; i < v->nframes * v->canvas->ntiles; i++)
+		tilecopy_release(v->clean[i]);
+
+	canvas_free(v->canvas);
+	colormap_free(v->colormap);
+	free(v->clean);
+
+	view_snapshots_free(v);
 	free(v);
 }
 
+/* Mark a tile as changed since the last snapshot. */
+static void view_touch(struct view *v, int frame, int tile)
+{
+	struct tilecopy **tc = &v->clean[frame * v->canvas->ntiles + tile];
+
+	tilecopy_release(*tc);
+	*tc = NULL;
+
+	canvas_touch(v->canvas, frame, tile);
+}
+
+static void view_touch_all(struct view *v)
+{
+	for (int i = 0; i < v->nframes * v->canvas->ntiles; i++)
+		view_touch(v, i / v->canvas->ntiles, i % v->canvas->ntiles);
+}
+
 static void view_offset(struct view *v, struct session *s, int *x, int *y)
 {
 	*x = v->x + s->x;
 	*y = v->y + s->y;
 }
 
-static bool view_within(struct view *v, int x, int y, int zoom)
+static bool view_within(struct view *v, int x, int y, float zoom)
 {
 	int vx, vy;
 	view_offset(v, session, &vx, &vy);
@@ -434,109 +654,376 @@ static bool view_within(struct view *v, int x, int y, int zoom)
 		vy <= y && y < (vy + vh(v) * zoom);
 }
 
-static void view_hover(struct session *s, int x, int y)
+/* Rebuild the index of views. Views are stacked vertically in list order,
+ * from top to bottom, so the index is simply the list reversed, sorted by
+ * ascending 'y', with non-overlapping vertical extents. */
+static void views_index(struct session *s)
 {
-	struct view *v = s->views;
-	while (v) {
-		v->hover = view_within(v, x, y, s->zoom);
-		v = v->next;
+	struct viewindex *ix = &s->vindex;
+
+	ix->len = 0;
+
+	for (struct view *v = s->views; v; v = v->next) {
+		if (ix->len == ix->cap) {
+			ix->cap   = ix->cap ? ix->cap * 2 : 16;
+			ix->views = realloc(ix->views, sizeof(*ix->views) * (size_t)ix->cap);
+		}
+		ix->views[ix->len ++] = v;
+	}
+	for (int i = 0; i < ix->len / 2; i++) {
+		struct view *tmp = ix->views[i];
+		ix->views[i] = ix->views[ix->len - i - 1];
+		ix->views[ix->len - i - 1] = tmp;
+	}
+}
+
+/* Return the position in the index of the first view whose vertical extent
+ * ends above the given screen 'y'. The extent is the one of
+ * `view_screen_rect`, which includes the border. */
+static int views_lower_bound(struct session *s, int y)
+{
+	struct viewindex *ix = &s->vindex;
+
+	int lo = 0,
+	    hi = ix->len;
+
+	while (lo < hi) {
+		int          mid = lo + (hi - lo) / 2;
+		struct view *v   = ix->views[mid];
+
+		if (view_screen_rect(s, v).y2 <= (float)y) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Return the view at the given screen coordinates, if any. */
+static struct view *views_at(struct session *s, int x, int y)
+{
+	struct viewindex *ix = &s->vindex;
+
+	for (int i = views_lower_bound(s, y); i < ix->len; i++) {
+		struct view *v = ix->views[i];
+
+		if (s->y + v->y > y)
+			break;
+		if (view_within(v, x, y, s->zoom))
+			return v;
 	}
+	return NULL;
+}
+
+/* Update the hover state of the views. Returns whether it changed. */
+static bool view_hover(struct session *s, int x, int y)
+{
+	struct view *v = views_at(s, x, y);
+
+	if (v == s->hover)
+		return false;
+
+	if (s->hover)
+		s->hover->hover = false;
+	if (v)
+		v->hover = true;
+
+	s->hover = v;
+
+	return true;
 }
 
 static inline int view_frame_at(struct view *v, int x, int y)
 {
-	return (x - v->x - session->x) / v->fw / session->zoom;
+	return (int)((float)(x - v->x - session->x) / ((float)v->fw * session->zoom));
 }
 
-static void view_draw_frame(struct context *ctx, struct view *v, int frame)
+/* Time on the session clock, which is ahead of `ctx_time` when macro
+ * playback skipped over sleeps. */
+static double session_time(struct session *s)
 {
-	ctx_texture_draw_rect(ctx, v->fb->tex, frame * v->fw, 0, v->fw, v->fh, 0, 0);
+	return ctx_time(s->ctx) + s->clock.skew;
 }
 
-static void view_draw_animation(struct context *ctx, struct view *v)
+static int view_animation_frame(struct context *ctx, struct view *v)
 {
-	double elapsed = ctx_time(ctx) - session->started;
+	double elapsed = session_time(session) - session->started;
 	double frac    = session->fps * elapsed;
-	int frame      = (int)(floor(frac)) % v->nframes;
 
-	view_draw_frame(ctx, v, frame);
+	return (int)(floor(frac)) % v->nframes;
+}
+
+/* Regenerate the mip levels of the tiles written to since the last time,
+ * each level from the one above it. */
+static void view_update_mips(struct context *ctx, struct view *v)
+{
+	struct canvas *c = v->canvas;
+
+	if (c->nstale == 0)
+		return;
+
+	ctx_save(ctx);
+	ctx_identity(ctx);
+	ctx_program(ctx, PROGRAM_DOWNSAMPLE);
+	ctx_blend(ctx, vec4(0, 0, 0, 0), GL_ONE, GL_ZERO);
+
+	set_uniform_i32(ctx->program, UNIFORM_INDEXED, v->colormap != NULL);
+
+	canvas_bind_texture(c);
+
+	for (int layer = 0; layer < c->cap; layer++) {
+		if (! c->stale[layer])
+			continue;
+
+		set_uniform_i32(ctx->program, UNIFORM_LAYER, layer);
+
+		for (int level = 1; level < c->levels; level++) {
+			vec4_t area = vec4(0, 0, max(c->tw >> level, 1), max(c->th >> level, 1));
+
+			canvas_bind_level(c, layer, level);
+			set_uniform_vec4(ctx->program, UNIFORM_AREA, &area);
+			polygon_draw(ctx, &session->overlay);
+		}
+	}
+	canvas_mips_done(c);
+
+	ctx_blend_alpha(ctx);
+	ctx_program(ctx, PROGRAM_NONE);
+	ctx_restore(ctx);
+}
+
+/* Get the mip level a view is drawn from at the current zoom. Each level
+ * halves the size of the one above it, down to the smallest level stored. */
+static int view_level(struct view *v)
+{
+	int level = 0;
+
+	for (float z = session->zoom; z < 1.f && level < v->canvas->levels - 1; z *= 2.f)
+		level ++;
+
+	return level;
+}
+
+/* Get the area covered by a tile, as displayed in the given frame slot of
+ * the view, in zoomed view coordinates. Texel rows run opposite to the view's
+ * 'y' axis. When `flip` is set, the view's flipping is taken into account. */
+static rect_t view_tile_area(struct view *v, int slot, int tile, bool flip)
+{
+	rect_t r = canvas_tile_rect(v->canvas, tile);
+	float  z = session->zoom;
+
+	float x1 = r.x1,          x2 = r.x2,
+	      y1 = v->fh - r.y2,  y2 = v->fh - r.y1;
+
+	if (flip && v->flipx) {
+		x1 = v->fw - r.x2;
+		x2 = v->fw - r.x1;
+	}
+	if (flip && v->flipy) {
+		y1 = r.y1;
+		y2 = r.y2;
+	}
+	/* A screen pixel shows the texel its left or top edge falls on, so
+	 * texel edges are rounded up to the next screen pixel. */
+	return rect(ceilf((slot * v->fw + x1) * z), ceilf(y1 * z),
+	            ceilf((slot * v->fw + x2) * z), ceilf(y2 * z));
 }
 
-static void view_draw_onionskin(struct context *ctx, struct view *v, int frame)
+/* Draw the frames surrounding the given frame over it, in a single pass per
+ * tile. Further frames fade out according to the onion skin falloff. Only
+ * the tiles within `clip`, in view coordinates, are drawn. */
+static void view_draw_onionskin(struct context *ctx, struct view *v, int frame, rect_t clip)
 {
-	if (frame == 0 || frame > v->nframes - 1)
+	struct onion  *o = &session->onion;
+	struct canvas *c = v->canvas;
+
+	if (frame < 0 || frame > v->nframes - 1)
 		return;
 
-	float alpha = 0.5f / (float)frame;
+	float zoom  = session->zoom;
+	int   level = view_level(v);
+	int   prev  = o->direction & ONION_PREV ? min(o->depth, frame) : 0;
+	int   next  = o->direction & ONION_NEXT ? min(o->depth, v->nframes - 1 - frame) : 0;
 
-	for (int i = 0; i < frame; i ++) {
-		ctx_blend(ctx,
-			vec4(0, 0, 0, alpha * (i + 1)),
-			GL_CONSTANT_ALPHA, GL_DST_ALPHA
-		);
-		ctx_texture_draw_rect(
-			ctx,
-			v->fb->tex,
-			v->fw * i,      0,
-			v->fw,          v->fh,
-			v->fw * frame,  0
-		);
-		ctx_blend_alpha(ctx); /* Default blending */
+	if (prev == 0 && next == 0)
+		return;
+
+	vec2_t size     = vec2(v->fw, v->fh);
+	vec4_t prevtint = rgba2vec4(o->prevtint);
+	vec4_t nexttint = rgba2vec4(o->nexttint);
+
+	prevtint.a = nexttint.a = o->tint;
+
+	ctx_program(ctx, PROGRAM_ONION);
+
+	set_uniform_vec2(ctx->program, UNIFORM_SIZE,     &size);
+	set_uniform_vec4(ctx->program, UNIFORM_PREVTINT, &prevtint);
+	set_uniform_vec4(ctx->program, UNIFORM_NEXTTINT, &nexttint);
+	set_uniform_f32(ctx->program,  UNIFORM_OPACITY,  o->opacity);
+	set_uniform_f32(ctx->program,  UNIFORM_FALLOFF,  o->falloff);
+	set_uniform_f32(ctx->program,  UNIFORM_ZOOM,     zoom);
+	set_uniform_i32(ctx->program,  UNIFORM_LEVEL,    level);
+	set_uniform_i32(ctx->program,  UNIFORM_LOWRES,   2);
+	set_uniform_i32(ctx->program,  UNIFORM_PREV,     prev);
+	set_uniform_i32(ctx->program,  UNIFORM_NEXT,     next);
+	set_uniform_i32(ctx->program,  UNIFORM_SLOT,     frame);
+
+	view_bind_colormap(ctx, v);
+	canvas_bind_texture(c);
+
+	for (int t = 0; t < c->ntiles; t++) {
+		rect_t area = view_tile_area(v, frame, t, false);
+
+		if (! rect_intersects(&area, &clip))
+			continue;
+
+		GLint  prevlayers[MAX_ONION_DEPTH], prevcells[MAX_ONION_DEPTH],
+		       nextlayers[MAX_ONION_DEPTH], nextcells[MAX_ONION_DEPTH];
+		bool   empty = true;
+
+		for (int i = 0; i < prev; i++) {
+			if (canvas_draw_tile(c, frame - i - 1, t, level, &prevlayers[i], &prevcells[i]))
+				empty = false;
+		}
+		for (int i = 0; i < next; i++) {
+			if (canvas_draw_tile(c, frame + i + 1, t, level, &nextlayers[i], &nextcells[i]))
+				empty = false;
+		}
+		if (empty)
+			continue;
+
+		rect_t tile   = canvas_tile_rect(c, t);
+		vec2_t origin = vec2(tile.x1, tile.y1);
+		vec4_t a      = vec4(area.x1, area.y1, area.x2 - area.x1, area.y2 - area.y1);
+
+		set_uniform_vec4(ctx->program, UNIFORM_AREA,   &a);
+		set_uniform_vec2(ctx->program, UNIFORM_ORIGIN, &origin);
+
+		if (prev) {
+			set_uniform_i32v(ctx->program, UNIFORM_PREVLAYERS, prev, prevlayers);
+			set_uniform_i32v(ctx->program, UNIFORM_PREVCELLS,  prev, prevcells);
+		}
+		if (next) {
+			set_uniform_i32v(ctx->program, UNIFORM_NEXTLAYERS, next, nextlayers);
+			set_uniform_i32v(ctx->program, UNIFORM_NEXTCELLS,  next, nextcells);
+		}
+
+		polygon_draw(ctx, &session->overlay);
 	}
+	ctx_program(ctx, PROGRAM_NONE);
 }
 
 static void view_readpixels(struct view *v, rgba_t *buf)
 {
-	framebuffer_read(v->fb, view_rect(v), buf);
+	canvas_read(v->canvas, view_rect(v), buf);
+}
+
+/* Turn a color into the pixel drawn into a view to paint it. On indexed
+ * views, that's the color's index in the red channel, and the color is
+ * added to the colormap if needed. Transparent colors stay transparent, so
+ * that blending leaves the view as it is. Returns false if the colormap is
+ * full. */
+static bool view_encode(struct view *v, rgba_t *color)
+{
+	if (! v->colormap)
+		return true;
+
+	if (color->a == 0) {
+		*color = TRANSPARENT;
+		return true;
+	}
+	int idx = colormap_index(v->colormap, *color);
+
+	if (idx < 0) {
+		message(MSG_ERR, "Error: the view's palette is full");
+		return false;
+	}
+	*color = rgba((uint8_t)idx, 0, 0, 255);
+
+	return true;
 }
 
-static void view_resize_framebuffer(struct view *v, int w, int h, struct context *ctx)
+/* Replace pixels read from a view by their colors, if the view is indexed. */
+static void view_decode(struct view *v, rgba_t *pixels, size_t n)
 {
-	int cw = v->fb->tex->w,
-	    ch = v->fb->tex->h;
+	if (! v->colormap)
+		return;
+
+	for (size_t i = 0; i < n; i++)
+		pixels[i] = v->colormap->colors[pixels[i].r];
+}
 
-	if (w != cw || h != ch) {
-		struct framebuffer *fb = framebuffer(w, h, NULL);
+/* Get a copy of a texture with its colors encoded for a view, as by
+ * `view_encode`. Returns NULL if they don't all fit in the colormap. */
+static struct texture *view_encode_texture(struct view *v, struct texture *t)
+{
+	size_t  n      = (size_t)(t->w * t->h);
+	rgba_t *pixels = malloc(sizeof(*pixels) * n);
+	rgba_t  from   = TRANSPARENT,
+	        to     = TRANSPARENT;
 
-		ctx_identity(ctx);
+	texture_bind(t);
+	trace_begin("gl", "glGetTexImage");
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	trace_end("gl", "glGetTexImage");
+	gl_stats.readbacks ++;
+	texture_bind(NULL);
 
-		framebuffer_bind(fb);
-		framebuffer_clear();
-		framebuffer_draw(v->fb, ctx);
-		framebuffer_free(v->fb);
+	for (size_t i = 0; i < n; i++) {
+		if (rgbacmp(pixels[i], from)) {
+			from = to = pixels[i];
 
-		v->fb = fb;
+			if (! view_encode(v, &to)) {
+				free(pixels);
+				return NULL;
+			}
+		}
+		pixels[i] = to;
 	}
+	struct texture *enc = texture(pixels, t->w, t->h, GL_RGBA);
+	free(pixels);
+
+	return enc;
+}
+
+/* Replace the pixels of a view with a new canvas. Every frame is considered
+ * changed. */
+static void view_replace_canvas(struct view *v, struct canvas *c)
+{
+	view_touch_all(v);
+	canvas_free(v->canvas);
+	free(v->clean);
+
+	v->canvas  = c;
+	v->clean   = calloc((size_t)(c->nframes * c->ntiles), sizeof(*v->clean));
+	v->fw      = c->w;
+	v->fh      = c->h;
+	v->nframes = c->nframes;
 }
 
 static bool view_crop_framebuffer(struct view *v, rect_t crop, struct context *ctx)
 {
+	crop = rect_norm(crop);
+
 	int w = rect_w(&crop);
 	int h = rect_h(&crop);
 
 	if (v->nframes > 1 && w % v->fw != 0)
 		return false;
 
-	struct framebuffer *fb = framebuffer(w, h, NULL);
-
-	ctx_identity(ctx);
-
-	framebuffer_bind(fb);
-	framebuffer_clear();
-	framebuffer_draw_rect(ctx, v->fb, rect_norm(rect_flipy(crop)), 0, 0);
-	framebuffer_free(v->fb);
-	// TODO: Why do we have to flip the rect above?
+	rgba_t *pixels = calloc((size_t)(w * h), sizeof(*pixels));
+	canvas_read(v->canvas, crop, pixels);
 
 	/* If we have a single frame, we have to change the frame width,
 	 * otherwise, we just change the number of frames, given that
 	 * our crop width is a multiple of our frame width. */
 	if (v->nframes == 1) {
-		v->fw = w;
+		view_replace_canvas(v, canvas(w, h, 1, pixels, v->canvas->format));
 	} else {
-		v->nframes = w / v->fw;
+		view_replace_canvas(v, canvas(v->fw, h, w / v->fw, pixels, v->canvas->format));
 	}
-	v->fh = h;
-	v->fb = fb;
+	free(pixels);
 
 	view_snapshot_save(ctx, v, false);
 	view_dirty(v);
@@ -544,18 +1031,24 @@ static bool view_crop_framebuffer(struct view *v, rect_t crop, struct context *c
 	return true;
 }
 
-static void views_refresh(struct view *vs, int zoom)
+static void views_refresh(struct session *s)
 {
-	for (struct view *v = vs; v; v = v->next) {
+	for (struct view *v = s->views; v; v = v->next) {
 		if (v->prev) {
-			v->y = v->prev->y - v->fh * zoom - 25;
+			v->y = v->prev->y - (int)((float)v->fh * s->zoom) - 25;
 		}
 	}
+	views_index(s);
 }
 
 static void view_resize(struct view *v, int fw, int fh, struct context *ctx)
 {
-	view_resize_framebuffer(v, fw * v->nframes, fh, ctx);
+	/* The tile grid changes with the frame size. */
+	view_touch_all(v);
+	canvas_resize(v->canvas, fw, fh);
+
+	v->clean = realloc(v->clean, sizeof(*v->clean) * (size_t)(v->nframes * v->canvas->ntiles));
+	memset(v->clean, 0, sizeof(*v->clean) * (size_t)(v->nframes * v->canvas->ntiles));
 
 	v->fw = fw;
 	v->fh = fh;
@@ -564,12 +1057,23 @@ static void view_resize(struct view *v, int fw, int fh, struct context *ctx)
 	view_dirty(v);
 }
 
+/* Lay out the view's pixels as a strip of frames of the given size. Unlike
+ * frame operations, this goes through every pixel of the view. */
 static void view_slice(struct view *v, int fw, int fh, struct context *ctx)
 {
-	v->nframes = v->fb->tex->w / fw;
-	v->fw      = fw;
-	v->fh      = fh;
+	int n = vw(v) / fw;
+
+	if (n < 1)
+		return;
+
+	rgba_t *pixels = malloc(sizeof(*pixels) * (size_t)(n * fw * vh(v)));
+	canvas_read(v->canvas, rect(0, 0, n * fw, vh(v)), pixels);
+
+	struct canvas *c = canvas(fw, vh(v), n, pixels, v->canvas->format);
+	canvas_resize(c, fw, fh);
+	free(pixels);
 
+	view_replace_canvas(v, c);
 	view_snapshot_save(ctx, v, false);
 	view_dirty(v);
 }
@@ -586,78 +1090,189 @@ static void view_saved(struct view *v)
 		v->filestatus = FILE_SAVED;
 }
 
-static void view_addframe(struct view *v, struct context *ctx)
+/* Insert a frame at position `at`, which is a copy of the frame at position
+ * `src`, or transparent if `src` is negative. Only the new frame's pixels
+ * are written. */
+static void view_insert_frame(struct view *v, int at, int src)
 {
-	assert(v);
+	int                n     = v->canvas->ntiles;
+	struct tilecopy  **clean = v->clean;
 
-	int w = vw(v) + v->fw;
-	int h = vh(v);
+	canvas_insert(v->canvas, at, src);
+	v->clean = malloc(sizeof(*v->clean) * (size_t)((v->nframes + 1) * n));
 
-	view_resize_framebuffer(v, w, h, ctx);
+	memcpy(v->clean, clean, sizeof(*v->clean) * (size_t)(at * n));
+	memcpy(v->clean + (at + 1) * n, clean + at * n, sizeof(*v->clean) * (size_t)((v->nframes - at) * n));
 
-	framebuffer_bind(v->fb);
-	ctx_identity(ctx);
+	for (int t = 0; t < n; t++) {
+		struct tilecopy *copy = src >= 0 ? clean[src * n + t] : NULL;
+		v->clean[at * n + t] = copy ? tilecopy_retain(copy) : NULL;
+	}
+	v->nframes ++;
+	free(clean);
+}
 
-	ctx_texture_draw_rect(ctx, v->fb->tex,
-		vw(v) - v->fw, 0,
-		v->fw,         v->fh,
-		vw(v),         0
-	);
+static void view_remove_frame(struct view *v, int frame)
+{
+	int n = v->canvas->ntiles;
 
-	v->nframes ++;
+	canvas_remove(v->canvas, frame);
+
+	for (int t = 0; t < n; t++)
+		tilecopy_release(v->clean[frame * n + t]);
+
+	v->nframes --;
+	memmove(v->clean + frame * n, v->clean + (frame + 1) * n, sizeof(*v->clean) * (size_t)((v->nframes - frame) * n));
+}
+
+static void view_move_frame(struct view *v, int from, int to)
+{
+	int     n    = v->canvas->ntiles;
+	size_t  size = sizeof(*v->clean) * (size_t)n;
+
+	struct tilecopy **copy = malloc(size);
+
+	canvas_move(v->canvas, from, to);
+	memcpy(copy, v->clean + from * n, size);
+
+	if (from < to) {
+		memmove(v->clean + from * n, v->clean + (from + 1) * n, size * (size_t)(to - from));
+	} else {
+		memmove(v->clean + (to + 1) * n, v->clean + to * n, size * (size_t)(from - to));
+	}
+	memcpy(v->clean + to * n, copy, size);
+	free(copy);
+}
+
+static void view_addframe(struct view *v, struct context *ctx)
+{
+	assert(v);
 
+	view_insert_frame(v, v->nframes, v->nframes - 1);
 	view_snapshot_save(ctx, v, false);
 	view_dirty(v);
 }
 
+/* Save a snapshot of the view. Only tiles which changed since the last
+ * snapshot are copied, the others are shared with it. */
 static void view_snapshot_save(struct context *ctx, struct view *v, bool saved)
 {
-	int w = vw(v),
-	    h = vh(v);
+	trace_begin("px", "view_snapshot_save");
 
 	struct snapshot *s = malloc(sizeof(*s));
+	struct canvas   *c = v->canvas;
 
 	s->x          = 0;
 	s->y          = 0;
-	s->w          = w;
-	s->h          = h;
+	s->w          = v->fw;
+	s->h          = v->fh;
 	s->saved      = saved;
 	s->next       = NULL;
 	s->prev       = v->snapshot;
 	s->nframes    = v->nframes;
+	s->ntiles     = c->ntiles;
+	s->tiles      = malloc(sizeof(*s->tiles) * (size_t)(v->nframes * c->ntiles));
+	s->colors     = NULL;
+	s->ncolors    = 0;
 
 	v->snapshot   = s;
 
+	if (v->colormap) {
+		s->colors  = malloc(sizeof(v->colormap->colors));
+		s->ncolors = v->colormap->ncolors;
+
+		memcpy(s->colors, v->colormap->colors, sizeof(v->colormap->colors));
+	}
+
 	if (s->prev) {
 		s->next       = s->prev->next;
 		s->prev->next = s;
 	}
 
-	framebuffer_bind(v->fb);
-	s->pixels = texture_read(view_rect(v));
+	for (int i = 0; i < v->nframes * c->ntiles; i++) {
+		int f = i / c->ntiles,
+		    t = i % c->ntiles;
+
+		if (canvas_tile_empty(c, f, t)) {
+			s->tiles[i] = NULL;
+			continue;
+		}
+		/* Paged out tiles are copied from host memory, without paging
+		 * them in. */
+		if (! v->clean[i]) {
+			rect_t  r      = rect_translate(canvas_tile_rect(c, t), vec2(f * v->fw, 0));
+			rgba_t *pixels = malloc(sizeof(*pixels) * (size_t)(rect_w(&r) * rect_h(&r)));
+
+			canvas_read(c, r, pixels);
+			v->clean[i] = tilecopy(pixels);
+		}
+		s->tiles[i] = tilecopy_retain(v->clean[i]);
+	}
 	framebuffer_bind(ctx->screen);
+
+	trace_end("px", "view_snapshot_save");
 }
 
+/* Restore a snapshot of the view. Only tiles which differ from the
+ * snapshot are drawn. */
 static void view_snapshot_restore(struct context *ctx, struct view *v, struct snapshot *s)
 {
-	if (vw(v) != s->w || vh(v) != s->h) {
-		view_resize_framebuffer(v, s->w, s->h, ctx);
+	struct canvas *c      = v->canvas;
+	int            failed = 0;
+
+	if (v->fw != s->w || v->fh != s->h) {
+		view_touch_all(v);
+		canvas_resize(c, s->w, s->h);
+
+		v->clean = realloc(v->clean, sizeof(*v->clean) * (size_t)(v->nframes * c->ntiles));
+		memset(v->clean, 0, sizeof(*v->clean) * (size_t)(v->nframes * c->ntiles));
 	}
+	assert(c->ntiles == s->ntiles);
 
-	framebuffer_bind(v->fb);
-	framebuffer_clear();
+	while (v->nframes > s->nframes)
+		view_remove_frame(v, v->nframes - 1);
 
-	ctx_identity(ctx);
+	while (v->nframes < s->nframes)
+		view_insert_frame(v, v->nframes, -1);
 
-	ctx_texture_draw(ctx, s->pixels, 0, 0);
-	framebuffer_bind(ctx->screen);
+	for (int i = 0; i < v->nframes * c->ntiles; i++) {
+		int f = i / c->ntiles,
+		    t = i % c->ntiles;
 
-	if (s->saved) view_saved(v);
+		if (! s->tiles[i]) {
+			canvas_drop_tile(c, f, t);
+			view_touch(v, f, t);
+			continue;
+		}
+		if (v->clean[i] == s->tiles[i] && ! canvas_tile_empty(c, f, t))
+			continue;
+
+		if (! canvas_write(c, f, t, s->tiles[i]->pixels)) {
+			failed ++;
+			continue;
+		}
+		view_touch(v, f, t);
+		v->clean[i] = tilecopy_retain(s->tiles[i]);
+	}
+	framebuffer_bind(ctx->screen);
+
+	if (failed > 0)
+		message(MSG_ERR, "Error: %d tiles couldn't be restored", failed);
+
+	if (s->colors && v->colormap) {
+		struct colormap *cm = v->colormap;
+
+		memcpy(cm->colors, s->colors, sizeof(cm->colors));
+		cm->ncolors = s->ncolors;
+
+		texture_update(cm->lut, 0, 0, (int)elems(cm->colors), 1, cm->colors);
+	}
+
+	if (s->saved) view_saved(v);
 	else          view_dirty(v);
 
-	v->fw       = s->w / s->nframes;
+	v->fw       = s->w;
 	v->fh       = s->h;
-	v->nframes  = s->nframes;
 	v->snapshot = s;
 }
 
@@ -674,11 +1289,26 @@ static bool view_save_as(struct view *v, const char *filename)
 	view_readpixels(session->view, tmp);
 	framebuffer_bind(session->ctx->screen);
 
-	if (tga_save(tmp, w, h, 32, filename) != 0) {
+	int err;
+
+	/* Indexed views are saved with their colormap, and a byte per pixel. */
+	if (v->colormap) {
+		uint8_t *indices = malloc((size_t)(w * h));
+
+		for (int i = 0; i < w * h; i++)
+			indices[i] = tmp[i].r;
+
+		err = tga_save_indexed(indices, w, h, v->colormap->colors, max(v->colormap->ncolors, 1), filename);
+		free(indices);
+	} else {
+		err = tga_save(tmp, w, h, 32, filename);
+	}
+	free(tmp);
+
+	if (err != 0) {
 		infof("px", "error: unable to save copy to '%s'", filename);
 		return false;
 	}
-	free(tmp);
 
 	view_filename(v, filename);
 	v->filestatus = FILE_SAVED;
@@ -704,116 +1334,146 @@ static void view_undo(struct context *ctx, struct view *v)
 	view_snapshot_restore(ctx, v, v->snapshot->prev);
 }
 
-static void view_draw_boundaries(struct view *v)
+/* Draw a view along with the checkerboard underneath it, and the selection
+ * grid, grid, frame separators and boundary on top of it, in a single pass
+ * per tile. Only the tiles within `clip`, in view coordinates, are drawn.
+ * When `preview` is set, only the given frame is drawn, as the animation
+ * preview. */
+static void view_draw_overlay(struct context *ctx, struct view *v, int frame, bool preview, rect_t clip)
 {
-	int x = v->x,
-	    y = v->y;
-
-	for (int i = 1; i < v->nframes; i++) {
-		int bx = x + i * v->fw * session->zoom,
-		    by = y;
+	struct session *s = session;
 
-		draw_vline(DARKGREY, bx, by, by + v->fh * session->zoom);
+	float   zoom      = s->zoom;
+	int     level     = view_level(v);
+	int     nframes   = preview ? 1 : v->nframes;
+	bool    current   = ! preview && v == s->view;
+	rect_t  sel       = rect(0, 0, 0, 0);
+	rgba_t  border;
 
+	if (preview) {
+		border = s->checker.active ? GREY : TRANSPARENT;
+	} else if (current) {
+		border = s->mode == MODE_PIXEL ? RED : WHITE;
+	} else {
+		border = v->hover ? LIGHTGREY : GREY;
 	}
+	if (current && zoom >= 6 && (s->mode == MODE_PIXEL || !rect_isempty(s->selection)))
+		sel = rect_norm(s->selection);
+
+	vec2_t size      = vec2(v->fw, v->fh);
+	vec2_t flip      = preview ? vec2(0, 0) : vec2(v->flipx, v->flipy);
+	vec2_t grid      = current && s->gridw > 0 && s->gridh > 0 && zoom >= 1 ? vec2(s->gridw, s->gridh) : vec2(0, 0);
+	vec4_t selection = vec4(sel.x1, sel.y1, sel.x2, sel.y2);
+	vec4_t bcolor    = rgba2vec4(border);
+	vec4_t separator = rgba2vec4(DARKGREY);
+	vec4_t gridcolor = rgba2vec4(GRID_COLOR);
+	vec4_t selcolor  = rgba2vec4(rgba(190, 0, 0, 32));
+
+	/* The pending adjustment is previewed by the overlay, so that scrubbing
+	 * doesn't touch any pixels. */
+	rect_t adj       = ! preview && s->adjust.view == v ? s->adjust.area : rect(0, 0, 0, 0);
+	vec3_t adjust    = vec3(s->adjust.hsl[0], s->adjust.hsl[1], s->adjust.hsl[2]);
+	vec4_t adjarea   = vec4(adj.x1, adj.y1, adj.x2, adj.y2);
+
+	ctx_program(ctx, PROGRAM_OVERLAY);
+
+	set_uniform_vec2(ctx->program, UNIFORM_SIZE,       &size);
+	set_uniform_vec2(ctx->program, UNIFORM_FLIP,       &flip);
+	set_uniform_vec2(ctx->program, UNIFORM_GRID,       &grid);
+	set_uniform_vec4(ctx->program, UNIFORM_SELECTION,  &selection);
+	set_uniform_vec4(ctx->program, UNIFORM_BORDER,     &bcolor);
+	set_uniform_vec4(ctx->program, UNIFORM_SEPARATOR,  &separator);
+	set_uniform_vec4(ctx->program, UNIFORM_GRIDCOLOR,  &gridcolor);
+	set_uniform_vec4(ctx->program, UNIFORM_SELCOLOR,   &selcolor);
+	set_uniform_vec3(ctx->program, UNIFORM_ADJUSTMENT, &adjust);
+	set_uniform_vec4(ctx->program, UNIFORM_ADJUSTAREA, &adjarea);
+	set_uniform_f32(ctx->program,  UNIFORM_ZOOM,       zoom);
+	set_uniform_i32(ctx->program,  UNIFORM_LEVEL,      level);
+	set_uniform_i32(ctx->program,  UNIFORM_LOWRES,     2);
+	set_uniform_i32(ctx->program,  UNIFORM_NFRAMES,    nframes);
+	set_uniform_i32(ctx->program,  UNIFORM_CHECKER,    s->checker.active);
+
+	view_bind_colormap(ctx, v);
+
+	struct canvas *c = v->canvas;
+
+	float fw    = (float)v->fw * zoom,
+	      ext   = ceilf((float)(nframes * v->fw) * zoom),
+	      bot   = ceilf((float)v->fh * zoom);
+	int   slot1 = max(0, (int)(clip.x1 / fw)),
+	      slot2 = min(nframes - 1, (int)(clip.x2 / fw));
+
+	canvas_bind_texture(c);
+
+	for (int slot = slot1; slot <= slot2; slot++) {
+		/* Flipping the view also reverses the order of its frames. */
+		int f = preview ? frame : slot;
+
+		if (! preview && v->flipx)
+			f = v->nframes - 1 - slot;
+
+		for (int t = 0; t < c->ntiles; t++) {
+			rect_t area = view_tile_area(v, slot, t, ! preview);
+
+			/* The overlay extends one pixel past the view, for the border. */
+			if (area.x1 == 0)   area.x1 = -1;
+			if (area.y1 == 0)   area.y1 = -1;
+			if (area.x2 == ext) area.x2 += 1;
+			if (area.y2 == bot) area.y2 += 1;
+
+			if (! rect_intersects(&area, &clip))
+				continue;
 
-	rgba_t color =
-		v == session->view ?
-			(session->mode == MODE_PIXEL ? RED : WHITE) : (v->hover ? LIGHTGREY : GREY);
-
-	draw_boundary(
-		color,
-		x                         - 1,
-		y                         - 1,
-		x + vw(v) * session->zoom + 1,
-		y + vh(v) * session->zoom + 1
-	);
-
-	if (session->checker.active && v->nframes > 1 && !session->paused) {
-		draw_boundary(
-			GREY,
-			x - v->fw * session->zoom - 1,
-			y                         - 1,
-			x                         + 0,
-			y + v->fh * session->zoom + 1
-		);
-	}
-}
-
-static void view_draw_grid(struct view *v, int gw, int gh, rgba_t color, int zoom)
-{
-	if (gw <= 0 || gh <= 0)
-		return;
+			rect_t tile   = canvas_tile_rect(c, t);
+			vec2_t origin = vec2(tile.x1, tile.y1);
+			vec4_t a      = vec4(area.x1, area.y1, area.x2 - area.x1, area.y2 - area.y1);
+			int    layer, cell;
 
-	int totalw = vw(v) * zoom;
-	int totalh = vh(v) * zoom;
+			canvas_draw_tile(c, f, t, level, &layer, &cell);
 
-	gw *= zoom;
-	gh *= zoom;
+			set_uniform_vec4(ctx->program, UNIFORM_AREA,   &a);
+			set_uniform_vec2(ctx->program, UNIFORM_ORIGIN, &origin);
+			set_uniform_i32(ctx->program,  UNIFORM_SLOT,   slot);
+			set_uniform_i32(ctx->program,  UNIFORM_LAYER,  layer);
+			set_uniform_i32(ctx->program,  UNIFORM_CELL,   cell);
 
-	draw_grid(color, gw, gh, totalw, totalh);
+			polygon_draw(ctx, &s->overlay);
+		}
+	}
+	ctx_program(ctx, PROGRAM_NONE);
 }
 
 static void view_draw
 	( struct context *ctx
 	, struct view *v
-	, float zoom
 	, int mx
 	, int my
+	, rect_t clip
 	)
 {
-	view_draw_checker(ctx, v, v->nframes);
-
-	ctx_save(ctx);
-	ctx_scale(ctx, v->flipx ? -1 : 1, v->flipy ? -1 : 1);
-	ctx_translate(ctx, v->flipx ? vw(v) * zoom : 0, v->flipy ? vh(v) * zoom : 0);
+	float zoom = session->zoom;
 
-	framebuffer_draw(v->fb, ctx);
-
-	ctx_restore(ctx);
+	view_draw_overlay(ctx, v, 0, false, clip);
 
 	if (v->nframes > 1) {
-		if (session->onion) {
-			view_draw_onionskin(ctx, v, view_frame_at(v, (int)mx, (int)my));
-		}
+		if (session->onion.active)
+			view_draw_onionskin(ctx, v, view_frame_at(v, (int)mx, (int)my), clip);
+
 		if (! session->paused) {
 			ctx_save(ctx);
-			ctx_translate(ctx, -(v->fw * zoom), 0);
-			view_draw_checker(ctx, v, 1);
-			view_draw_animation(ctx, v);
+			ctx_translate(ctx, -((float)v->fw * zoom), 0);
+			view_draw_overlay(ctx, v, view_animation_frame(ctx, v), true,
+				rect_translate(clip, vec2((float)v->fw * zoom, 0)));
 			ctx_restore(ctx);
 		}
 	}
 }
 
-static void view_draw_checker(struct context *ctx, struct view *v, int nframes)
-{
-	struct spritebatch sb;
-
-	if (! session->checker.active)
-		return;
-
-	float ratio   = (float)v->fw * nframes / (float)v->fh;
-	float repeatx = session->zoom * ratio;
-	float repeaty = session->zoom;
-
-	spritebatch_init(&sb, session->checker.tex);
-	spritebatch_add(&sb,
-		rect(0, 0, session->checker.tex->w, session->checker.tex->h),
-		rect(0, 0, v->fw * nframes, v->fh),
-		repeatx,
-		repeaty,
-		vec4identity
-	);
-	spritebatch_draw(&sb, ctx);
-	spritebatch_release(&sb);
-}
-
 /** SHORTCUTS *****************************************************************/
 
 static void session_view_vcenter(struct session *, struct view *);
 static void session_view_center(struct session *, struct view *);
-static void session_zoom(struct session *, int);
+static void session_zoom(struct session *, float);
 static void session_tool_switch(struct session *, enum tooltype);
 static void session_brush_paint(struct session *);
 static void session_brush_erase(struct session *);
@@ -825,7 +1485,7 @@ static void kb_save(struct session *s, const union arg *arg)
 
 static void kb_move(struct session *s, const union arg *arg)
 {
-	s->view->x += s->view->fw * -arg->p.x * s->zoom;
+	s->view->x += (int)((float)(s->view->fw * -arg->p.x) * s->zoom);
 }
 
 static void kb_nudge(struct session *s, const union arg *arg)
@@ -855,47 +1515,65 @@ static void kb_center_view(struct session *s, const union arg *arg)
 	session_view_center(s, s->view);
 }
 
-static void session_copy_rect(struct session *s, rect_t *r)
+static bool session_copy_rect(struct session *s, rect_t *r)
 {
+	rect_t  n = rect_norm(*r);
+
+	/* The paste buffer is a single texture. */
+	if (rect_w(&n) > texture_max_size() || rect_h(&n) > texture_max_size()) {
+		message(MSG_ERR, "Error: selection is too large to copy");
+		return false;
+	}
+	rgba_t *pixels = calloc((size_t)(rect_w(&n) * rect_h(&n)), sizeof(*pixels));
+
 	if (s->paste)
 		texture_free(s->paste);
 
-	s->paste = texture_read(rect_norm(*r));
+	/* The paste buffer holds colors, even when copying from an indexed
+	 * view, so that it can be pasted into any view. */
+	canvas_read(s->view->canvas, n, pixels);
+	view_decode(s->view, pixels, (size_t)(rect_w(&n) * rect_h(&n)));
+	s->paste = texture(pixels, rect_w(&n), rect_h(&n), GL_RGBA);
+
+	free(pixels);
+
+	return true;
 }
 
 static void kb_px_copy(struct session *s, const union arg *arg)
 {
-	framebuffer_bind(s->view->fb);
-	session_copy_rect(s, &s->selection);
+	if (! session_copy_rect(s, &s->selection))
+		return;
 	framebuffer_bind(s->ctx->screen);
 	message(MSG_INFO, "%d pixels copied", rect_w(&s->selection) * (int)rect_h(&s->selection));
 }
 
 static void kb_px_cut(struct session *s, const union arg *arg)
 {
-	framebuffer_bind(s->view->fb);
-	ctx_identity(s->ctx);
+	struct view *v   = s->view;
+	rect_t       sel = rect_norm(s->selection);
 
-	rect_t sel = rect_norm(s->selection);
-
-	session_copy_rect(s, &sel);
+	if (! session_copy_rect(s, &sel))
+		return;
 
+	ctx_identity(s->ctx);
 	ctx_blend(s->ctx,
 		vec4(0, 0, 0, 0),
 		GL_ONE, GL_SRC_ALPHA
 	);
-	fill_rect
-		( s->ctx
-		, (int)sel.x1
-		, (int)sel.y1
-		, (int)sel.x2
-		, (int)sel.y2
-		, rgba(0, 0, 0, 0)
-		);
+	/* Empty tiles are already clear. */
+	struct tileiter it;
+
+	for (canvas_tiles(&it, v->canvas, sel, false); canvas_tiles_next(&it); ) {
+		rect_t r = rect_translate(sel, vec2(-it.x, -it.y));
+
+		fill_rect(s->ctx, (int)r.x1, (int)r.y1, (int)r.x2, (int)r.y2, rgba(0, 0, 0, 0));
+		view_touch(v, it.frame, it.tile);
+	}
 	ctx_blend_alpha(s->ctx);
 	framebuffer_bind(s->ctx->screen);
-	view_snapshot_save(s->ctx, s->view, false);
-	view_dirty(s->view);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
 }
 
 static void kb_px_paste(struct session *s, const union arg *arg)
@@ -903,21 +1581,36 @@ static void kb_px_paste(struct session *s, const union arg *arg)
 	if (! s->paste)
 		return;
 
-	framebuffer_bind(s->view->fb);
+	struct view    *v     = s->view;
+	rect_t          sel   = rect_norm(s->selection);
+	struct texture *paste = v->colormap ? view_encode_texture(v, s->paste) : s->paste;
+
+	if (! paste)
+		return;
+
+	struct tileiter it;
+
 	ctx_identity(s->ctx);
 
-	struct spritebatch sb;
-	spritebatch_init(&sb, s->paste);
-	spritebatch_add(&sb,
-		rect(0, 0, s->paste->w, s->paste->h),
-		rect_norm(s->selection),
-		1, 1, vec4identity);
-	spritebatch_draw(&sb, s->ctx);
-	spritebatch_release(&sb);
+	for (canvas_tiles(&it, v->canvas, sel, true); canvas_tiles_next(&it); ) {
+		struct spritebatch sb;
+
+		spritebatch_init(&sb, paste);
+		spritebatch_add(&sb,
+			rect(0, 0, s->paste->w, s->paste->h),
+			rect_translate(sel, vec2(-it.x, -it.y)),
+			1, 1, vec4identity);
+		spritebatch_draw(&sb, s->ctx);
+		spritebatch_release(&sb);
+
+		view_touch(v, it.frame, it.tile);
+	}
+	if (paste != s->paste)
+		texture_free(paste);
 
 	framebuffer_bind(s->ctx->screen);
-	view_snapshot_save(s->ctx, s->view, false);
-	view_dirty(s->view);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
 
 	message(MSG_INFO, "%d pixels pasted", s->paste->w * s->paste->h);
 }
@@ -989,7 +1682,7 @@ static void kb_px_select_frame(struct session *s, const union arg *arg)
 
 static void kb_onion(struct session *s, const union arg *arg)
 {
-	s->onion = !s->onion;
+	s->onion.active = !s->onion.active;
 }
 
 static void kb_pan(struct session *s, const union arg *arg)
@@ -1051,6 +1744,11 @@ static void kb_toggle_checker(struct session *s, const union arg *a)
 	s->checker.active = !s->checker.active;
 }
 
+static void kb_toggle_perf(struct session *s, const union arg *a)
+{
+	session_perf_toggle(s);
+}
+
 static void kb_swap_colors(struct session *s, const union arg *a)
 {
 	rgba_t tmp  = s->fg;
@@ -1089,7 +1787,7 @@ static void kb_brush_size(struct session *s, const union arg *arg)
 
 static void kb_zoom(struct session *s, const union arg *arg)
 {
-	static int zooms[] = {1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 32, 64, 128};
+	static float zooms[] = {0.125f, 0.25f, 0.5f, 1, 2, 3, 4, 6, 8, 10, 12, 16, 20, 24, 32, 64, 128};
 
 	unsigned i;
 	int z = arg->i;
@@ -1114,7 +1812,7 @@ static void kb_zoom(struct session *s, const union arg *arg)
 				break;
 			i --;
 		}
-		if (s->zoom > 1) {
+		if (s->zoom > zooms[0]) {
 			session_zoom(s, zooms[i]);
 		}
 	}
@@ -1136,6 +1834,40 @@ static void kb_flipy(struct session *s, const union arg *arg)
 		s->view->flipx = false;
 }
 
+/* Set a channel of the pending adjustment, starting one over the selection,
+ * or the view if nothing is selected, if there isn't one yet. The hue is
+ * given in degrees, and saturation and lightness in percent. Only the
+ * overlay is redrawn while the adjustment is previewed, so changes show up
+ * at once, however large the view. */
+static void session_adjust(struct session *s, enum adjustchannel ch, float value, bool relative)
+{
+	struct adjustment *a = &s->adjust;
+
+	if (a->view != s->view) {
+		a->view = s->view;
+		a->area = rect_isempty(s->selection) ? view_rect(s->view) : rect_norm(s->selection);
+		a->hsl[0] = a->hsl[1] = a->hsl[2] = 0;
+	}
+	if (ch == ADJUST_HUE) {
+		value /= 360.f;
+		value  = fmodf((relative ? a->hsl[ch] : 0) + value, 1.f);
+	} else {
+		value /= 100.f;
+		value  = max(-1.f, min(1.f, (relative ? a->hsl[ch] : 0) + value));
+	}
+	a->hsl[ch] = value;
+
+	message(MSG_INFO, "Adjusting hue %+.0f, saturation %+.0f%%, lightness %+.0f%%",
+		a->hsl[ADJUST_HUE] * 360.f, a->hsl[ADJUST_SATURATION] * 100.f, a->hsl[ADJUST_LIGHTNESS] * 100.f);
+}
+
+/* Scrub a channel of the pending adjustment, eg. `{ .p = {ADJUST_HUE, +15} }`
+ * to rotate the hue by 15 degrees. */
+static void kb_adjust(struct session *s, const union arg *arg)
+{
+	session_adjust(s, (enum adjustchannel)arg->p.x, (float)arg->p.y, true);
+}
+
 static void kb_adjust_fps(struct session *s, const union arg *arg)
 {
 	s->fps += arg->i;
@@ -1234,11 +1966,24 @@ static struct point snap(struct session *, struct point, int, int);
 static struct checker checker(bool active)
 {
 	return (struct checker){
-		.tex    = texture_load("assets/alpha.tga", GL_RGBA),
 		.active = active,
 	};
 }
 
+static struct onion onion(bool active)
+{
+	return (struct onion){
+		.active    = active,
+		.depth     = 3,
+		.direction = ONION_PREV,
+		.opacity   = 0.5f,
+		.falloff   = 0.5f,
+		.prevtint  = rgba(255, 0, 0, 255),
+		.nexttint  = rgba(0, 0, 255, 255),
+		.tint      = 0.f,
+	};
+}
+
 static void session_init(struct session *s, struct context *ctx)
 {
 	s->w          = ctx->width;
@@ -1252,7 +1997,8 @@ static void session_init(struct session *s, struct context *ctx)
 	s->zoom       = 1;
 	s->paused     = true;
 	s->help       = false;
-	s->onion      = false;
+	s->onion      = onion(false);
+	s->adjust     = (struct adjustment){0};
 	s->fg         = WHITE;
 	s->bg         = BLACK;
 	s->started    = ctx_time(ctx);
@@ -1262,16 +2008,29 @@ static void session_init(struct session *s, struct context *ctx)
 	s->ctx        = ctx;
 	s->cmdline    = cmdline();
 	s->checker    = checker(false);
+	s->overlay    = rectangle(rect(0, 0, 1, 1));
 	s->gridw      = 0;
 	s->gridh      = 0;
 	s->mode       = MODE_NORMAL;
 	s->paste      = NULL;
 	s->selection  = rect(0, 0, 0, 0);
-	s->macro      = NULL;
-	s->macros     = NULL;
 	s->play       = NULL;
+	s->clock      = (struct vclock){ .speed = 1 };
 	s->recording  = false;
 	s->recopts    = 0;
+	s->damage     = DAMAGE_ALL;
+	s->hover      = NULL;
+	s->vindex     = (struct viewindex){0};
+	s->damaged    = rect(0, 0, 0, 0);
+	s->cursorrect = rect(0, 0, 0, 0);
+	s->deadline   = 0;
+	s->tilefails  = 0;
+	s->checks     = 0;
+	s->failures   = 0;
+	s->testing    = false;
+	s->bench      = NULL;
+
+	readback_init(&s->probe);
 
 	*s->message   = '\0';
 
@@ -1290,29 +2049,18 @@ static void session_init(struct session *s, struct context *ctx)
 	s->tool.brush.multi     = false;
 }
 
-static struct macro *session_macro_alloc(struct session *s)
-{
-	if (! s->macros) {
-		s->macros = s->macro = calloc(1, sizeof(*s->macro));
-	} else {
-		s->macro->next = calloc(1, sizeof(*s->macro));
-		s->macro = s->macro->next;
-	}
-	return s->macro;
-}
-
 static void session_macro_record(struct session *s, const char *fmt, ...)
 {
 	if (! s->recording)
 		return;
 
-	char         *cmd;
-	struct macro *m;
+	char          cmd[MACRO_LINE];
+	unsigned long delay = 0;
 
 	{
 		va_list ap;
 		va_start(ap, fmt);
-		vasprintf(&cmd, fmt, ap);
+		vsnprintf(cmd, sizeof(cmd), fmt, ap);
 		va_end(ap);
 	}
 
@@ -1320,46 +2068,106 @@ static void session_macro_record(struct session *s, const char *fmt, ...)
 		struct timeval now;
 		gettimeofday(&now, NULL);
 
-		int      frame_msec = 1000 / s->ctx->vidmode->refreshRate;
+		int      frame_msec = (int)(1000 / s->ctx->pacer.rate);
 		long     delta_usec = now.tv_usec - s->macro_tv.tv_usec;
 		time_t   delta_sec  = now.tv_sec - s->macro_tv.tv_sec;
 		long     delta_msec = delta_sec * 1000 + delta_usec / 1000 - frame_msec;
 
-		if (delta_msec > 0 && s->macros) {
-			m = session_macro_alloc(s);
-			asprintf(&m->cmd, "sleep %ld", delta_msec);
-		}
+		if (delta_msec > 0 && s->macro.steps > 0)
+			delay = (unsigned long)delta_msec;
+
 		s->macro_tv.tv_sec  = now.tv_sec;
 		s->macro_tv.tv_usec = now.tv_usec;
 	}
+	macro_add(&s->macro, delay, cmd);
+}
 
-	m      = session_macro_alloc(s);
-	m->cmd = cmd;
+/* Whether a command needs everything before it to be drawn, along with the
+ * colors being read back, before it's run. */
+static bool session_macro_checkpoint(const char *cmd)
+{
+	return strprefix(cmd, "test/check") || strprefix(cmd, "test/digest") ||
+	       strprefix(cmd, "test/drawn");
 }
 
-static void session_macro_play(struct session *s)
+/* Wait for the colors being read back to arrive. Returns whether any of
+ * them changed, in which case what shows them has to be redrawn. */
+static bool session_readback_wait(struct session *s)
 {
-	if (! s->play)
-		return;
+	bool changed = false;
+
+	if (readback_pending(&s->probe) && readback_wait(&s->probe)) {
+		session_damage(s, DAMAGE_STATUS);
+		changed = true;
+	}
+	if (readback_pending(&s->tools.probe) && readback_wait(&s->tools.probe)) {
+		session_damage(s, DAMAGE_CURSOR);
+		changed = true;
+	}
+	return changed;
+}
+
+/* Whether a macro line is a comment or a sleep, neither of which do any
+ * work that shows up in a frame. */
+static bool session_macro_idle(const char *cmd)
+{
+	return cmd[0] == '\0' || cmd[0] == ';' || strprefix(cmd, "sleep ");
+}
 
+/* Play the next commands of the macro being played. At normal speed, one
+ * command is played per tick. Otherwise, commands are played until a frame's
+ * worth of time has passed, or a checkpoint is reached, and sleeps only
+ * advance the session clock. Benchmarks play one command per tick, without
+ * sleeping, so that they always draw the same frames. Comments and sleeps
+ * don't get a tick of their own, nor are they timed. */
+static void session_macro_play(struct session *s)
+{
 	/* Keep track of the value of `cmd` across function calls, so that
 	 * we can always play the _previous_ command, while displaying the
 	 * _current_. This ensures that we always have a graphics tick
 	 * in between, so that commands are shown before they are run. */
-	static char cmd[128] = {0};
+	static char cmd[MACRO_LINE] = {0};
+
+	double start = ctx_time(s->ctx);
+
+	do {
+		if (! s->play || ctx_time(s->ctx) < s->clock.resume)
+			return;
+
+		/* Checkpoints are run once the colors read back are drawn. */
+		if (session_macro_checkpoint(cmd) && session_readback_wait(s))
+			return;
+
+		if (strlen(cmd)) {
+			double t = ctx_time(s->ctx);
 
-	if (strlen(cmd))
-		command(s, cmd);
+			command(s, cmd);
 
-	if (fgetstr(cmd, sizeof(cmd), s->play)) {
-		if (strlen(cmd) > 0 && cmd[0] != ';') {
-			message(MSG_REPLAY, cmd);
+			if (s->bench && ! session_macro_idle(cmd))
+				samples_add(&s->bench->commands, (ctx_time(s->ctx) - t) * 1000.);
 		}
-	} else {
-		fclose(s->play);
-		s->play = NULL;
-		cmd[0] = '\0';
-	}
+
+		if (s->play && macro_read(s->play, cmd, sizeof(cmd))) {
+			if (strlen(cmd) > 0 && cmd[0] != ';') {
+				message(MSG_REPLAY, cmd);
+			}
+		} else {
+			if (s->play) {
+				macro_close(s->play);
+				free(s->play);
+				s->play = NULL;
+			}
+			s->clock.speed  = 1;
+			s->clock.resume = 0;
+			s->clock.batch  = 0;
+			cmd[0] = '\0';
+
+			if (s->testing || s->bench)
+				ctx_closewindow(s->ctx);
+		}
+	} while ((s->bench && s->play && session_macro_idle(cmd)) ||
+	         (s->clock.batch > 0 && ! session_macro_checkpoint(cmd) &&
+	          ctx_time(s->ctx) < start + s->clock.batch));
 }
 
 static unsigned long session_digest(struct session *s)
@@ -1382,32 +2190,84 @@ static unsigned long session_digest(struct session *s)
 	return digest;
 }
 
-static int session_finish_recording(struct session *s, const char *recpath)
+/* Digest of the pixels of a tile, independent of how the tile is stored. */
+static uint64_t view_tile_digest(struct view *v, int frame, int tile)
 {
-	struct macro      *m = s->macros;
-	struct macro      *prev;
+	rect_t  r   = rect_translate(canvas_tile_rect(v->canvas, tile), vec2(frame * v->fw, 0));
+	size_t  len = sizeof(rgba_t) * (size_t)(rect_w(&r) * rect_h(&r));
+	rgba_t *buf = malloc(len);
 
-	FILE              *fp;
-	int                steps = 0;
+	canvas_read(v->canvas, r, buf);
 
-	if (! recpath)
-		recpath = "/dev/null";
+	uint64_t digest = hash64(buf, len);
+	free(buf);
 
-	if (! (fp = fopen(recpath, "w+")))
-		fatal("record", "Couldn't create recording file");
+	return digest;
+}
+
+/* Tiles whose digests `session_view_digest` records as `test/tile` lines. */
+enum tiledigest {
+	TILEDIGEST_NONE,
+	TILEDIGEST_NONEMPTY,
+	TILEDIGEST_ALL
+};
+
+/* Digest of the pixels of every view, computed from the digests of their
+ * tiles. Unlike `session_digest`, this doesn't depend on the window, zoom
+ * level or UI. The digests of the tiles are recorded along the way, if
+ * asked to, so that they're only computed once. */
+static uint64_t session_view_digest(struct session *s, enum tiledigest record)
+{
+	uint64_t *buf   = NULL;
+	int       len   = 0,
+	          cap   = 0,
+	          nview = 1;
+
+	for (struct view *v = s->views; v; v = v->next, nview++) {
+		int ntiles = v->canvas->ntiles;
+
+		if (len + v->nframes * ntiles + 3 > cap) {
+			cap = max(cap * 2, len + v->nframes * ntiles + 3);
+			buf = realloc(buf, sizeof(*buf) * (size_t)cap);
+		}
+		buf[len ++] = (uint64_t)v->fw;
+		buf[len ++] = (uint64_t)v->fh;
+		buf[len ++] = (uint64_t)v->nframes;
 
-	while (m) {
-		fprintf(fp, "%s\n", m->cmd);
+		for (int i = 0; i < v->nframes * ntiles; i++) {
+			int f = i / ntiles,
+			    t = i % ntiles;
 
-		free(m->cmd);
-		prev = m;
-		m = m->next;
-		free(prev);
+			buf[len ++] = view_tile_digest(v, f, t);
 
-		steps ++;
+			if (record == TILEDIGEST_ALL ||
+			   (record == TILEDIGEST_NONEMPTY && ! canvas_tile_empty(v->canvas, f, t))) {
+				session_macro_record(s, "test/tile %d %d %d %016llx",
+					nview, f + 1, t + 1, (unsigned long long)buf[len - 1]);
+			}
+		}
 	}
-	fclose(fp);
+	uint64_t digest = hash64(buf, sizeof(*buf) * (size_t)len);
+
+	free(buf);
+	framebuffer_bind(s->ctx->screen);
+
+	return digest;
+}
+
+/* Write out the macro being recorded, in the binary encoding. It can be
+ * converted to text with `macro/convert`. */
+static int session_finish_recording(struct session *s, const char *recpath)
+{
+	int steps = s->macro.steps;
 
+	if (! recpath)
+		recpath = "/dev/null";
+
+	if (! macro_save(&s->macro, recpath))
+		fatal("record", "Couldn't create recording file");
+
+	macro_free(&s->macro);
 	s->recording = false;
 
 	return steps;
@@ -1417,6 +2277,7 @@ static void session_start_recording(struct session *s, unsigned opts)
 {
 	/* Start the macro timer */
 	gettimeofday(&s->macro_tv, NULL);
+	macro_init(&s->macro);
 	s->recording = true;
 	s->recopts   = opts;
 }
@@ -1430,7 +2291,7 @@ static void session_tool_switch(struct session *s, enum tooltype t)
 	s->tool.curr = t;
 }
 
-static void session_zoom(struct session *s, int zoom)
+static void session_zoom(struct session *s, float zoom)
 {
 	double px           = s->mx - s->x;
 	double py           = s->my - s->y;
@@ -1438,7 +2299,7 @@ static void session_zoom(struct session *s, int zoom)
 
 	s->zoom = zoom;
 
-	if (view_within(s->view, s->mx, s->my, (int)zprev)) {
+	if (view_within(s->view, s->mx, s->my, (float)zprev)) {
 		double zdiff = (double)s->zoom / zprev;
 
 		int nx = (int)floor(px * zdiff);
@@ -1450,7 +2311,7 @@ static void session_zoom(struct session *s, int zoom)
 		double vx = s->view->x;
 		double vy = s->view->y;
 
-		views_refresh(s->views, s->zoom);
+		views_refresh(s);
 
 		int dx = s->view->x - (int)floor(vx * zdiff);
 		int dy = s->view->y - (int)floor(vy * zdiff);
@@ -1458,7 +2319,7 @@ static void session_zoom(struct session *s, int zoom)
 		s->x -= dx;
 		s->y -= dy;
 	} else {
-		views_refresh(s->views, s->zoom);
+		views_refresh(s);
 		session_view_center(s, s->view);
 	}
 }
@@ -1488,19 +2349,54 @@ static void session_pick_color(struct session *s, rgba_t color)
 	session_brush_paint(s);
 }
 
+/* Get the color at the given screen coordinates. This waits for drawing to
+ * finish, so it's only used for explicit picks. */
 static rgba_t session_color_at(struct session *s, int x, int y)
 {
-	struct view *v = s->views;
-	while (v) {
-		if (v->hover) {
-			struct point p = session_view_coords(s, v, x, y);
-			return framebuffer_sample(v->fb, p.x, p.y);
-		}
-		v = v->next;
+	if (s->hover) {
+		struct point p = session_view_coords(s, s->hover, x, y);
+		rgba_t       c = canvas_sample(s->hover->canvas, p.x, p.y);
+
+		view_decode(s->hover, &c, 1);
+
+		return c;
 	}
 	return framebuffer_sample(s->ctx->screen, x, y);
 }
 
+/* Request the color at the given screen coordinates, to be read back from
+ * `rb` once the GPU gets to it, usually by the next frame. */
+static void session_probe_color(struct session *s, struct readback *rb, int x, int y)
+{
+	if (s->hover) {
+		struct point  p    = session_view_coords(s, s->hover, x, y);
+		const rgba_t *host = canvas_host_pixel(s->hover->canvas, p.x, p.y);
+
+		/* Tiles in host memory are answered from there, rather than being
+		 * paged in. */
+		if (host) {
+			readback_value(rb, *host);
+		} else if (canvas_bind_pixel(s->hover->canvas, &p.x, &p.y)) {
+			readback_pixel(rb, p.x, p.y);
+		} else {
+			readback_value(rb, TRANSPARENT);
+		}
+		return;
+	}
+	framebuffer_bind(s->ctx->screen);
+	readback_pixel(rb, x, y);
+}
+
+/* Collect the colors read back since the last frame, and redraw what shows
+ * them if they changed. */
+static void session_readback(struct session *s)
+{
+	if (readback_poll(&s->probe))
+		session_damage(s, DAMAGE_STATUS);
+	if (readback_poll(&s->tools.probe))
+		session_damage(s, DAMAGE_CURSOR);
+}
+
 static void session_pick_color_at(struct session *s, int x, int y)
 {
 	session_pick_color(s, session_color_at(s, x, y));
@@ -1522,12 +2418,12 @@ static void session_brush_erase(struct session *s)
 
 static void session_view_vcenter(struct session *s, struct view *v)
 {
-	s->y = s->ctx->height/2 - vh(s->view)/2 * s->zoom - v->y;
+	s->y = s->ctx->height/2 - (int)((float)(vh(s->view)/2) * s->zoom) - v->y;
 }
 
 static void session_view_hcenter(struct session *s, struct view *v)
 {
-	s->x = s->ctx->width/2 - (vw(s->view) * s->zoom)/2 - v->x;
+	s->x = s->ctx->width/2 - (int)((float)vw(s->view) * s->zoom)/2 - v->x;
 }
 
 static void session_view_center(struct session *s, struct view *v)
@@ -1539,13 +2435,13 @@ static void session_view_center(struct session *s, struct view *v)
 static void session_view_resize(struct session *s, struct view *v, int fw, int fh)
 {
 	view_resize(v, fw, fh, s->ctx);
-	views_refresh(s->views, s->zoom);
+	views_refresh(s);
 }
 
 static struct point session_view_coords(struct session *s, struct view *v, int x, int y)
 {
-	int vx = (x - v->x - s->x) / s->zoom;
-	int vy = (y - v->y - s->y) / s->zoom;
+	int vx = (int)((float)(x - v->x - s->x) / s->zoom);
+	int vy = (int)((float)(y - v->y - s->y) / s->zoom);
 
 	if (s->mode != MODE_PIXEL && s->tool.curr == TOOL_BRUSH) {
 		/* Coords should be bottom left corner of brush */
@@ -1577,20 +2473,18 @@ static void session_add_view(struct session *s, struct view *v)
 		u->next = v;
 
 		/* Recompute the spacing between the views */
-		views_refresh(s->views, s->zoom);
+		views_refresh(s);
 	} else {
 		s->views = s->view = v;
 		session_view_center(s, v);
+		views_refresh(s);
 	}
 }
 
 static void session_view_blank(struct session *s, char *filename, enum filestatus fs, int w, int h)
 {
-	struct view *v = view(s->ctx, filename, fs, w, h, NULL, 0, 0);
+	struct view *v = view(s->ctx, filename, fs, w, h, NULL, NULL, 0, 0);
 	session_add_view(s, v);
-
-	framebuffer_bind(v->fb);
-	framebuffer_clear();
 }
 
 static void session_edit_view(struct session *s, struct view *v)
@@ -1599,6 +2493,54 @@ static void session_edit_view(struct session *s, struct view *v)
 	session_view_vcenter(s, v);
 }
 
+/* Make index zero of a loaded color map transparent, since that's how
+ * indexed views treat it. The entries are shifted up by one if there's
+ * room. Otherwise, index zero swaps places with a transparent entry, or one
+ * which no pixel uses. Returns false if there is none. */
+static bool colormap_remap(rgba_t *colors, int *ncolors, uint8_t *indices, size_t n)
+{
+	bool used[256] = {false};
+	int  to        = -1;
+
+	if (colors[0].a == 0)
+		return true;
+
+	if (*ncolors < 256) {
+		memmove(colors + 1, colors, sizeof(*colors) * (size_t)*ncolors);
+		colors[0] = TRANSPARENT;
+		(*ncolors) ++;
+
+		for (size_t i = 0; i < n; i++)
+			indices[i] ++;
+
+		return true;
+	}
+	for (size_t i = 0; i < n; i++)
+		used[indices[i]] = true;
+
+	for (int i = 1; i < 256 && to < 0; i++) {
+		if (colors[i].a == 0)
+			to = i;
+	}
+	for (int i = 1; i < 256 && to < 0; i++) {
+		if (! used[i])
+			to = i;
+	}
+	if (to < 0)
+		return false;
+
+	colors[to] = colors[0];
+	colors[0]  = TRANSPARENT;
+
+	for (size_t i = 0; i < n; i++) {
+		if (indices[i] == 0)
+			indices[i] = (uint8_t)to;
+		else if (indices[i] == to)
+			indices[i] = 0;
+	}
+	return true;
+}
+
 static bool session_view_load(struct session *s, char *path)
 {
 	struct tga  t;
@@ -1613,9 +2555,21 @@ static bool session_view_load(struct session *s, char *path)
 		}
 	}
 
-	struct view *vprev = s->view;
+	struct view     *vprev = s->view;
+	struct colormap *cm    = NULL;
+
+	/* Color-mapped images are edited as indexed views, whose pixels hold
+	 * indices. Index zero is stored as transparent, so that tiles holding
+	 * nothing else are left empty. Images whose color map can't spare it
+	 * are edited as regular views. */
+	if (t.indices && colormap_remap(t.colormap, &t.ncolors, t.indices, (size_t)(t.width * t.height))) {
+		cm = colormap(t.colormap, t.ncolors);
+
+		for (int i = 0; i < t.width * t.height; i++)
+			t.data[i] = t.indices[i] ? rgba(t.indices[i], 0, 0, 255) : TRANSPARENT;
+	}
 	struct view *v = view(
-		s->ctx, path, FILE_SAVED, t.width, t.height, (uint8_t *)t.data, 0, 0
+		s->ctx, path, FILE_SAVED, t.width, t.height, (uint8_t *)t.data, cm, 0, 0
 	);
 	/* If the previous view was a dummy view, close it now that we have
 	 * something interesting loaded. */
@@ -1625,6 +2579,9 @@ static bool session_view_load(struct session *s, char *path)
 	session_add_view(s, v);
 	session_edit_view(s, v);
 
+	if (cm)
+		session_palette_load(s, cm->colors, cm->ncolors);
+
 	message(MSG_INFO, "\"%s\" %d pixels read", path, t.width * t.height);
 
 	tga_release(&t);
@@ -1646,10 +2603,15 @@ static bool session_view_quit(struct session *s, struct view *v, bool exit)
 				if (v->next)
 					v->next->prev = NULL;
 			}
+			if (s->hover == v)
+				s->hover = NULL;
+			if (s->adjust.view == v)
+				s->adjust.view = NULL;
+
 			view_free(v);
+			views_refresh(s);
 
 			if (s->views) {
-				views_refresh(s->views, s->zoom);
 				session_view_vcenter(s, s->view);
 			} else if (exit) {
 				ctx_closewindow(s->ctx);
@@ -1668,6 +2630,86 @@ static void session_palette_center(struct session *s, struct palette *p)
 	p->y = s->ctx->height/2 - n * p->cellsize/2;
 }
 
+static rect_t palette_rect(struct palette *p)
+{
+	return rect(p->x - 1, p->y - 1, p->x + p->cellsize * 2 + 1, p->y + p->cellsize * 16 + 1);
+}
+
+/* Screen area covered by a view, including its boundary, information and
+ * animation preview. */
+static rect_t view_screen_rect(struct session *s, struct view *v)
+{
+	int vx, vy;
+	view_offset(v, s, &vx, &vy);
+
+	float z = s->zoom;
+
+	return rect(
+		(float)vx - (float)v->fw * z - 1,
+		vy - s->ctx->font->gh - 5,
+		(float)vx + (float)vw(v) * z + 1,
+		(float)vy + (float)vh(v) * z + 1
+	);
+}
+
+/* Screen area covered by the status bar and command line. */
+static rect_t statusbar_rect(struct session *s)
+{
+	return rect(0, 0, s->ctx->width, 20 + 2 * s->ctx->font->gh);
+}
+
+/* Screen area of the performance overlay, above the status bar, on the
+ * right. It fits the frame time graph and ten lines of text. */
+static rect_t perf_rect(struct session *s)
+{
+	int w  = PERF_HISTORY * PERF_BAR_WIDTH + 10,
+	    h  = (int)(10 * s->ctx->font->gh) + PERF_GRAPH_HEIGHT + 15,
+	    x2 = s->ctx->width - 10,
+	    y1 = (int)statusbar_rect(s).y2 + 10;
+
+	return rect(x2 - w, y1, x2, y1 + h);
+}
+
+/* Show or hide the performance overlay. */
+static bool session_perf_toggle(struct session *s)
+{
+#if defined(PERF)
+	/* Stage timers can't be nested in the benchmark's frame timer. */
+	if (s->ctx->gputimer) {
+		message(MSG_ERR, "Error: performance overlay unavailable while benchmarking");
+		return false;
+	}
+	perf_enable(! perf.enabled);
+	session_damage(s, DAMAGE_ALL);
+
+	return true;
+#else
+	message(MSG_ERR, "Error: px was built without PERF");
+	return false;
+#endif
+}
+
+/* Screen area which has to be redrawn, based on the damage since the last
+ * frame. */
+static rect_t session_damage_rect(struct session *s)
+{
+	if (s->damage & DAMAGE_VIEWS)
+		return ctx_windowrect(s->ctx);
+
+	rect_t r = s->damaged;
+
+	if (s->damage & DAMAGE_CURSOR) {
+		r = rect_union(r, s->cursorrect);
+		r = rect_union(r, session_cursor_rect(s, s->mx, s->my));
+	}
+	if (s->damage & DAMAGE_STATUS)
+		r = rect_union(r, statusbar_rect(s));
+	if (s->damage & DAMAGE_PALETTE)
+		r = rect_union(r, palette_rect(s->palette));
+
+	return r;
+}
+
 static void session_draw_statusbar(struct session *s)
 {
 	if (s->mode == MODE_PRESENT)
@@ -1678,10 +2720,18 @@ static void session_draw_statusbar(struct session *s)
 	int mx = s->mx,
 	    my = s->my;
 
-	rgba_t cc = session_color_at(s, mx, my);
+	/* The color shown is from the previous frame, so that reading it back
+	 * doesn't hold up drawing. */
+	session_probe_color(s, &s->probe, mx, my);
+
+	rgba_t cc = s->probe.color;
+
+	/* Indexed views are read back as indices. */
+	if (s->hover)
+		view_decode(s->hover, &cc, 1);
 
 	const char *paused = s->paused               ? "p"            : "";
-	const char *onion  = s->onion                ? "o"            : "";
+	const char *onion  = s->onion.active         ? "o"            : "";
 
 	char coords[32];
 
@@ -1700,7 +2750,7 @@ static void session_draw_statusbar(struct session *s)
 	/* Session information */
 	ui_drawtext(s->ctx, NULL, s->w - 36 * s->ctx->font->gw - 10, 10 + s->ctx->font->gh + 5, RGBA_GREY,
 		"%1s %1s  #%.2x%.2x%.2x %16s %5d%%",
-		paused, onion, cc.r, cc.g, cc.b, coords, s->zoom * 100);
+		paused, onion, cc.r, cc.g, cc.b, coords, (int)(s->zoom * 100));
 
 	view_fileinfo(s->view, sizeof(buffer), buffer);
 
@@ -1714,7 +2764,16 @@ static void session_draw_statusbar(struct session *s)
 
 		float  margin = s->view->filestatus == FILE_NONE ? 0 : s->ctx->font->gw * 2;
 		rgba_t color  = s->recording ? RGBA_RED : RGBA_GREY;
-		char  *text   = s->recording ? "* recording" : "> playing";
+		char   text[32];
+
+		if (s->recording)
+			snprintf(text, sizeof(text), "* recording");
+		else if (s->clock.speed == 1)
+			snprintf(text, sizeof(text), "> playing");
+		else if (s->clock.speed > 0)
+			snprintf(text, sizeof(text), ">> playing (%gx)", s->clock.speed);
+		else
+			snprintf(text, sizeof(text), ">> playing (max)");
 
 		ui_drawtext(s->ctx, &offx, margin, 0, color, text);
 	}
@@ -1722,36 +2781,103 @@ static void session_draw_statusbar(struct session *s)
 	draw_current_colors(s->ctx, s->fg, s->bg);
 }
 
-static void session_draw_cmdline(struct session *s)
+/* Draw the performance overlay: the CPU and GPU time of each stage and the
+ * GL statistics of the last frame, over a graph of recent frame times. Bars
+ * over the frame budget are red, and the graph tops out at twice the
+ * budget. */
+static void session_draw_perf(struct session *s)
 {
-	/* Command line */
-	if (s->mode == MODE_COMMAND) {
-		ui_drawtext(s->ctx, NULL, 10, 10, RGBA_WHITE, "%s", s->cmdline.in->field);
-	} else {
-		ui_drawtext(s->ctx, NULL, 10, 10, s->messagecolor, "%s", s->message);
-	}
-}
+	struct context *ctx    = s->ctx;
+	struct glstats *st     = &ctx->glstats;
+	rect_t          r      = perf_rect(s);
+	double          budget = 1000. / ctx->pacer.rate;
+	int             gh     = (int)ctx->font->gh;
+	int             x      = (int)r.x1 + 5,
+	                y      = (int)r.y2 - 5 - gh;
 
-static void session_draw_views(struct session *s)
-{
-	struct context *ctx = s->ctx;
+	float  within[PERF_HISTORY * 12], over[PERF_HISTORY * 12];
+	size_t nwithin = 0, nover = 0;
 
-	int mx = s->mx,
-	    my = s->my;
+	fill_rect(ctx, (int)r.x1, (int)r.y1, (int)r.x2, (int)r.y2, rgba(0, 0, 0, 224));
 
-	int zoom = s->zoom;
+	ui_drawtext(ctx, NULL, x, y, RGBA_WHITE, "%-8s %8s %8s", "stage", "cpu", "gpu");
+
+	for (int i = 0; i < PERF_STAGES; i++) {
+		y -= gh;
+		ui_drawtext(ctx, NULL, x, y, RGBA_GREY, "%-8s %6.2fms %6.2fms",
+			perf_stages[i], perf.last[i], perf.gpu[i]);
+	}
+	y -= gh;
+	ui_drawtext(ctx, NULL, x, y, RGBA_WHITE, "%-8s %6.2fms", "frame", ctx->pacer.frametime);
+	y -= gh;
+	ui_drawtext(ctx, NULL, x, y, RGBA_GREY, "%lu draws, %lu buffers", st->draws, st->buffers);
+	y -= gh;
+	ui_drawtext(ctx, NULL, x, y, RGBA_GREY, "%lu uploads, %lu readbacks", st->uploads, st->readbacks);
+
+	for (int i = 0; i < PERF_HISTORY; i++) {
+		double ms = perf.history[(perf.head + i) % PERF_HISTORY];
+
+		if (ms <= 0)
+			continue;
+
+		float x1 = r.x1 + 5 + (float)(i * PERF_BAR_WIDTH),
+		      x2 = x1 + PERF_BAR_WIDTH - 1,
+		      y1 = r.y1 + 5,
+		      y2 = y1 + (float)(fmin(ms / (2 * budget), 1.) * PERF_GRAPH_HEIGHT);
+		float bar[] = {
+			x1, y1,  x2, y1,  x1, y2,
+			x1, y2,  x2, y1,  x2, y2,
+		};
+		if (ms > budget)
+			memcpy(&over[nover++ * 12], bar, sizeof(bar));
+		else
+			memcpy(&within[nwithin++ * 12], bar, sizeof(bar));
+	}
+	if (nwithin)
+		fill_triangles(ctx, within, nwithin * 6, RGBA_GREY);
+	if (nover)
+		fill_triangles(ctx, over, nover * 6, RGBA_RED);
+}
+
+static void session_draw_cmdline(struct session *s)
+{
+	/* Command line */
+	if (s->mode == MODE_COMMAND) {
+		ui_drawtext(s->ctx, NULL, 10, 10, RGBA_WHITE, "%s", s->cmdline.in->field);
+	} else {
+		ui_drawtext(s->ctx, NULL, 10, 10, s->messagecolor, "%s", s->message);
+	}
+}
+
+static void session_draw_views(struct session *s, rect_t *clip)
+{
+	struct context *ctx = s->ctx;
+
+	int mx = s->mx,
+	    my = s->my;
+
+	float zoom = s->zoom;
 
 	ctx_save(ctx);
 	ctx_translate(ctx, s->x, s->y);
 
-	for (struct view *v = s->views; v; v = v->next) {
+	/* Only views within the clip area are drawn. */
+	struct viewindex *ix = &s->vindex;
+
+	for (int i = views_lower_bound(s, (int)clip->y1); i < ix->len; i++) {
+		struct view *v = ix->views[i];
+		rect_t       r = view_screen_rect(s, v);
+
+		if (r.y1 >= clip->y2)
+			break;
+		if (! rect_intersects(&r, clip))
+			continue;
+
 		ctx_save(ctx);
 		ctx_translate(ctx, v->x, v->y);
 
-		ctx_save(ctx);
-		ctx_scale(ctx, zoom, zoom);
-		view_draw(ctx, v, zoom, mx, my);
-		ctx_restore(ctx);
+		/* Tiles are culled in view coordinates. */
+		view_draw(ctx, v, mx, my, rect_translate(*clip, vec2(-s->x - v->x, -s->y - v->y)));
 
 		/* View information */
 		ui_drawtext(ctx, NULL, 0, -ctx->font->gh - 5, RGBA_GREY,
@@ -1769,10 +2895,10 @@ static void session_draw_views(struct session *s)
 		ctx_save(ctx);
 		ctx_translate(ctx, s->view->x, s->view->y);
 
-		int x1 = (int)s->selection.x1 * zoom;
-		int y1 = (int)s->selection.y1 * zoom;
-		int x2 = (int)s->selection.x2 * zoom;
-		int y2 = (int)s->selection.y2 * zoom;
+		int x1 = (int)(s->selection.x1 * zoom);
+		int y1 = (int)(s->selection.y1 * zoom);
+		int x2 = (int)(s->selection.x2 * zoom);
+		int y2 = (int)(s->selection.y2 * zoom);
 
 		ui_drawtext(ctx, NULL, x2 + 5, y2 + 5, rgba(128, 0, 0, 255),
 			"%dx%d", rect_w(&s->selection), rect_h(&s->selection));
@@ -1790,16 +2916,6 @@ static void session_draw_views(struct session *s)
 			max(x1, x2) + 1, max(y1, y2) + 1
 		);
 		ctx_blend_alpha(ctx);
-
-		if (zoom >= 6) {
-			ctx_save(ctx);
-			ctx_translate(ctx, rect_min(s->selection).x * zoom,  rect_min(s->selection).y * zoom);
-			draw_grid(rgba(190, 0, 0, 32), zoom, zoom,
-				rect_w(&s->selection) * zoom,
-				rect_h(&s->selection) * zoom
-			);
-			ctx_restore(ctx);
-		}
 		ctx_restore(ctx);
 	} else if (s->tool.curr == TOOL_BRUSH && s->mode != MODE_PRESENT) { /* Brush */
 		ctx_save(ctx);
@@ -1813,21 +2929,11 @@ static void session_draw_views(struct session *s)
 
 			ctx_save(ctx);
 			ctx_translate(ctx, -s->x, -s->y);
-			draw_boundary(GREY, n.x - 1, n.y - 1, n.x + zoom + 1, n.y + zoom + 1);
+			draw_boundary(GREY, n.x - 1, n.y - 1, n.x + (int)zoom + 1, n.y + (int)zoom + 1);
 			ctx_restore(ctx);
 		}
 	}
 
-	/* Grid */
-	ctx_save(ctx);
-	ctx_translate(ctx, s->view->x, s->view->y);
-	view_draw_grid(s->view, s->gridw, s->gridh, GRID_COLOR, zoom);
-	ctx_restore(ctx);
-
-	/* View boundaries */
-	for (struct view *v = s->views; v; v = v->next)
-		view_draw_boundaries(v);
-
 	ctx_restore(ctx);
 }
 
@@ -1841,11 +2947,15 @@ static void session_draw_palette(struct session *s)
 }
 
 
+/* Snap screen coordinates to the pixel grid of a view. When zoomed out,
+ * screen pixels are the finest grid there is. */
 static struct point snap(struct session *s, struct point p, int x, int y)
 {
+	int z = max(1, (int)s->zoom);
+
 	return (struct point){
-		.x = p.x - ((p.x - x - s->x) % s->zoom),
-		.y = p.y - ((p.y - y - s->y) % s->zoom)
+		.x = p.x - ((p.x - x - s->x) % z),
+		.y = p.y - ((p.y - y - s->y) % z)
 	};
 }
 
@@ -1853,24 +2963,25 @@ static void view_draw_brush_cursor(struct view *v, struct brush *b, struct point
 {
 	if (b->erase) {
 		int    s     = b->size;
-		int    z     = session->zoom;
+		int    h     = (int)((float)(s/2) * session->zoom),
+		       e     = (int)((float)s * session->zoom);
 
 		draw_boundary(WHITE,
-			n.x          - s/2 * z,
-			n.y          - s/2 * z,
-			n.x  + s * z - s/2 * z,
-			n.y  + s * z - s/2 * z
+			n.x      - h,
+			n.y      - h,
+			n.x  + e - h,
+			n.y  + e - h
 		);
 	} else {
 		vec4_t color   = rgba2vec4(c);
-		int    s       = (b->size / 2) * session->zoom;
+		int    s       = (int)((float)(b->size / 2) * session->zoom);
 
 		ctx_scale(session->ctx, session->zoom, session->zoom);
 		ctx_translation(session->ctx, n.x - s, n.y - s);
-		ctx_program(session->ctx, "constant");
+		ctx_program(session->ctx, PROGRAM_CONSTANT);
 
 		ctx_blend(session->ctx, vec4(0, 0, 0, 0), b->sblend, b->dblend);
-		set_uniform_vec4(session->ctx->program, "color", &color);
+		set_uniform_vec4(session->ctx->program, UNIFORM_COLOR, &color);
 		polygon_draw(session->ctx, &b->quad);
 		ctx_blend_alpha(session->ctx);
 
@@ -1880,16 +2991,15 @@ static void view_draw_brush_cursor(struct view *v, struct brush *b, struct point
 
 static void view_draw_brush_cursor_disabled(struct view *v, struct brush *b, struct point n, rgba_t fg)
 {
-	int    s       = b->size;
-	int    z       = session->zoom;
+	int    e       = (int)((float)b->size * session->zoom);
 
 	rgba_t color = b->erase ? GREY : fg;
 
 	draw_boundary(color,
-		n.x          - s * z/2,
-		n.y          - s * z/2,
-		n.x  + s * z - s * z/2,
-		n.y  + s * z - s * z/2
+		n.x      - e/2,
+		n.y      - e/2,
+		n.x  + e - e/2,
+		n.y  + e - e/2
 	);
 }
 
@@ -1902,7 +3012,10 @@ static void draw_tool_icon(struct context *ctx, struct tools *ts, enum tooltype
 	GLenum sfactor = ts->icons[t].sfactor,
 	       dfactor = ts->icons[t].dfactor;
 
-	rgba_t sample     = framebuffer_sample(ctx->screen, sx, sy);
+	framebuffer_bind(ctx->screen);
+	readback_pixel(&ts->probe, sx, sy);
+
+	rgba_t sample     = ts->probe.color;
 	float  brightness = (float)(sample.r + sample.g + sample.b) / 3.f;
 	vec4_t blendcolor = brightness >= 128 ? vec4(0, 0, 0, 255) : vec4(255, 255, 255, 255);
 
@@ -1942,7 +3055,7 @@ static void session_draw_cursor(struct session *s, int x, int y, enum tooltype t
 
 static void view_draw_brush(struct view *v, struct brush *b, int x, int y)
 {
-	int z = session->zoom;
+	float z = session->zoom;
 
 	struct point n  = {x, y};
 
@@ -1954,7 +3067,7 @@ static void view_draw_brush(struct view *v, struct brush *b, int x, int y)
 		if (b->multi) {
 			for (int i = 0; i < v->nframes - view_frame_at(v, n.x, n.y); i++) {
 				struct point p = {
-					n.x + i * v->fw * z,
+					n.x + (int)((float)(i * v->fw) * z),
 					n.y
 				};
 				view_draw_brush_cursor(v, b, p, session->fg);
@@ -1971,12 +3084,12 @@ static void brush_paint(struct context *ctx, struct brush *b, rgba_t fg, int x0,
 {
 	vec4_t   color = rgba2vec4(fg);
 
-	ctx_program(ctx, "constant");
+	ctx_program(ctx, PROGRAM_CONSTANT);
 
 	if (b->erase) {
 		color = rgba2vec4(TRANSPARENT);
 	}
-	set_uniform_vec4(ctx->program, "color", &color);
+	set_uniform_vec4(ctx->program, UNIFORM_COLOR, &color);
 
 	ctx_save(ctx);
 	ctx_blend(ctx, vec4(0, 0, 0, 0), b->sblend, b->dblend);
@@ -2006,8 +3119,29 @@ static void brush_paint(struct context *ctx, struct brush *b, rgba_t fg, int x0,
 	ctx_restore(ctx);
 }
 
+/* Paint a brush stroke, in view coordinates, into every tile it touches.
+ * Erasing doesn't allocate empty tiles, since they're already clear. */
+static void view_paint(struct context *ctx, struct view *v, struct brush *b, rgba_t fg, int x0, int y0, int x1, int y1)
+{
+	rect_t r = rect(min(x0, x1) - b->size, min(y0, y1) - b->size,
+	                max(x0, x1) + b->size, max(y0, y1) + b->size);
+
+	if (! b->erase && ! view_encode(v, &fg))
+		return;
+
+	struct tileiter it;
+
+	for (canvas_tiles(&it, v->canvas, r, ! b->erase); canvas_tiles_next(&it); ) {
+		brush_paint(ctx, b, fg, x0 - it.x, y0 - it.y, x1 - it.x, y1 - it.y);
+		view_touch(v, it.frame, it.tile);
+	}
+}
+
 static void brush_tick(struct context *ctx, struct view *s, struct brush *b, rgba_t color, int mx, int my)
 {
+	trace_begin("px", "brush_tick");
+	latency_result(true);
+
 	struct point p = session_view_coords(ctx->extra, s, mx, my);
 
 	if (b->drawing == DRAW_STARTED) {
@@ -2019,7 +3153,6 @@ static void brush_tick(struct context *ctx, struct view *s, struct brush *b, rgb
 	b->curr.x = p.x;
 	b->curr.y = p.y;
 
-	framebuffer_bind(s->fb);
 	ctx_identity(ctx);
 
 	int x1 = b->prev.x;
@@ -2029,12 +3162,14 @@ static void brush_tick(struct context *ctx, struct view *s, struct brush *b, rgb
 
 	if (b->multi) {
 		for (int i = 0; i < s->nframes - view_frame_at(s, mx, my); i++) {
-			brush_paint(ctx, b, color, x1 + i * s->fw, y1, x2 + i * s->fw, y2);
+			view_paint(ctx, s, b, color, x1 + i * s->fw, y1, x2 + i * s->fw, y2);
 		}
 	} else {
-		brush_paint(ctx, b, color, x1, y1, x2, y2);
+		view_paint(ctx, s, b, color, x1, y1, x2, y2);
 	}
 	framebuffer_bind(ctx->screen);
+
+	trace_end("px", "brush_tick");
 }
 
 static void brush_start_drawing(struct context *ctx, struct view *s, struct brush *b, rgba_t color, int x, int y)
@@ -2171,22 +3306,433 @@ static void palette_set_colors(struct palette *p, const char *colors[], int ncol
 	}
 }
 
-static struct palette *palette_read(struct context *ctx, struct view *v)
+/* Replace the colors of the session palette. */
+static void session_palette_load(struct session *s, const rgba_t *colors, int n)
 {
-	int total = vw(v) * vh(v);
-	rgba_t *pixels = alloca(sizeof(rgba_t) * total);
-	struct palette *p = palette(PAL_SWATCH_SIZE);
+	struct palette *p = s->palette;
 
-	view_readpixels(v, pixels);
+	p->ncolors = min(n, (int)elems(p->colors));
+
+	for (int i = 0; i < p->ncolors; i++)
+		palette_setcolor(p, colors[i], i);
 
-	for (int i = 0; i < total; i++) {
-		if (pixels[i].a > 0)
-			palette_addcolor(p, pixels[i]);
+	palette_refresh(p, s->ctx);
+	session_palette_center(s, p);
+}
+
+/* Count the colors of the given frames of a view, tile by tile, so that only
+ * one tile is held in memory at a time. Empty tiles are skipped without
+ * being read. */
+static void view_histogram(struct view *v, int first, int last, struct histogram *h)
+{
+	struct canvas *c   = v->canvas;
+	rgba_t        *buf = malloc(sizeof(*buf) * (size_t)(c->tw * c->th));
+
+	for (int f = first; f <= last; f++) {
+		for (int t = 0; t < c->ntiles; t++) {
+			if (canvas_tile_empty(c, f, t))
+				continue;
+
+			rect_t r = rect_translate(canvas_tile_rect(c, t), vec2(f * v->fw, 0));
+
+			canvas_read(c, r, buf);
+			view_decode(v, buf, (size_t)(rect_w(&r) * rect_h(&r)));
+			histogram_add(h, buf, (size_t)(rect_w(&r) * rect_h(&r)));
+		}
 	}
+	free(buf);
+	framebuffer_bind(session->ctx->screen);
+}
+
+/* Build a palette from the colors of the given frames of a view, in the
+ * order they appear, or most frequent first if `byfreq` is set. At most
+ * `limit` colors are kept. */
+static struct palette *palette_read(struct view *v, int first, int last, bool byfreq, int limit)
+{
+	struct palette   *p = palette(PAL_SWATCH_SIZE);
+	struct histogram  h;
+
+	histogram_init(&h);
+	view_histogram(v, first, last, &h);
+
+	struct hcolor *colors = histogram_colors(&h, byfreq);
+
+	p->ncolors = min(h.len, min(limit, (int)elems(p->colors)));
+
+	for (int i = 0; i < p->ncolors; i++)
+		palette_setcolor(p, colors[i].color, i);
+
+	free(colors);
+	histogram_free(&h);
 
 	return p;
 }
 
+/* Pixels of a tile, held in memory to be processed on the CPU. */
+struct tilebuf {
+	int              frame, tile;
+	rect_t           rect;      /* Area covered, in view coordinates */
+	rgba_t          *pixels;
+	size_t           n;
+};
+
+/* Read the tiles of a view intersecting an area, in view coordinates, into
+ * memory, so that they can be processed on multiple threads, away from GL.
+ * Empty tiles are skipped. */
+static struct tilebuf *view_read_tiles(struct view *v, rect_t area, int *ntiles)
+{
+	struct canvas  *c     = v->canvas;
+	int             first = max(0, (int)area.x1 / v->fw),
+	                last  = min(v->nframes - 1, ((int)area.x2 - 1) / v->fw);
+	struct tilebuf *tiles = malloc(sizeof(*tiles) * (size_t)(max(last - first + 1, 1) * c->ntiles));
+
+	*ntiles = 0;
+
+	for (int f = first; f <= last; f++) {
+		for (int t = 0; t < c->ntiles; t++) {
+			rect_t r = rect_translate(canvas_tile_rect(c, t), vec2(f * v->fw, 0));
+
+			if (canvas_tile_empty(c, f, t) || ! rect_intersects(&r, &area))
+				continue;
+
+			struct tilebuf *tb = &tiles[(*ntiles) ++];
+
+			tb->frame  = f;
+			tb->tile   = t;
+			tb->rect   = r;
+			tb->n      = (size_t)(rect_w(&tb->rect) * rect_h(&tb->rect));
+			tb->pixels = malloc(sizeof(*tb->pixels) * tb->n);
+
+			canvas_read(c, tb->rect, tb->pixels);
+		}
+	}
+	framebuffer_bind(session->ctx->screen);
+
+	return tiles;
+}
+
+/* Free tiles read with `view_read_tiles`, writing them back to the view
+ * first if they were changed. */
+static void view_write_tiles(struct view *v, struct tilebuf *tiles, int ntiles, bool changed)
+{
+	for (int i = 0; i < ntiles; i++) {
+		if (changed) {
+			canvas_write(v->canvas, tiles[i].frame, tiles[i].tile, tiles[i].pixels);
+			view_touch(v, tiles[i].frame, tiles[i].tile);
+		}
+		free(tiles[i].pixels);
+	}
+	framebuffer_bind(session->ctx->screen);
+	free(tiles);
+}
+
+struct quantization {
+	struct tilebuf  *tiles;
+	struct histogram hists[PARALLEL_MAX_WORKERS]; /* One per worker */
+	bool             coarse[PARALLEL_MAX_WORKERS]; /* Set by workers which ran
+	                                                * out of exact colors */
+	struct histogram h;         /* All colors, once merged */
+	rgba_t           palette[256];
+	uint8_t         *index;     /* Palette index of each histogram color */
+};
+
+static void quantization_count(void *arg, int worker, int lo, int hi)
+{
+	struct quantization *q = arg;
+
+	for (int i = lo; i < hi && ! q->coarse[worker]; i++) {
+		histogram_add(&q->hists[worker], q->tiles[i].pixels, q->tiles[i].n);
+
+		q->coarse[worker] = q->hists[worker].len > QUANTIZE_EXACT;
+	}
+}
+
+static void quantization_coarsen(void *arg, int worker, int lo, int hi)
+{
+	struct quantization *q = arg;
+
+	histogram_free(&q->hists[worker]);
+	histogram_init(&q->hists[worker]);
+
+	for (int i = lo; i < hi; i++) {
+		quantize_coarsen(q->tiles[i].pixels, q->tiles[i].n);
+		histogram_add(&q->hists[worker], q->tiles[i].pixels, q->tiles[i].n);
+	}
+}
+
+static void quantization_map(void *arg, int worker, int lo, int hi)
+{
+	struct quantization *q = arg;
+
+	for (int i = lo; i < hi; i++)
+		quantize_map(&q->h, q->palette, q->index, q->tiles[i].pixels, q->tiles[i].n);
+}
+
+/* Reduce the given frames of a view to at most `n` colors, and store them in
+ * `palette`. The tiles are counted and remapped on multiple threads. Returns
+ * the number of colors, or -1 if nothing could be changed. */
+static int view_quantize(struct view *v, int first, int last, int n, rgba_t *palette)
+{
+	struct quantization  q = {0};
+	int                  ntiles;
+
+	q.tiles = view_read_tiles(v, rect_union(view_frame_rect(v, first), view_frame_rect(v, last)), &ntiles);
+
+	int nworkers = parallel_workers(ntiles);
+
+	for (int i = 0; i < nworkers; i++)
+		histogram_init(&q.hists[i]);
+
+	parallel_for(ntiles, quantization_count, &q);
+
+	/* If there are too many colors to count exactly, count coarse colors
+	 * everywhere instead. Pixels are coarsened in place, as they're about
+	 * to be replaced anyway. */
+	bool coarse = false;
+	int  counted = 0;
+
+	for (int i = 0; i < nworkers; i++) {
+		coarse  |= q.coarse[i];
+		counted += q.hists[i].len;
+	}
+	if (coarse || counted > QUANTIZE_EXACT)
+		parallel_for(ntiles, quantization_coarsen, &q);
+
+	/* Workers get consecutive tiles, so merging in worker order keeps the
+	 * colors in the order they're first seen. */
+	histogram_init(&q.h);
+
+	for (int i = 0; i < nworkers; i++) {
+		histogram_merge(&q.h, &q.hists[i]);
+		histogram_free(&q.hists[i]);
+	}
+	struct hcolor *colors = histogram_colors(&q.h, false);
+
+	q.index = malloc((size_t)(q.h.len ? q.h.len : 1));
+	n       = quantize(colors, q.h.len, n, q.palette, q.index);
+
+	if (n > 0)
+		parallel_for(ntiles, quantization_map, &q);
+
+	view_write_tiles(v, q.tiles, ntiles, n > 0);
+	memcpy(palette, q.palette, sizeof(*palette) * (size_t)max(n, 0));
+
+	free(colors);
+	free(q.index);
+	histogram_free(&q.h);
+
+	return n > 0 ? n : -1;
+}
+
+struct remapping {
+	struct remap     r;
+	struct tilebuf  *tiles;
+	rect_t           area;      /* Area to remap, in view coordinates */
+	bool             dither;
+};
+
+static void remapping_map(void *arg, int worker, int lo, int hi)
+{
+	struct remapping *m = arg;
+
+	for (int i = lo; i < hi; i++) {
+		struct tilebuf *tb = &m->tiles[i];
+		rect_t          r  = tb->rect;
+		int             w  = rect_w(&r),
+		                x1 = max((int)m->area.x1, (int)r.x1),
+		                y1 = max((int)m->area.y1, (int)r.y1),
+		                x2 = min((int)m->area.x2, (int)r.x2),
+		                y2 = min((int)m->area.y2, (int)r.y2);
+
+		for (int y = y1; y < y2; y++) {
+			rgba_t *row = tb->pixels + (size_t)((y - (int)r.y1) * w + (x1 - (int)r.x1));
+
+			remap_row(&m->r, row, (size_t)max(x2 - x1, 0), x1, y, m->dither);
+		}
+	}
+}
+
+/* Map the colors within an area of a view, in view coordinates, to the
+ * nearest of the given colors. Returns the number of tiles changed. */
+static int view_remap(struct view *v, rect_t area, const rgba_t *colors, int ncolors, bool dither)
+{
+	struct remapping m = { .area = rect_norm(area), .dither = dither };
+	int              ntiles;
+
+	if (rect_isempty(m.area))
+		return 0;
+
+	m.tiles = view_read_tiles(v, m.area, &ntiles);
+
+	if (ntiles > 0) {
+		remap_init(&m.r, colors, ncolors);
+		parallel_for(ntiles, remapping_map, &m);
+		remap_free(&m.r);
+	}
+	view_write_tiles(v, m.tiles, ntiles, ntiles > 0);
+
+	return ntiles;
+}
+
+/* Colors to replace, and their replacements. */
+struct recolor {
+	rgba_t           from[256];
+	rgba_t           to[256];
+	int              n;
+};
+
+/* Read the colors of a palette file, such as `db32.palette`, which has a
+ * color per line. Other lines are ignored. Returns the number of colors
+ * read, or -1 if the file can't be opened. */
+static int palette_file_read(const char *path, rgba_t *colors, int max)
+{
+	FILE *fp = fopen(path, "r");
+	char  line[128];
+	int   n  = 0;
+
+	if (! fp)
+		return -1;
+
+	while (n < max && fgetstr(line, sizeof(line), fp)) {
+		if (line[0] == '#')
+			colors[n ++] = hex2rgba(line);
+	}
+	fclose(fp);
+
+	return n;
+}
+
+/* Draw the tiles within an area of a view, in view coordinates, through the
+ * bound program, in place. Each tile is copied aside first, as a tile can't
+ * be sampled while it's drawn into, and only the part of it within the area
+ * is drawn back. With `empty`, empty tiles are drawn as well. Returns the
+ * number of tiles drawn. */
+static int view_filter(struct context *ctx, struct view *v, rect_t area, bool empty)
+{
+	struct canvas  *c       = v->canvas;
+	struct texture *scratch = texture(NULL, c->tw, c->th, (GLint)c->format);
+	struct tileiter it;
+	int             tiles   = 0;
+
+	ctx_blend(ctx, vec4(0, 0, 0, 0), GL_ONE, GL_ZERO);
+
+	area = rect_norm(area);
+
+	for (canvas_tiles(&it, c, area, empty); canvas_tiles_next(&it); ) {
+		rect_t t  = canvas_tile_rect(c, it.tile);
+		float  x1 = max(area.x1 - (float)it.x, 0),
+		       y1 = max(area.y1 - (float)it.y, 0),
+		       x2 = min(area.x2 - (float)it.x, (float)rect_w(&t)),
+		       y2 = min(area.y2 - (float)it.y, (float)rect_h(&t));
+		vec4_t a  = vec4(x1, y1, x2 - x1, y2 - y1);
+
+		texture_bind(scratch);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, rect_w(&t), rect_h(&t));
+
+		set_uniform_vec4(ctx->program, UNIFORM_AREA, &a);
+		polygon_draw(ctx, &session->overlay);
+
+		view_touch(v, it.frame, it.tile);
+		tiles ++;
+	}
+	texture_bind(NULL);
+	texture_free(scratch);
+
+	ctx_blend_alpha(ctx);
+	framebuffer_bind(ctx->screen);
+
+	return tiles;
+}
+
+/* Replace colors within an area of a view, in view coordinates, on the GPU.
+ * The replacements are uploaded once, as a table, and each tile is then
+ * drawn through it. Indexed views are recolored by index. Returns the
+ * number of tiles changed. */
+static int view_recolor(struct context *ctx, struct view *v, const struct recolor *rc, rect_t area)
+{
+	rgba_t         table[2][256];
+	int            n     = 0,
+	               tiles = 0;
+	bool           empty = false;   /* Whether empty tiles have pixels to replace */
+
+	for (int i = 0; i < rc->n; i++) {
+		rgba_t from = rc->from[i],
+		       to   = rc->to[i];
+
+		/* Colors missing from a colormap have no pixels to replace. */
+		if (v->colormap) {
+			int idx = colormap_find(v->colormap, from);
+
+			if (idx < 0 || ! view_encode(v, &to))
+				continue;
+
+			from  = rgba((uint8_t)idx, 0, 0, 255);
+			empty = empty || idx == 0;
+		} else {
+			empty = empty || ! rgbacmp(from, TRANSPARENT);
+		}
+		table[0][n]   = from;
+		table[1][n ++] = to;
+	}
+	if (n == 0)
+		return 0;
+
+	struct texture *lut = texture(NULL, (int)elems(table[0]), 2, GL_RGBA);
+
+	texture_update(lut, 0, 0, n, 1, table[0]);
+	texture_update(lut, 0, 1, n, 1, table[1]);
+
+	ctx_save(ctx);
+	ctx_identity(ctx);
+	ctx_program(ctx, PROGRAM_RECOLOR);
+
+	set_uniform_i32(ctx->program, UNIFORM_COUNT, n);
+	set_uniform_i32(ctx->program, UNIFORM_LUT,   1);
+
+	gl_bind_texture(1, lut->handle);
+	gl_bind_sampler(1, lut->sampler);
+
+	tiles = view_filter(ctx, v, area, empty);
+
+	ctx_program(ctx, PROGRAM_NONE);
+	ctx_restore(ctx);
+
+	texture_free(lut);
+
+	return tiles;
+}
+
+/* Apply a hue, saturation and lightness adjustment to an area of a view, in
+ * view coordinates, on the GPU. Indexed views have their colors adjusted
+ * instead, which affects the whole view. Returns the number of tiles
+ * changed. */
+static int view_adjust(struct context *ctx, struct view *v, const float hsl[3], rect_t area)
+{
+	if (v->colormap) {
+		for (int i = 1; i < v->colormap->ncolors; i++) {
+			rgba_t c = v->colormap->colors[i];
+
+			colormap_set(v->colormap, i, rgba_adjust(c, hsl[0], hsl[1], hsl[2]));
+		}
+		return v->nframes * v->canvas->ntiles;
+	}
+	vec3_t adjustment = vec3(hsl[0], hsl[1], hsl[2]);
+	int    tiles;
+
+	ctx_save(ctx);
+	ctx_identity(ctx);
+	ctx_program(ctx, PROGRAM_ADJUST);
+
+	set_uniform_vec3(ctx->program, UNIFORM_ADJUSTMENT, &adjustment);
+
+	tiles = view_filter(ctx, v, area, false);
+
+	ctx_program(ctx, PROGRAM_NONE);
+	ctx_restore(ctx);
+
+	return tiles;
+}
+
 /** CALLBACKS *****************************************************************/
 
 static void key_callback(struct context *ctx, int key, int scancode, int action, int mods)
@@ -2197,6 +3743,8 @@ static void key_callback(struct context *ctx, int key, int scancode, int action,
 	if (s->mousedown)
 		return;
 
+	session_damage(s, DAMAGE_ALL);
+
 	if (action == INPUT_REPEAT)
 		action = INPUT_PRESS;
 
@@ -2258,6 +3806,7 @@ static void char_callback(struct context *ctx, unsigned int scancode)
 	if (! isprint(scancode))
 		return;
 
+	session_damage(s, DAMAGE_STATUS);
 	cmdline_handle_input(s, &s->cmdline, scancode);
 }
 
@@ -2268,6 +3817,8 @@ static void window_size_callback(struct context *ctx, int w, int h)
 	s->w = w;
 	s->h = h;
 
+	session_damage(s, DAMAGE_ALL);
+
 	s->mx = (int)ctx->cursorx;
 	s->my = (int)ctx->cursory;
 
@@ -2282,6 +3833,8 @@ static void window_pos_callback(struct context *ctx, int x, int y)
 
 	s->mx = (int)ctx->cursorx;
 	s->my = (int)ctx->cursory;
+
+	session_damage(s, DAMAGE_CURSOR | DAMAGE_STATUS);
 }
 
 static void mouse_button_callback(struct context *ctx, int button, int action, int mods)
@@ -2292,6 +3845,8 @@ static void mouse_button_callback(struct context *ctx, int button, int action, i
 	struct session *s   = ctx->extra;
 	struct palette *pal = s->palette;
 
+	session_damage(s, DAMAGE_ALL);
+
 	if (action == INPUT_PRESS) {
 		s->mousedown = true;
 		session_macro_record(s, "cursor/down");
@@ -2334,15 +3889,8 @@ static void mouse_button_callback(struct context *ctx, int button, int action, i
 			s->mselection  = rect((float)x, (float)y, (float)x, (float)y);
 		}
 	} else if (action == INPUT_PRESS) { /* Click on inactive view to switch to it */
-		if (s->tool.curr != TOOL_SAMPLER) {
-			struct view *v = s->views;
-			while (v) {
-				if (v->hover) {
-					session_edit_view(s, v);
-					break;
-				}
-				v = v->next;
-			}
+		if (s->tool.curr != TOOL_SAMPLER && s->hover) {
+			session_edit_view(s, s->hover);
 		}
 	} else if (action == INPUT_RELEASE) {
 		if (s->tool.curr == TOOL_BRUSH) {
@@ -2360,8 +3908,23 @@ static void cursor_pos_callback(struct context *ctx, double fx, double fy)
 	struct view *v       = sess->view;
 
 	session_macro_record(sess, "cursor/move %d %d", (int)fx, (int)fy);
+
+	int      hover  = sess->palette->hover;
+	unsigned damage = DAMAGE_CURSOR | DAMAGE_STATUS;
+
 	palette_hover(sess->palette, x, y);
-	view_hover(sess, x, y);
+
+	if (sess->palette->hover != hover)
+		damage |= DAMAGE_PALETTE;
+	if (view_hover(sess, x, y))
+		damage |= DAMAGE_VIEWS;
+
+	/* The onion skin and multi-frame brush outline follow the frame under
+	 * the cursor, and panning or painting changes the views themselves. */
+	if (sess->onion.active || sess->tool.brush.multi || sess->mousedown || sess->tool.curr == TOOL_PAN)
+		damage |= DAMAGE_VIEWS;
+
+	session_damage(sess, damage);
 
 	if (sess->mode == MODE_NORMAL) {
 		switch (sess->tool.curr) {
@@ -2425,6 +3988,9 @@ static bool cmd_quit_all_forced(struct session *s, int argc, char *args[])
 		s->views = s->views->next;
 		view_free(v);
 	}
+	s->hover = NULL;
+	views_refresh(s);
+
 	ctx_closewindow(s->ctx);
 
 	return true;
@@ -2532,45 +4098,132 @@ static bool cmd_slice_all(struct session *s, int argc, char *args[])
 	return true;
 }
 
-static bool cmd_checker(struct session *s, int argc, char *args[])
+/* Parse a frame number, counting from 1, into a frame index no greater
+ * than `max`. */
+static bool frame_arg(const char *arg, int max, int *frame)
 {
-	kb_toggle_checker(s, 0);
-	return true;
-}
+	int n = (int)strtol(arg, NULL, 10);
 
-static bool cmd_source(struct session *s, int argc, char *args[])
-{
-	if (! source(s, args[1])) {
-		message(MSG_ERR, "Error: file \"%s\" not found", args[1]);
+	if (n < 1 || n - 1 > max) {
+		message(MSG_ERR, "Error: invalid frame '%s'", arg);
 		return false;
 	}
+	*frame = n - 1;
+
 	return true;
 }
 
-static bool cmd_fullscreen(struct session *s, int argc, char *args[])
+static bool cmd_frame_add(struct session *s, int argc, char *args[])
 {
-	ctx_fullscreen(s->ctx);
+	view_addframe(s->view, s->ctx);
 	return true;
 }
 
-static bool cmd_window(struct session *s, int argc, char *args[])
+/* Insert a blank frame before the given frame. The frame after the last
+ * one can be given, to append. */
+static bool cmd_frame_insert(struct session *s, int argc, char *args[])
 {
-	int w, h;
-	if (sscanf(args[1], "%dx%d", &w, &h) != 2) {
-		message(MSG_ERR, "Error: invalid command argument '%s'", args[1]);
+	struct view *v = s->view;
+	int f;
+
+	if (! frame_arg(args[1], v->nframes, &f))
 		return false;
-	}
-	ctx_windowsize(s->ctx, w, h);
+
+	view_insert_frame(v, f, -1);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
 	return true;
 }
 
-static bool cmd_echo(struct session *s, int argc, char *args[])
+static bool cmd_frame_dup(struct session *s, int argc, char *args[])
 {
-	if (argc > 1) {
-		message(MSG_ECHO, "%s", args[1]);
-	} else {
-		message(MSG_ECHO, "");
-	}
+	struct view *v = s->view;
+	int f;
+
+	if (! frame_arg(args[1], v->nframes - 1, &f))
+		return false;
+
+	view_insert_frame(v, f + 1, f);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	return true;
+}
+
+static bool cmd_frame_delete(struct session *s, int argc, char *args[])
+{
+	struct view *v = s->view;
+	int f;
+
+	if (! frame_arg(args[1], v->nframes - 1, &f))
+		return false;
+
+	if (v->nframes == 1) {
+		message(MSG_ERR, "Error: can't delete the only frame");
+		return false;
+	}
+	view_remove_frame(v, f);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	return true;
+}
+
+static bool cmd_frame_move(struct session *s, int argc, char *args[])
+{
+	struct view *v = s->view;
+	int from, to;
+
+	if (! frame_arg(args[1], v->nframes - 1, &from) || ! frame_arg(args[2], v->nframes - 1, &to))
+		return false;
+
+	view_move_frame(v, from, to);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	return true;
+}
+
+static bool cmd_checker(struct session *s, int argc, char *args[])
+{
+	kb_toggle_checker(s, 0);
+	return true;
+}
+
+static bool cmd_source(struct session *s, int argc, char *args[])
+{
+	if (! source(s, args[1])) {
+		message(MSG_ERR, "Error: file \"%s\" not found", args[1]);
+		return false;
+	}
+	return true;
+}
+
+static bool cmd_fullscreen(struct session *s, int argc, char *args[])
+{
+	ctx_fullscreen(s->ctx);
+	return true;
+}
+
+static bool cmd_window(struct session *s, int argc, char *args[])
+{
+	int w, h;
+	if (sscanf(args[1], "%dx%d", &w, &h) != 2) {
+		message(MSG_ERR, "Error: invalid command argument '%s'", args[1]);
+		return false;
+	}
+	ctx_windowsize(s->ctx, w, h);
+	return true;
+}
+
+static bool cmd_echo(struct session *s, int argc, char *args[])
+{
+	if (argc > 1) {
+		message(MSG_ECHO, "%s", args[1]);
+	} else {
+		message(MSG_ECHO, "");
+	}
 	return true;
 }
 
@@ -2592,17 +4245,360 @@ static bool cmd_palette_clear(struct session *s, int argc, char *args[])
 	return true;
 }
 
+/* Parse the options of color sampling commands: `freq` to sort colors by
+ * frequency, `frame` to only sample the frame under the cursor, and a
+ * number to limit the number of colors. */
+static bool sample_args(struct session *s, int argc, char *args[], int *first, int *last, bool *byfreq, int *limit)
+{
+	struct view *v = s->view;
+
+	*first  = 0;
+	*last   = v->nframes - 1;
+	*byfreq = false;
+	*limit  = (int)elems(s->palette->colors);
+
+	for (int i = 1; i < argc; i++) {
+		if (! strcmp(args[i], "freq")) {
+			*byfreq = true;
+		} else if (! strcmp(args[i], "frame")) {
+			*first = *last = max(0, min(view_frame_at(v, s->mx, s->my), v->nframes - 1));
+		} else if ((*limit = (int)strtol(args[i], NULL, 10)) <= 0) {
+			message(MSG_ERR, "Error: invalid command argument '%s'", args[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Sample a palette from the view, eg. `p/sample freq 16 frame`. See
+ * `sample_args` for the options. */
 static bool cmd_palette_sample(struct session *s, int argc, char *args[])
 {
+	int  first, last, limit;
+	bool byfreq;
+
+	if (! sample_args(s, argc, args, &first, &last, &byfreq, &limit))
+		return false;
+
 	palette_free(s->palette);
 
-	s->palette = palette_read(s->ctx, s->view);
+	s->palette = palette_read(s->view, first, last, byfreq, limit);
 	palette_refresh(s->palette, s->ctx);
 	session_palette_center(s, s->palette);
 
 	return true;
 }
 
+/* Set a palette color by index, eg. `p/set 3 #ff0000`. Indices start at
+ * zero, like in indexed files. On an indexed view, this also changes every
+ * pixel using that index, in every frame. */
+static bool cmd_palette_set(struct session *s, int argc, char *args[])
+{
+	struct palette *p   = s->palette;
+	struct view    *v   = s->view;
+	char           *end;
+	long            idx = strtol(args[1], &end, 10);
+
+	if (*end || idx < 0 || idx >= (long)elems(p->colors)) {
+		message(MSG_ERR, "Error: invalid palette index '%s'", args[1]);
+		return false;
+	}
+	if (args[2][0] != '#') {
+		message(MSG_ERR, "Error: invalid color '%s'", args[2]);
+		return false;
+	}
+	rgba_t color = hex2rgba(args[2]);
+
+	while (p->ncolors <= idx)
+		palette_setcolor(p, TRANSPARENT, p->ncolors ++);
+
+	palette_setcolor(p, color, (int)idx);
+	palette_refresh(p, s->ctx);
+	session_palette_center(s, p);
+
+	if (v->colormap) {
+		colormap_set(v->colormap, (int)idx, color);
+		view_snapshot_save(s->ctx, v, false);
+		view_dirty(v);
+	}
+	return true;
+}
+
+/* Reduce the view to N colors, eg. `quantize 16`. With `frame`, only the
+ * frame under the cursor is reduced, and with `p`, the colors are also
+ * loaded into the palette, most used first. */
+static bool cmd_quantize(struct session *s, int argc, char *args[])
+{
+	struct view *v     = s->view;
+	rgba_t       colors[256];
+	int          n     = (int)strtol(args[1], NULL, 10),
+	             first = 0,
+	             last  = v->nframes - 1;
+	bool         load  = false;
+	double       t     = ctx_time(s->ctx);
+
+	if (n <= 0 || n > (int)elems(colors)) {
+		message(MSG_ERR, "Error: color count must be between 1 and %d", (int)elems(colors));
+		return false;
+	}
+	if (v->colormap) {
+		message(MSG_ERR, "Error: view is indexed, edit its palette instead");
+		return false;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (! strcmp(args[i], "p")) {
+			load = true;
+		} else if (! strcmp(args[i], "frame")) {
+			first = last = max(0, min(view_frame_at(v, s->mx, s->my), v->nframes - 1));
+		} else {
+			message(MSG_ERR, "Error: invalid command argument '%s'", args[i]);
+			return false;
+		}
+	}
+	if ((n = view_quantize(v, first, last, n, colors)) < 0) {
+		message(MSG_ERR, "Error: nothing to quantize");
+		return false;
+	}
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	if (load)
+		session_palette_load(s, colors, n);
+	message(MSG_OK, "Quantized to %d colors (%.1fms)", n, (ctx_time(s->ctx) - t) * 1000.);
+
+	return true;
+}
+
+/* Replace colors, eg. `recolor #ff0000 #0000ff`, with any number of pairs
+ * of colors, or `recolor red.palette blue.palette` to replace each color of
+ * a palette file by the one in the same place in another. Colors are
+ * replaced within the selection if there is one, otherwise within the view,
+ * or as given by `frame N`, `frames FIRST LAST` or `all` for every view.
+ * Each view changed gets a single undo step. */
+static bool cmd_recolor(struct session *s, int argc, char *args[])
+{
+	struct recolor rc   = {0};
+	struct view   *v    = s->view;
+	rect_t         area = rect_isempty(s->selection) ? view_rect(v) : rect_norm(s->selection);
+	bool           all  = false;
+	int            i    = 1;
+
+	if (args[1][0] == '#') {
+		for (; i + 1 < argc && args[i][0] == '#' && args[i + 1][0] == '#'; i += 2) {
+			rc.from[rc.n]   = hex2rgba(args[i]);
+			rc.to[rc.n ++]  = hex2rgba(args[i + 1]);
+		}
+	} else {
+		int nfrom = palette_file_read(args[1], rc.from, (int)elems(rc.from)),
+		    nto   = palette_file_read(args[2], rc.to, (int)elems(rc.to));
+
+		if (nfrom < 0 || nto < 0) {
+			message(MSG_ERR, "Error: couldn't read palette \"%s\"", args[nfrom < 0 ? 1 : 2]);
+			return false;
+		}
+		rc.n = min(nfrom, nto);
+		i    = 3;
+	}
+	if (rc.n == 0) {
+		message(MSG_ERR, "Error: no colors to replace");
+		return false;
+	}
+
+	for (; i < argc; i++) {
+		int first, last;
+
+		if (! strcmp(args[i], "all")) {
+			all = true;
+		} else if (! strcmp(args[i], "frame") && i + 1 < argc) {
+			if (! frame_arg(args[++ i], v->nframes - 1, &first))
+				return false;
+			area = view_frame_rect(v, first);
+		} else if (! strcmp(args[i], "frames") && i + 2 < argc) {
+			if (! frame_arg(args[i + 1], v->nframes - 1, &first) ||
+			    ! frame_arg(args[i + 2], v->nframes - 1, &last))
+				return false;
+			area = rect(view_frame_rect(v, min(first, last)).x1, 0,
+			            view_frame_rect(v, max(first, last)).x2, vh(v));
+			i += 2;
+		} else {
+			message(MSG_ERR, "Error: invalid command argument '%s'", args[i]);
+			return false;
+		}
+	}
+	double t     = ctx_time(s->ctx);
+	int    views = 0,
+	       tiles = 0;
+
+	for (struct view *w = all ? s->views : v; w; w = all ? w->next : NULL) {
+		int n = view_recolor(s->ctx, w, &rc, all ? view_rect(w) : area);
+
+		if (n > 0) {
+			view_snapshot_save(s->ctx, w, false);
+			view_dirty(w);
+
+			views ++;
+			tiles += n;
+		}
+	}
+	message(MSG_OK, "Recolored %d tiles in %d views (%.1fms)", tiles, views, (ctx_time(s->ctx) - t) * 1000.);
+
+	return true;
+}
+
+/* Map every color to the nearest color of the palette, as perceived, within
+ * the selection if there is one, otherwise within the view, or within the
+ * frame given with `frame N`. With `dither`, an ordered dither pattern is
+ * used to blend between palette colors, instead of banding. */
+static bool cmd_remap(struct session *s, int argc, char *args[])
+{
+	struct view *v      = s->view;
+	rect_t       area   = rect_isempty(s->selection) ? view_rect(v) : rect_norm(s->selection);
+	bool         dither = false;
+
+	if (v->colormap) {
+		message(MSG_ERR, "Error: view is indexed, edit its palette instead");
+		return false;
+	}
+	if (s->palette->ncolors == 0) {
+		message(MSG_ERR, "Error: palette is empty");
+		return false;
+	}
+	for (int i = 1; i < argc; i++) {
+		int frame;
+
+		if (! strcmp(args[i], "dither")) {
+			dither = true;
+		} else if (! strcmp(args[i], "frame") && i + 1 < argc) {
+			if (! frame_arg(args[++ i], v->nframes - 1, &frame))
+				return false;
+			area = view_frame_rect(v, frame);
+		} else {
+			message(MSG_ERR, "Error: invalid command argument '%s'", args[i]);
+			return false;
+		}
+	}
+	double t = ctx_time(s->ctx);
+	int    n = view_remap(v, area, s->palette->colors, s->palette->ncolors, dither);
+
+	if (n > 0) {
+		view_snapshot_save(s->ctx, v, false);
+		view_dirty(v);
+	}
+	message(MSG_OK, "Remapped %d tiles to %d colors (%.1fms)", n, s->palette->ncolors, (ctx_time(s->ctx) - t) * 1000.);
+
+	return true;
+}
+
+static bool cmd_adjust_hue(struct session *s, int argc, char *args[])
+{
+	session_adjust(s, ADJUST_HUE, strtof(args[1], NULL), false);
+	return true;
+}
+
+static bool cmd_adjust_saturation(struct session *s, int argc, char *args[])
+{
+	session_adjust(s, ADJUST_SATURATION, strtof(args[1], NULL), false);
+	return true;
+}
+
+static bool cmd_adjust_lightness(struct session *s, int argc, char *args[])
+{
+	session_adjust(s, ADJUST_LIGHTNESS, strtof(args[1], NULL), false);
+	return true;
+}
+
+/* Apply the pending adjustment, as a single undo step. Indexed views have
+ * their colors adjusted, so the adjustment must cover the whole view. */
+static bool cmd_adjust_apply(struct session *s, int argc, char *args[])
+{
+	struct adjustment *a = &s->adjust;
+	struct view       *v = a->view;
+
+	if (! v) {
+		message(MSG_ERR, "Error: nothing to adjust");
+		return false;
+	}
+	if (v->colormap && (a->area.x1 > 0 || a->area.y1 > 0 || a->area.x2 < vw(v) || a->area.y2 < vh(v))) {
+		message(MSG_ERR, "Error: view is indexed, its whole palette must be adjusted");
+		return false;
+	}
+	double t = ctx_time(s->ctx);
+	int    n = view_adjust(s->ctx, v, a->hsl, a->area);
+
+	if (n > 0)
+		view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	a->view = NULL;
+	message(MSG_OK, "Adjusted %d tiles (%.1fms)", n, (ctx_time(s->ctx) - t) * 1000.);
+
+	return true;
+}
+
+static bool cmd_adjust_cancel(struct session *s, int argc, char *args[])
+{
+	s->adjust.view = NULL;
+	return true;
+}
+
+/* Store the view as palette indices, which takes a quarter of the memory,
+ * and lets palette edits show up everywhere at once. The view can have at
+ * most 255 colors, as index zero is kept for transparent pixels. The undo
+ * history is cleared, as it holds colors rather than indices. */
+static bool cmd_indexed(struct session *s, int argc, char *args[])
+{
+	struct view *v = s->view;
+
+	if (v->colormap) {
+		message(MSG_INFO, "View is already indexed");
+		return true;
+	}
+	size_t           n      = (size_t)(vw(v) * vh(v));
+	rgba_t          *pixels = malloc(sizeof(*pixels) * n);
+	struct histogram h;
+
+	view_readpixels(v, pixels);
+	framebuffer_bind(s->ctx->screen);
+
+	histogram_init(&h);
+	histogram_add(&h, pixels, n);
+
+	if (h.len >= 256) {
+		message(MSG_ERR, "Error: view has %d colors, quantize it to 255 first", h.len);
+
+		histogram_free(&h);
+		free(pixels);
+
+		return false;
+	}
+	struct hcolor *colors = histogram_colors(&h, false);
+	rgba_t         map[256] = { TRANSPARENT };
+
+	for (int i = 0; i < h.len; i++)
+		map[i + 1] = colors[i].color;
+
+	for (size_t i = 0; i < n; i++) {
+		int o = histogram_find(&h, pixels[i]);
+
+		pixels[i] = o >= 0 ? rgba((uint8_t)(o + 1), 0, 0, 255) : TRANSPARENT;
+	}
+	view_replace_canvas(v, canvas(v->fw, v->fh, v->nframes, pixels, GL_R8));
+	v->colormap = colormap(map, h.len + 1);
+
+	view_snapshots_free(v);
+	view_snapshot_save(s->ctx, v, false);
+	view_dirty(v);
+
+	session_palette_load(s, map, h.len + 1);
+	message(MSG_OK, "View indexed with %d colors", h.len);
+
+	free(colors);
+	free(pixels);
+	histogram_free(&h);
+
+	return true;
+}
+
 static bool cmd_grid(struct session *s, int argc, char *args[])
 {
 	if (argc == 1) {
@@ -2620,6 +4616,73 @@ static bool cmd_grid(struct session *s, int argc, char *args[])
 	return true;
 }
 
+static bool cmd_onion_depth(struct session *s, int argc, char *args[])
+{
+	int depth = (int)strtol(args[1], NULL, 10);
+
+	if (depth < 1 || depth > MAX_ONION_DEPTH) {
+		message(MSG_ERR, "Error: onion skin depth must be between 1 and %d", MAX_ONION_DEPTH);
+		return false;
+	}
+	s->onion.depth = depth;
+
+	return true;
+}
+
+/* Set which frames are shown by the onion skin: `prev`, `next` or `both`. */
+static bool cmd_onion_direction(struct session *s, int argc, char *args[])
+{
+	if (! strcmp(args[1], "prev")) {
+		s->onion.direction = ONION_PREV;
+	} else if (! strcmp(args[1], "next")) {
+		s->onion.direction = ONION_NEXT;
+	} else if (! strcmp(args[1], "both")) {
+		s->onion.direction = ONION_BOTH;
+	} else {
+		message(MSG_ERR, "Error: invalid command argument '%s'", args[1]);
+		return false;
+	}
+	return true;
+}
+
+/* Set the opacity multiplier applied to each further frame, and optionally
+ * the opacity of the nearest frames, eg. `onion/falloff 0.5 0.8`. */
+static bool cmd_onion_falloff(struct session *s, int argc, char *args[])
+{
+	float falloff = strtof(args[1], NULL);
+	float opacity = argc > 2 ? strtof(args[2], NULL) : s->onion.opacity;
+
+	if (falloff < 0 || falloff > 1 || opacity < 0 || opacity > 1) {
+		message(MSG_ERR, "Error: onion skin falloff and opacity must be between 0 and 1");
+		return false;
+	}
+	s->onion.falloff = falloff;
+	s->onion.opacity = opacity;
+
+	return true;
+}
+
+/* Set the tint of previous and next frames, and optionally the amount of
+ * tint, eg. `onion/tint #ff0000 #0000ff 0.5`. */
+static bool cmd_onion_tint(struct session *s, int argc, char *args[])
+{
+	float tint = argc > 3 ? strtof(args[3], NULL) : 0.5f;
+
+	if (args[1][0] != '#' || args[2][0] != '#') {
+		message(MSG_ERR, "Error: invalid color");
+		return false;
+	}
+	if (tint < 0 || tint > 1) {
+		message(MSG_ERR, "Error: onion skin tint must be between 0 and 1");
+		return false;
+	}
+	s->onion.prevtint = hex2rgba(args[1]);
+	s->onion.nexttint = hex2rgba(args[2]);
+	s->onion.tint     = tint;
+
+	return true;
+}
+
 static bool cmd_pause(struct session *s, int argc, char *args[])
 {
 	s->paused = true;
@@ -2629,14 +4692,21 @@ static bool cmd_pause(struct session *s, int argc, char *args[])
 
 static bool cmd_zoom(struct session *s, int argc, char *args[])
 {
-	int z;
-	if (sscanf(args[1], "%d", &z) != 1) {
+	float z;
+	if (sscanf(args[1], "%f", &z) != 1) {
 		message(MSG_ERR, "Error: invalid command argument '%s'", args[1]);
 		return false;
 	}
 	z /= 100;
 
-	if (z < 1 || z > 240) {
+	/* Zooming in is by whole steps, and zooming out by halves, so that
+	 * views can be drawn from their mip levels. */
+	if (z >= 1) {
+		z = floorf(z);
+	} else if (z > 0) {
+		z = exp2f(roundf(log2f(z)));
+	}
+	if (z < 0.125f || z > 240) {
 		message(MSG_ERR, "Error: invalid zoom level");
 		return false;
 	}
@@ -2657,19 +4727,22 @@ static bool cmd_fill(struct session *s, int argc, char *args[])
 		message(MSG_ERR, "Error: invalid argument: %s", args[1]);
 		return false;
 	}
-	framebuffer_bind(s->view->fb);
+	struct view *v     = s->view;
+	rect_t       area  = rect_isempty(s->selection) ? view_rect(v) : rect_norm(s->selection);
+	rgba_t       color = hex2rgba(args[1]);
 
-	if (!rect_isempty(s->selection)) {
-		fill_rect( s->ctx
-			 , (int)s->selection.x1
-			 , (int)s->selection.y1
-			 , (int)s->selection.x2
-			 , (int)s->selection.y2
-			 , hex2rgba(args[1])
-			 );
-	} else {
-		fill_rect(s->ctx, 0, 0, vw(s->view), vh(s->view), hex2rgba(args[1]));
+	if (! view_encode(v, &color))
+		return false;
+
+	struct tileiter it;
+
+	for (canvas_tiles(&it, v->canvas, area, true); canvas_tiles_next(&it); ) {
+		rect_t r = rect_translate(area, vec2(-it.x, -it.y));
+
+		fill_rect(s->ctx, (int)r.x1, (int)r.y1, (int)r.x2, (int)r.y2, color);
+		view_touch(v, it.frame, it.tile);
 	}
+	framebuffer_bind(s->ctx->screen);
 	return true;
 }
 
@@ -2698,20 +4771,53 @@ static bool cmd_record(struct session *s, int argc, char *args[])
 	return true;
 }
 
+/* Play a macro, optionally faster than it was recorded, eg. `play rec 10`
+ * for 10x, or `play rec max` to play it as fast as possible. */
 static bool cmd_play(struct session *s, int argc, char *args[])
 {
-	if (argc != 2) {
+	double speed = 1;
+
+	if (argc != 2 && argc != 3) {
 		message(MSG_ERR, "Error: invalid command invocation");
 		return false;
 	}
-	FILE *stream = fopen(args[1], "r");
+	if (argc == 3) {
+		speed = strcmp(args[2], "max") ? strtod(args[2], NULL) : 0;
+
+		if (speed < 0 || (speed == 0 && strcmp(args[2], "max"))) {
+			message(MSG_ERR, "Error: invalid playback speed '%s'", args[2]);
+			return false;
+		}
+	}
+	struct macroreader *r = malloc(sizeof(*r));
 
-	if (! stream) {
+	if (! macro_open(r, args[1])) {
 		message(MSG_ERR, "Error: couldn't open \"%s\"", args[1]);
+		free(r);
 		return false;
 	}
+	if (s->play) {
+		macro_close(s->play);
+		free(s->play);
+	}
+	s->play        = r;
+	s->clock.speed = speed;
+	s->clock.batch = speed == 1 ? 0 : 1. / s->ctx->pacer.rate;
+
+	return true;
+}
+
+/* Convert a macro file between the binary encoding that recordings are
+ * saved in, and text, eg. `macro/convert 2019-01-01.rec 2019-01-01.txt`. */
+static bool cmd_macro_convert(struct session *s, int argc, char *args[])
+{
+	int steps = macro_convert(args[1], args[2]);
 
-	s->play = stream;
+	if (steps < 0) {
+		message(MSG_ERR, "Error: couldn't convert \"%s\" to \"%s\"", args[1], args[2]);
+		return false;
+	}
+	message(MSG_INFO, "%d steps converted to \"%s\"", steps, args[2]);
 
 	return true;
 }
@@ -2742,6 +4848,9 @@ static bool cmd_cursorup(struct session *s, int argc, char *args[])
 	return true;
 }
 
+/* Sleep for the given number of milliseconds. During macro playback, this
+ * advances the session clock instead, and only holds up playback, for as
+ * long as the playback speed calls for. */
 static bool cmd_sleep(struct session *s, int argc, char *args[])
 {
 	if (argc != 2) {
@@ -2750,6 +4859,16 @@ static bool cmd_sleep(struct session *s, int argc, char *args[])
 	}
 	long ms = strtoul(args[1], NULL, 10);
 
+	if (s->play) {
+		double secs = (double)ms / 1000.,
+		       wait = s->clock.speed > 0 ? secs / s->clock.speed : 0;
+
+		s->clock.skew  += secs - wait;
+		s->clock.resume = ctx_time(s->ctx) + wait;
+
+		return true;
+	}
+
 	struct timespec ts;
 	ts.tv_sec  = ms / 1000;
 	ts.tv_nsec = (ms % 1000) * 1000 * 1000;
@@ -2770,14 +4889,109 @@ static bool cmd_test_check(struct session *s, int argc, char *args[])
 	unsigned long actual = session_digest(s);
 	unsigned long expected = strtoul(args[1], NULL, 16);
 
+	s->checks ++;
+
 	if (actual != expected) {
 		message(MSG_ERR, "Test failed (%lx != %lx)", actual, expected);
+		s->failures ++;
 		return false;
 	}
 	message(MSG_OK, "Test passed for %lx", expected);
 	return true;
 }
 
+static bool cmd_test_vdigest(struct session *s, int argc, char *args[])
+{
+	message(MSG_INFO, "digest = %016llx", (unsigned long long)session_view_digest(s, TILEDIGEST_NONE));
+	return true;
+}
+
+/* Check the digest of every view. Tiles which failed `test/tile` since the
+ * last check are reported, to tell what differs. */
+static bool cmd_test_vcheck(struct session *s, int argc, char *args[])
+{
+	uint64_t actual   = session_view_digest(s, TILEDIGEST_NONE);
+	uint64_t expected = strtoull(args[1], NULL, 16);
+	int      fails    = s->tilefails;
+
+	s->tilefails = 0;
+	s->checks ++;
+
+	if (actual != expected) {
+		s->failures ++;
+
+		if (fails > 0) {
+			message(MSG_ERR, "Test failed (%016llx != %016llx), %d tile(s) differ, starting with %s",
+				(unsigned long long)actual, (unsigned long long)expected, fails, s->tilefail);
+		} else {
+			message(MSG_ERR, "Test failed (%016llx != %016llx)",
+				(unsigned long long)actual, (unsigned long long)expected);
+		}
+		return false;
+	}
+	message(MSG_OK, "Test passed for %016llx", (unsigned long long)expected);
+	return true;
+}
+
+/* Check the digest of a single tile: `test/tile <view> <frame> <tile> <digest>`.
+ * Views, frames and tiles are numbered from 1, tiles row by row. Only
+ * failures are reported, and then counted by `test/vcheck`. */
+static bool cmd_test_tile(struct session *s, int argc, char *args[])
+{
+	struct view *v     = s->views;
+	int          nview = (int)strtol(args[1], NULL, 10),
+	             tile  = (int)strtol(args[3], NULL, 10) - 1,
+	             frame;
+
+	for (int i = 1; v && i < nview; i++)
+		v = v->next;
+
+	if (nview < 1 || ! v) {
+		message(MSG_ERR, "Error: invalid view '%s'", args[1]);
+		return false;
+	}
+	if (! frame_arg(args[2], v->nframes - 1, &frame))
+		return false;
+
+	if (tile < 0 || tile >= v->canvas->ntiles) {
+		message(MSG_ERR, "Error: invalid tile '%s'", args[3]);
+		return false;
+	}
+	uint64_t actual   = view_tile_digest(v, frame, tile);
+	uint64_t expected = strtoull(args[4], NULL, 16);
+
+	framebuffer_bind(s->ctx->screen);
+
+	if (actual != expected) {
+		if (s->tilefails ++ == 0) {
+			snprintf(s->tilefail, sizeof(s->tilefail), "view %d, frame %d, tile %d",
+				nview, frame + 1, tile + 1);
+		}
+		message(MSG_ERR, "Test failed for view %d, frame %d, tile %d (%016llx != %016llx)",
+			nview, frame + 1, tile + 1, (unsigned long long)actual, (unsigned long long)expected);
+		return false;
+	}
+	return true;
+}
+
+/* Check that every tile shown since the last `test/drawn` could be drawn,
+ * however many of them there are. */
+static bool cmd_test_drawn(struct session *s, int argc, char *args[])
+{
+	int undrawn = s->undrawn;
+
+	s->undrawn = 0;
+	s->checks ++;
+
+	if (undrawn > 0) {
+		message(MSG_ERR, "Test failed, %d tile(s) couldn't be drawn", undrawn);
+		s->failures ++;
+		return false;
+	}
+	message(MSG_OK, "Test passed, all tiles drawn");
+	return true;
+}
+
 static bool cmd_test_record(struct session *s, int argc, char *args[])
 {
 	session_start_recording(s, REC_TEST);
@@ -2785,21 +4999,36 @@ static bool cmd_test_record(struct session *s, int argc, char *args[])
 	return true;
 }
 
+/* Play a test recording as fast as possible, unless a speed is given. */
 static bool cmd_test_play(struct session *s, int argc, char *args[])
 {
-	/* Currently, these two commands are identical */
-	return cmd_play(s, argc, args);
+	char *argv[] = { args[0], args[1], argc > 2 ? args[2] : "max" };
+
+	return cmd_play(s, 3, argv);
 }
 
 static bool cmd_test_save(struct session *s, int argc, char *args[])
 {
 	char path[32];
 
+	/* Tiles are checked one by one before the whole, so that a failure
+	 * tells which tiles differ. Only non-empty tiles are, unless `all` is
+	 * given. */
+	enum tiledigest record = TILEDIGEST_NONEMPTY;
+
+	if (argc > 1 && ! strcmp(args[1], "all")) {
+		record = TILEDIGEST_ALL;
+	} else if (argc > 1) {
+		message(MSG_ERR, "Error: invalid command argument '%s'", args[1]);
+		return false;
+	}
 	if (! timestamp(path, sizeof(path))) {
 		message(MSG_ERR, "Error: couldn't create timestamp");
 		return false;
 	}
-	session_macro_record(s, "test/check %lx", session_digest(s));
+	uint64_t digest = session_view_digest(s, record);
+
+	session_macro_record(s, "test/vcheck %016llx", (unsigned long long)digest);
 
 	int steps = session_finish_recording(s, path);
 	message(MSG_INFO, "%d steps recorded to \"%s\"", steps, path);
@@ -2814,6 +5043,183 @@ static bool cmd_test_discard(struct session *s, int argc, char *args[])
 	return true;
 }
 
+static bool cmd_stats_gl(struct session *s, int argc, char *args[])
+{
+	struct glstats *st = &s->ctx->glstats;
+
+	message(MSG_INFO, "%lu draws, %lu calls, %lu skipped, %lu uniforms, %lu buffers, %lu uploads, %lu readbacks",
+		st->draws, st->calls, st->skipped, st->uniforms, st->buffers, st->uploads, st->readbacks);
+
+	return true;
+}
+
+static bool cmd_stats_overlay(struct session *s, int argc, char *args[])
+{
+	return session_perf_toggle(s);
+}
+
+static bool cmd_trace_start(struct session *s, int argc, char *args[])
+{
+	if (! trace_start()) {
+		message(MSG_ERR, "Error: already tracing");
+		return false;
+	}
+	message(MSG_INFO, "Tracing..");
+
+	return true;
+}
+
+/* Save the trace capture to a file which can be opened in Perfetto or
+ * `chrome://tracing`, eg. `trace/stop px.json`. */
+static bool cmd_trace_stop(struct session *s, int argc, char *args[])
+{
+	if (! trace_on) {
+		message(MSG_ERR, "Error: not tracing");
+		return false;
+	}
+	long n = trace_stop(args[1]);
+
+	if (n < 0) {
+		message(MSG_ERR, "Error: couldn't write trace to \"%s\", still tracing", args[1]);
+		return false;
+	}
+	message(MSG_OK, "%ld events written to \"%s\"", n, args[1]);
+
+	return true;
+}
+
+static bool cmd_latency_start(struct session *s, int argc, char *args[])
+{
+	if (latency.enabled) {
+		message(MSG_ERR, "Error: already measuring latency");
+		return false;
+	}
+	latency_enable(true);
+	message(MSG_INFO, "Measuring latency..");
+
+	return true;
+}
+
+/* Stop measuring input latency, and report the latency of each input type,
+ * to a file if one is given, eg. `latency/stop latency.txt`, or to the log
+ * otherwise. */
+static bool cmd_latency_stop(struct session *s, int argc, char *args[])
+{
+	if (! latency.enabled) {
+		message(MSG_ERR, "Error: not measuring latency");
+		return false;
+	}
+	FILE *fp = argc > 1 ? fopen(args[1], "w") : stderr;
+
+	if (! fp) {
+		message(MSG_ERR, "Error: couldn't open \"%s\"", args[1]);
+		return false;
+	}
+	glFinish();
+	latency_poll();
+	latency_report(fp);
+
+	if (fp != stderr)
+		fclose(fp);
+
+	struct samples *strokes = &latency.gpu[INPUT_STROKE];
+
+	message(MSG_OK, "Stroke latency: %.1fms p50, %.1fms p95 (%zu samples)",
+		samples_percentile(strokes, 50), samples_percentile(strokes, 95), strokes->len);
+
+	latency_enable(false);
+
+	return true;
+}
+
+/* Show frame statistics. The largest jitter seen is kept until the stats
+ * are reset, with `stats/frame reset`. */
+static bool cmd_stats_frame(struct session *s, int argc, char *args[])
+{
+	struct pacer *p = &s->ctx->pacer;
+
+	if (argc > 1) {
+		if (strcmp(args[1], "reset")) {
+			message(MSG_ERR, "Error: invalid argument '%s'", args[1]);
+			return false;
+		}
+		p->jitter = 0;
+		return true;
+	}
+	message(MSG_INFO, "%lu frames @ %.0fHz, %.2fms draw, %.2fms interval (avg %.2fms, jitter %.2fms)",
+		p->frames, p->rate, p->frametime, p->interval, p->average, p->jitter);
+
+	return true;
+}
+
+/* Show the number of colors in the view, and the first few of them, in the
+ * order they appear, or the most frequent ones with `freq`. Takes the same
+ * options as `p/sample`. */
+static bool cmd_stats_colors(struct session *s, int argc, char *args[])
+{
+	int  first, last, limit;
+	bool byfreq;
+
+	if (! sample_args(s, argc, args, &first, &last, &byfreq, &limit))
+		return false;
+
+	struct histogram h;
+	double           t = ctx_time(s->ctx);
+
+	histogram_init(&h);
+	view_histogram(s->view, first, last, &h);
+
+	struct hcolor *colors = histogram_colors(&h, byfreq);
+	char           top[128] = {0};
+	size_t         len = 0;
+
+	for (int i = 0; i < min(h.len, min(limit, 4)); i++) {
+		rgba_t c = colors[i].color;
+
+		len += (size_t)snprintf(top + len, sizeof(top) - len, " #%.2x%.2x%.2x %.1f%%",
+			c.r, c.g, c.b, 100. * colors[i].count / (double)h.total);
+	}
+	message(MSG_INFO, "%d colors in %lu pixels (%.1fms), %s:%s",
+		h.len, h.total, (ctx_time(s->ctx) - t) * 1000., byfreq ? "top" : "first", top);
+
+	free(colors);
+	histogram_free(&h);
+
+	return true;
+}
+
+/* Set the frame pacing mode and target rate, eg. `pace vsync 60`,
+ * `pace low-latency 144` or `pace uncapped`. */
+static bool cmd_pace(struct session *s, int argc, char *args[])
+{
+	struct pacer *p    = &s->ctx->pacer;
+	double        rate = argc > 2 ? strtod(args[2], NULL) : p->rate;
+	enum pacing   mode;
+
+	if (argc < 2) {
+		message(MSG_ERR, "Error: invalid command invocation");
+		return false;
+	}
+
+	if (! strcmp(args[1], "vsync")) {
+		mode = PACE_VSYNC;
+	} else if (! strcmp(args[1], "low-latency")) {
+		mode = PACE_LOWLATENCY;
+	} else if (! strcmp(args[1], "uncapped")) {
+		mode = PACE_UNCAPPED;
+	} else {
+		message(MSG_ERR, "Error: unknown pacing mode \"%s\"", args[1]);
+		return false;
+	}
+	if (rate <= 0) {
+		message(MSG_ERR, "Error: invalid frame rate \"%s\"", args[2]);
+		return false;
+	}
+	ctx_pace(s->ctx, mode, rate);
+
+	return true;
+}
+
 static bool command(struct session *s, char *str)
 {
 	size_t len = strlen(str);
@@ -2824,15 +5230,17 @@ static bool command(struct session *s, char *str)
 	char *input = alloca(len + 1);
 	memcpy(input, str, len + 1);
 
+	session_damage(s, DAMAGE_ALL);
+
 	if (!! strcmp(str, "record") && ! strprefix(str, "test/"))
-		session_macro_record(s, str);
+		session_macro_record(s, "%s", str);
 
 	int      argc     =  0;
-	char    *argv[16] = {0}; /* 16 args max */
+	char    *argv[64] = {0}; /* 64 args max */
 	char    *arg      = NULL;
 
 	argv[argc++] = strtok(input, " ");
-	while ((arg = strtok(NULL, " "))) {
+	while (argc < (int)elems(argv) && (arg = strtok(NULL, " "))) {
 		argv[argc++] = arg;
 	}
 
@@ -2842,7 +5250,15 @@ static bool command(struct session *s, char *str)
 				message(MSG_ERR, "Error: %s: wrong number of arguments", argv[0]);
 				return false;
 			}
-			return commands[i].callback(s, argc, argv);
+			/* Commands can start and stop the capture, so whether it's
+			 * running is checked once, for the span to have both ends. */
+			bool traced = trace_on;
+
+			if (traced) _trace_event("command", commands[i].name, 'B');
+			bool ok = commands[i].callback(s, argc, argv);
+			if (traced) _trace_event("command", commands[i].name, 'E');
+
+			return ok;
 		}
 	}
 
@@ -2953,6 +5369,8 @@ static void tools_init(struct tools *tools)
 	tools->icons[TOOL_BRUSH]         = (struct icon){ rect(16, 16, 16, 16), -8, -8, GL_CONSTANT_COLOR, GL_ONE_MINUS_SRC_ALPHA };
 
 	assert(tools->texture);
+
+	readback_init(&tools->probe);
 }
 
 static bool parse_options(struct session *s, int argc, char *argv[])
@@ -2972,31 +5390,273 @@ static bool parse_options(struct session *s, int argc, char *argv[])
 	return false;
 }
 
+/* Report tiles which couldn't be drawn, and count them for `test/drawn`.
+ * Otherwise, views with tiles paged in while drawing zoomed out are redrawn,
+ * since those tiles were drawn from their low resolution copy. */
+static void session_check_tiles(struct session *s)
+{
+	for (struct view *v = s->views; v; v = v->next) {
+		struct canvas *c = v->canvas;
+
+		s->undrawn += c->undrawn;
+		c->undrawn  = 0;
+
+		if (c->failed) {
+			message(MSG_ERR, "Error: too many tiles to fit in video memory, some can't be shown");
+			c->failed = false;
+		} else if (c->nstale && s->zoom < 1) {
+			session_damage(s, DAMAGE_VIEWS);
+		}
+	}
+}
+
+/* Redraw the damaged parts of the screen and present it. Everything
+ * intersecting the damaged area is drawn, clipped to that area, while the
+ * rest of the screen framebuffer is left as it was on the previous frame. */
+static void session_draw(struct session *s)
+{
+	struct context *ctx     = s->ctx;
+	rect_t          clip    = session_damage_rect(s);
+	rect_t          palette = palette_rect(s->palette);
+	rect_t          status  = statusbar_rect(s);
+	rect_t          overlay = perf_rect(s);
+
+	/* The overlay changes every frame, so it's always redrawn. */
+	if (perf.enabled)
+		clip = rect_union(clip, overlay);
+
+	trace_begin("draw", "session_draw");
+	ctx_frame_begin(ctx);
+	canvas_pin(true);
+
+	perf_begin(PERF_VIEWS);
+
+	/* Views are only drawn from their mip levels when zoomed out, so
+	 * that's when edits are propagated to them. */
+	if (s->zoom < 1) {
+		for (struct view *v = s->views; v; v = v->next)
+			view_update_mips(ctx, v);
+	}
+	framebuffer_bind(ctx->screen);
+	ctx_clip(ctx, &clip);
+	framebuffer_clearcolor(0.0f, 0.0f, 0.0f, 0.f);
+
+	ctx_identity(ctx);
+
+	trace_begin("draw", "session_draw_views");
+	session_draw_views(s, &clip);
+	trace_end("draw", "session_draw_views");
+
+	perf_end(PERF_VIEWS);
+
+	if (rect_intersects(&clip, &palette)) {
+		perf_begin(PERF_PALETTE);
+		trace_begin("draw", "session_draw_palette");
+		session_draw_palette(s);
+		trace_end("draw", "session_draw_palette");
+		perf_end(PERF_PALETTE);
+	}
+	if (rect_intersects(&clip, &status)) {
+		perf_begin(PERF_STATUSBAR);
+		trace_begin("draw", "session_draw_statusbar");
+		session_draw_statusbar(s);
+		trace_end("draw", "session_draw_statusbar");
+		trace_begin("draw", "session_draw_cmdline");
+		session_draw_cmdline(s);
+		trace_end("draw", "session_draw_cmdline");
+		perf_end(PERF_STATUSBAR);
+	}
+	if (s->help)
+		help_show(ctx);
+
+	if (perf.enabled) {
+		trace_begin("draw", "session_draw_perf");
+		session_draw_perf(s);
+		trace_end("draw", "session_draw_perf");
+	}
+	perf_begin(PERF_CURSOR);
+	trace_begin("draw", "session_draw_cursor");
+	session_draw_cursor(s, s->mx, s->my, s->tool.curr);
+	trace_end("draw", "session_draw_cursor");
+	perf_end(PERF_CURSOR);
+
+	ctx_clip(ctx, NULL);
+	canvas_pin(false);
+
+	perf_begin(PERF_PRESENT);
+	ctx_present(ctx);
+	perf_end(PERF_PRESENT);
+	perf_frame(ctx->pacer.frametime);
+	trace_end("draw", "session_draw");
+
+	s->cursorrect = session_cursor_rect(s, s->mx, s->my);
+	s->damage     = DAMAGE_NONE;
+	s->damaged    = perf.enabled ? overlay : rect(0, 0, 0, 0);
+
+	session_check_tiles(s);
+}
+
+/* Schedule the next frame of animated views, and damage their previews if
+ * the previously scheduled frame is due. */
+static void session_schedule(struct session *s)
+{
+	double now = session_time(s);
+	bool   due = s->deadline > 0 && now >= s->deadline;
+
+	s->deadline = 0;
+
+	if (s->paused)
+		return;
+
+	for (struct view *v = s->views; v; v = v->next) {
+		if (v->nframes <= 1)
+			continue;
+
+		if (due) {
+			int vx, vy;
+			view_offset(v, s, &vx, &vy);
+
+			session_damage_area(s, rect(
+				(float)vx - (float)v->fw * s->zoom - 1, vy - 1,
+				vx + 1, (float)vy + (float)vh(v) * s->zoom + 1));
+		}
+		double frame = floor((now - s->started) * s->fps) + 1;
+		s->deadline  = s->started + frame / s->fps;
+	}
+}
+
+/* Wait for input, or until the next scheduled frame is due. While a macro
+ * is playing, or there is damage left to draw, only wait until the frame
+ * pacer allows the next frame to be drawn. */
+static void session_wait(struct session *s)
+{
+	struct pacer *p = &s->ctx->pacer;
+
+	if (p->mode == PACE_UNCAPPED) {
+		ctx_poll(s->ctx);
+	} else if (s->play || s->damage || ! rect_isempty(s->damaged) ||
+	           readback_pending(&s->probe) || readback_pending(&s->tools.probe)) {
+		ctx_tick_until(s->ctx, p->deadline);
+	} else if (s->deadline > 0) {
+		ctx_tick_until(s->ctx, fmax(s->deadline - s->clock.skew, p->deadline));
+	} else {
+		ctx_tick_wait(s->ctx);
+	}
+}
+
+/* Record the timings of the frame just drawn. GPU timings are only
+ * available a few frames later. */
+static void session_bench_frame(struct session *s)
+{
+	double ms;
+
+	samples_add(&s->bench->cpu, s->ctx->pacer.frametime);
+
+	while (gl_timer_read(s->ctx->gputimer, &ms))
+		samples_add(&s->bench->gpu, ms);
+}
+
+/* Write the benchmark report, and compare it with the baseline, if any.
+ * Returns non-zero if the report couldn't be written, or if it regressed. */
+static int session_bench_finish(struct session *s, double started, const char *report,
+                                const char *baseline, double threshold)
+{
+	struct bench *b = s->bench;
+	double ms;
+
+	trace_begin("gl", "glFinish");
+	glFinish();
+	trace_end("gl", "glFinish");
+
+	while (gl_timer_read(s->ctx->gputimer, &ms))
+		samples_add(&b->gpu, ms);
+
+	gl_timer_free(s->ctx->gputimer);
+	free(s->ctx->gputimer);
+	s->ctx->gputimer = NULL;
+
+	b->elapsed = ctx_time(s->ctx) - started;
+
+	if (! bench_write(b, report)) {
+		errorf("bench", "couldn't write report to '%s'", report);
+		return 1;
+	}
+	infof("bench", "%zu frames and %zu commands in %.2fs, report written to '%s'",
+	      b->cpu.len, b->commands.len, b->elapsed, report);
+
+	if (baseline)
+		return bench_compare(report, baseline, threshold) != 0;
+
+	return 0;
+}
+
+static void refresh_callback(struct context *ctx)
+{
+	session_damage(ctx->extra, DAMAGE_ALL);
+}
+
 int main(int argc, char *argv[])
 {
+	char *test = NULL, *bench = NULL;
+	char *report = "bench.json", *baseline = NULL;
+	double threshold = BENCH_THRESHOLD, started = 0;
+
+	/* `px -T <dir> [-j <jobs>]` plays every recording of a directory in
+	 * parallel, each with `px -t <recording>`, which plays a recording in
+	 * a hidden window and exits with its result.
+	 *
+	 * `px -b <recording> [-o <report>] [-B <baseline>] [-r <percent>]`
+	 * replays a recording one command per frame, without vsync, and writes
+	 * frame and command timings to a report, comparing it with a baseline. */
+	for (int i = 1; i + 1 < argc; i++) {
+		if (! strcmp(argv[i], "-T")) {
+			int jobs = i + 3 < argc && ! strcmp(argv[i + 2], "-j") ? atoi(argv[i + 3]) : 0;
+
+			return runner(argv[0], argv[i + 1], jobs) > 0;
+		}
+		if (! strcmp(argv[i], "-t"))
+			test = argv[i + 1];
+		else if (! strcmp(argv[i], "-b"))
+			bench = argv[i + 1];
+		else if (! strcmp(argv[i], "-o"))
+			report = argv[i + 1];
+		else if (! strcmp(argv[i], "-B"))
+			baseline = argv[i + 1];
+		else if (! strcmp(argv[i], "-r"))
+			threshold = strtod(argv[i + 1], NULL);
+	}
 	struct context *ctx = calloc(1, sizeof(*ctx));
+
+	ctx->hidden = test != NULL;
+
 	if (! ctx_init(ctx, 640, 480, true)) {
 		fatal("main", "error initializing context");
 	}
 
 	info("main", "loading shader programs..");
 
-	ctx_load_program(ctx, "text",        "shaders/text.vert",           "shaders/textured.frag");
-	ctx_load_program(ctx, "texture",     "shaders/textured.vert",       "shaders/textured.frag");
-	ctx_load_program(ctx, "constant",    "shaders/basic.vert",          "shaders/constant.frag");
-	ctx_load_program(ctx, "framebuffer", "shaders/framebuffer.vert",    "shaders/framebuffer.frag");
+	ctx_load_program(ctx, PROGRAM_TEXT,        "text",        "shaders/text.vert",           "shaders/textured.frag");
+	ctx_load_program(ctx, PROGRAM_TEXTURE,     "texture",     "shaders/textured.vert",       "shaders/textured.frag");
+	ctx_load_program(ctx, PROGRAM_CONSTANT,    "constant",    "shaders/basic.vert",          "shaders/constant.frag");
+	ctx_load_program(ctx, PROGRAM_FRAMEBUFFER, "framebuffer", "shaders/framebuffer.vert",    "shaders/framebuffer.frag");
+	ctx_load_program(ctx, PROGRAM_OVERLAY,     "overlay",     "shaders/overlay.vert",        "shaders/overlay.frag");
+	ctx_load_program(ctx, PROGRAM_ONION,       "onion",       "shaders/overlay.vert",        "shaders/onion.frag");
+	ctx_load_program(ctx, PROGRAM_DOWNSAMPLE,  "downsample",  "shaders/overlay.vert",        "shaders/downsample.frag");
+	ctx_load_program(ctx, PROGRAM_RECOLOR,     "recolor",     "shaders/overlay.vert",        "shaders/recolor.frag");
+	ctx_load_program(ctx, PROGRAM_ADJUST,      "adjust",      "shaders/overlay.vert",        "shaders/adjust.frag");
 
 	info("main", "loading font..");
 	if (! load_font(ctx->font, "assets/glyphs.tga", 8, 14)) {
 		ctx_destroy(ctx, "error loading font");
 		return 1;
 	}
-	ctx->on_key    = key_callback;
-	ctx->on_click  = mouse_button_callback;
-	ctx->on_cursor = cursor_pos_callback;
-	ctx->on_resize = window_size_callback;
-	ctx->on_move   = window_pos_callback;
-	ctx->on_char   = char_callback;
+	ctx->on_key     = key_callback;
+	ctx->on_click   = mouse_button_callback;
+	ctx->on_cursor  = cursor_pos_callback;
+	ctx->on_resize  = window_size_callback;
+	ctx->on_move    = window_pos_callback;
+	ctx->on_char    = char_callback;
+	ctx->on_refresh = refresh_callback;
 
 	ctx_cursor_hide(ctx);
 
@@ -3022,36 +5682,59 @@ int main(int argc, char *argv[])
 
 	kb_brush(session, NULL);
 
-	if (! parse_options(session, argc, argv)) {
+	if (test) {
+		/* Configuration is skipped, so that tests run the same anywhere. */
+		char *args[] = { "test/play", test };
+
+		session->testing = true;
+		ctx_pace(ctx, PACE_UNCAPPED, 60);
+
+		if (! cmd_test_play(session, (int)elems(args), args))
+			ctx_closewindow(ctx);
+	} else if (bench) {
+		/* Like tests, benchmarks skip configuration. Sleeps are skipped as
+		 * well, since it's the frames that are being measured. */
+		char *args[] = { "play", bench, "max" };
+
+		session->bench = calloc(1, sizeof(*session->bench));
+		bench_init(session->bench, bench);
+		ctx->gputimer = calloc(1, sizeof(*ctx->gputimer));
+		gl_timer_init(ctx->gputimer);
+		ctx_pace(ctx, PACE_UNCAPPED, 60);
+		started = ctx_time(ctx);
+
+		if (cmd_play(session, (int)elems(args), args))
+			session->clock.batch = 0;
+		else
+			ctx_closewindow(ctx);
+	} else if (! parse_options(session, argc, argv)) {
 		source_dir(session, getenv("HOME"));
 		source_dir(session, ".");
 	}
 
 	while (ctx_loop(ctx)) {
 		session_macro_play(session);
+		session_schedule(session);
+		session_readback(session);
+		latency_poll();
 
-		framebuffer_bind(ctx->screen);
-		framebuffer_clearcolor(0.0f, 0.0f, 0.0f, 0.f);
-
-		ctx_identity(ctx);
-
-		session_draw_views(session);
-		session_draw_palette(session);
-		session_draw_statusbar(session);
-		session_draw_cmdline(session);
-
-		if (session->help)
-			help_show(ctx);
+		if (ctx->pacer.mode == PACE_UNCAPPED)
+			session_damage(session, DAMAGE_ALL);
 
-		session_draw_cursor(session, session->mx, session->my, session->tool.curr);
+		if ((session->damage || ! rect_isempty(session->damaged)) && ctx_frame_due(ctx)) {
+			session_draw(session);
 
-		ctx_present(ctx);
-
-		if (session->paused && !session->play) {
-			ctx_tick_wait(ctx);
-		} else {
-			ctx_tick(ctx);
+			if (session->bench)
+				session_bench_frame(session);
 		}
+		session_wait(session);
+	}
+	int status = 0;
+
+	if (session->bench) {
+		status = session_bench_finish(session, started, report, baseline, threshold);
+		bench_free(session->bench);
+		free(session->bench);
 	}
 
 	if (session->palette)
@@ -3059,6 +5742,10 @@ int main(int argc, char *argv[])
 	if (session->paste)
 		texture_free(session->paste);
 
+	polygon_release(&session->overlay);
+	readback_free(&session->probe);
+	readback_free(&session->tools.probe);
+
 	for (struct view *tmp, *v = session->views; v; ) {
 		tmp = v->next;
 		view_free(v);
@@ -3067,13 +5754,17 @@ int main(int argc, char *argv[])
 
 	ctx_destroy(ctx, "exiting");
 
+	/* Tests fail if they didn't check anything. */
+	if (test)
+		status = session->failures > 0 || session->checks == 0;
+
 #if defined(DEBUG)
 	free(session->cmdline.in);
-	free(session->checker.tex);
 	free(session->tools.texture);
+	free(session->vindex.views);
 	free(session);
 #endif
 
-	return 0;
+	return status;
 }
 
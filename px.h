@@ -59,6 +59,15 @@ enum recopt {
 	REC_TEST = 1 << 0
 };
 
+enum damage {
+	DAMAGE_NONE      = 0,
+	DAMAGE_VIEWS     = 1 << 0,
+	DAMAGE_PALETTE   = 1 << 1,
+	DAMAGE_STATUS    = 1 << 2,
+	DAMAGE_CURSOR    = 1 << 3,
+	DAMAGE_ALL       = DAMAGE_VIEWS | DAMAGE_PALETTE | DAMAGE_STATUS | DAMAGE_CURSOR
+};
+
 struct brush {
 	int                       size;
 	enum   dstate             drawing;
@@ -71,18 +80,41 @@ struct brush {
 	bool                      multi;
 };
 
+/* Copy of a tile's pixels, shared by all snapshots in which the tile is
+ * unchanged. */
+/* Copy of a tile, kept in host memory so that the undo history doesn't take
+ * up video memory. */
+struct tilecopy {
+	rgba_t                   *pixels;   /* Laid out as read by `canvas_read` */
+	int                       refs;
+};
+
 struct snapshot {
-	struct texture           *pixels;
+	struct tilecopy         **tiles;    /* Copy of each tile, or NULL if empty */
 	int                       x, y;
-	int                       w, h;
+	int                       w, h;     /* Frame size */
 	int                       nframes;
+	int                       ntiles;   /* Number of tiles in a frame */
+	rgba_t                   *colors;   /* Colormap of an indexed view, or NULL */
+	int                       ncolors;
 	bool                      saved;
 
 	struct snapshot          *next, *prev;
 };
 
+/* Colors of an indexed view, whose pixels are indices into them. */
+struct colormap {
+	rgba_t                    colors[256];
+	int                       ncolors;
+	struct texture           *lut;      /* Colors as a 256x1 texture, looked up
+	                                     * when drawing the view */
+};
+
 struct view {
-	struct framebuffer       *fb;
+	struct canvas            *canvas;
+	struct colormap          *colormap; /* Colors of an indexed view, or NULL */
+	struct tilecopy         **clean;    /* Copy of each tile as of the last snapshot,
+	                                     * or NULL if it has changed since */
 	int                       fw, fh;
 	int                       x, y;
 	int                       nframes;
@@ -95,6 +127,11 @@ struct view {
 	enum filestatus          filestatus;
 };
 
+struct viewindex {
+	struct view             **views;    /* Views sorted by ascending 'y' */
+	int                       len, cap;
+};
+
 struct icon {
 	rect_t                    rect;
 	int                       ax, ay;
@@ -106,6 +143,7 @@ struct icon {
 struct tools {
 	struct texture            *texture;
 	struct icon                icons[6];
+	struct readback            probe;     /* Color under the icon, for contrast */
 };
 
 struct input {
@@ -119,7 +157,48 @@ struct cmdline {
 
 struct checker {
 	bool                     active;
-	struct texture          *tex;
+};
+
+enum oniondir {
+	ONION_PREV       = 1 << 0,
+	ONION_NEXT       = 1 << 1,
+	ONION_BOTH       = ONION_PREV | ONION_NEXT
+};
+
+struct onion {
+	bool                     active;
+	int                      depth;       /* Number of frames shown in each direction */
+	enum oniondir            direction;
+	float                    opacity;     /* Opacity of the nearest frames */
+	float                    falloff;     /* Opacity multiplier for each further frame */
+	rgba_t                   prevtint;
+	rgba_t                   nexttint;
+	float                    tint;        /* Amount of tint, from 0 to 1 */
+};
+
+enum adjustchannel {
+	ADJUST_HUE,
+	ADJUST_SATURATION,
+	ADJUST_LIGHTNESS
+};
+
+/* Hue, saturation and lightness adjustment being previewed, until it's
+ * applied or cancelled. */
+struct adjustment {
+	struct view             *view;        /* View adjusted, or NULL if there is none */
+	rect_t                   area;        /* Area adjusted, in view coordinates */
+	float                    hsl[3];      /* Hue rotation, in turns, and saturation and
+	                                       * lightness changes, from -1 to 1 */
+};
+
+/* Clock followed by animation and macro playback. While a macro plays, it
+ * can run ahead of real time, so that playback isn't held up by sleeps. */
+struct vclock {
+	double                   skew;        /* Seconds the clock is ahead of real time */
+	double                   speed;       /* Playback speed, or 0 for as fast as possible */
+	double                   resume;      /* Real time at which playback resumes */
+	double                   batch;       /* Seconds of commands to play per tick, or 0
+	                                       * to play one command per tick */
 };
 
 enum tooltype {
@@ -138,22 +217,18 @@ struct buffer {
 	rect_t                         rect;
 };
 
-struct macro {
-	struct macro *next;
-	char         *cmd;
-};
-
 struct session {
 	int                      w, h;
 	int                      x, y;
 	int                      mx, my;
 	bool                     mousedown;
 	rect_t                   mselection;
-	int                      zoom;
+	float                    zoom;      /* Below 1, views are drawn from their mip levels */
 	int                      fps;
 	rect_t                   selection;
 	bool                     paused;
-	bool                     onion;
+	struct onion             onion;
+	struct adjustment        adjust;
 	bool                     help;
 	bool                     recording;
 	unsigned                 recopts;
@@ -161,16 +236,32 @@ struct session {
 	rgba_t                   fg, bg;
 	int                      gridw, gridh;
 
-	struct macro            *macros;   /* Head of macro list */
-	struct macro            *macro;    /* Current macro pointer */
+	unsigned                 damage;      /* Parts of the screen to redraw */
+	rect_t                   damaged;     /* Additional screen area to redraw */
+	rect_t                   cursorrect;  /* Screen area of the last drawn cursor */
+	double                   deadline;    /* Time of the next scheduled redraw */
+	struct readback          probe;       /* Color under the cursor, for the status bar */
+	int                      tilefails;   /* Tiles which failed `test/tile` since the last check */
+	int                      checks;      /* Number of test checks run */
+	int                      failures;    /* Number of those which failed */
+	int                      undrawn;     /* Tiles which couldn't be drawn, until `test/drawn` */
+	bool                     testing;     /* Whether to quit once the macro played, as `px -t` */
+	struct bench            *bench;       /* Benchmark being run, as `px -b`, or NULL */
+	char                     tilefail[64];/* First of those tiles */
+
+	struct macro             macro;    /* Macro being recorded */
 	struct timeval           macro_tv; /* Time of last macro */
-	FILE                    *play;
+	struct macroreader      *play;     /* Macro being played, or NULL */
+	struct vclock            clock;
 
 	struct view             *views;
 	struct view             *view;
+	struct view             *hover;    /* View under the cursor */
+	struct viewindex         vindex;   /* Index of views, for culling and hit testing */
 	struct context          *ctx;
 	struct cmdline           cmdline;
 	struct checker           checker;
+	struct polygon           overlay;               /* Unit quad for view overlays */
 	struct palette          *palette;
 	struct tools             tools;
 	struct tool              tool;
@@ -0,0 +1,230 @@
+//
+// quantize.c
+// color quantization
+//
+// Palettes are built with median cut, over the colors of a histogram rather
+// than over pixels. Colors start out in a single box, and the box with the
+// widest spread of pixels along any channel is split at the median pixel
+// along that channel, until there are as many boxes as palette colors. Each
+// box then gives the average of its pixels as a palette color. Alpha is
+// treated as a fourth channel, so that translucent colors keep their own
+// entries.
+//
+// Photographs and other reference images can have millions of colors, which
+// are too many to count and sort quickly. Past `QUANTIZE_EXACT` colors, the
+// pixels are coarsened to five bits per color channel before counting,
+// which is all median cut needs to pick good boxes.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "color.h"
+#include "histogram.h"
+#include "quantize.h"
+
+struct box {
+	int              lo, hi;    /* Range of colors in the box */
+	int              axis;      /* Channel with the widest range */
+	uint64_t         score;     /* Range along `axis`, times the pixel count */
+};
+
+static inline uint8_t channel(rgba_t c, int axis)
+{
+	switch (axis) {
+	case 0:  return c.r;
+	case 1:  return c.g;
+	case 2:  return c.b;
+	default: return c.a;
+	}
+}
+
+#define CMP_AXIS(axis) \
+	static int cmp_axis##axis(const void *a, const void *b) \
+	{ \
+		const struct hcolor *x = a, *y = b; \
+		return (int)channel(x->color, axis) - (int)channel(y->color, axis); \
+	}
+
+CMP_AXIS(0)
+CMP_AXIS(1)
+CMP_AXIS(2)
+CMP_AXIS(3)
+
+static int (*const cmp_axis[])(const void *, const void *) = {
+	cmp_axis0, cmp_axis1, cmp_axis2, cmp_axis3
+};
+
+/* Find the channel along which a box is widest, and score it. Boxes with a
+ * single color can't be split, and score zero. */
+static void box_measure(struct box *b, const struct hcolor *colors)
+{
+	uint8_t  lo[4] = {255, 255, 255, 255},
+	         hi[4] = {0};
+	uint64_t count = 0;
+
+	for (int i = b->lo; i < b->hi; i++) {
+		for (int a = 0; a < 4; a++) {
+			uint8_t v = channel(colors[i].color, a);
+
+			if (v < lo[a]) lo[a] = v;
+			if (v > hi[a]) hi[a] = v;
+		}
+		count += colors[i].count;
+	}
+	b->axis  = 0;
+	b->score = 0;
+
+	if (b->hi - b->lo < 2)
+		return;
+
+	for (int a = 1; a < 4; a++) {
+		if (hi[a] - lo[a] > hi[b->axis] - lo[b->axis])
+			b->axis = a;
+	}
+	b->score = (uint64_t)(hi[b->axis] - lo[b->axis]) * count;
+}
+
+/* Split a box at its median pixel, leaving the lower half in `b`. */
+static void box_split(struct box *b, struct box *upper, struct hcolor *colors)
+{
+	qsort(colors + b->lo, (size_t)(b->hi - b->lo), sizeof(*colors), cmp_axis[b->axis]);
+
+	uint64_t total = 0,
+	         sum   = 0;
+
+	for (int i = b->lo; i < b->hi; i++)
+		total += colors[i].count;
+
+	/* Both halves get at least one color. */
+	int mid = b->lo + 1;
+
+	for (sum = colors[b->lo].count; mid < b->hi - 1 && sum * 2 < total; mid++)
+		sum += colors[mid].count;
+
+	upper->lo = mid;
+	upper->hi = b->hi;
+	b->hi     = mid;
+
+	box_measure(b, colors);
+	box_measure(upper, colors);
+}
+
+static rgba_t box_average(const struct box *b, const struct hcolor *colors)
+{
+	uint64_t sum[4] = {0},
+	         count  = 0;
+
+	for (int i = b->lo; i < b->hi; i++) {
+		for (int a = 0; a < 4; a++)
+			sum[a] += (uint64_t)channel(colors[i].color, a) * colors[i].count;
+
+		count += colors[i].count;
+	}
+	return (rgba_t){
+		(uint8_t)((sum[0] + count / 2) / count),
+		(uint8_t)((sum[1] + count / 2) / count),
+		(uint8_t)((sum[2] + count / 2) / count),
+		(uint8_t)((sum[3] + count / 2) / count)
+	};
+}
+
+/* Reduce `ncolors` histogram colors to at most `n` palette colors, which
+ * are written to `palette`, most used first. `index` is set to the palette
+ * index of each histogram color, by the order it was first seen in. The
+ * histogram colors are reordered. Returns the number of palette colors. */
+int quantize(struct hcolor *colors, int ncolors, int n, rgba_t *palette, uint8_t *index)
+{
+	struct box boxes[256];
+	int        nboxes = 0;
+
+	if (ncolors == 0 || n <= 0)
+		return 0;
+	if (n > 256)
+		n = 256;
+
+	boxes[nboxes ++] = (struct box){ 0, ncolors, 0, 0 };
+	box_measure(&boxes[0], colors);
+
+	while (nboxes < n) {
+		int best = 0;
+
+		for (int i = 1; i < nboxes; i++) {
+			if (boxes[i].score > boxes[best].score)
+				best = i;
+		}
+		if (boxes[best].score == 0)
+			break;
+
+		box_split(&boxes[best], &boxes[nboxes ++], colors);
+	}
+
+	/* Order boxes by pixel count, so that the main colors come first. */
+	uint64_t counts[256];
+
+	for (int i = 0; i < nboxes; i++) {
+		counts[i] = 0;
+
+		for (int j = boxes[i].lo; j < boxes[i].hi; j++)
+			counts[i] += colors[j].count;
+	}
+	for (int i = 1; i < nboxes; i++) {
+		for (int j = i; j > 0 && counts[j] > counts[j - 1]; j--) {
+			struct box b = boxes[j];
+			uint64_t   c = counts[j];
+
+			boxes[j]  = boxes[j - 1];
+			counts[j] = counts[j - 1];
+			boxes[j - 1]  = b;
+			counts[j - 1] = c;
+		}
+	}
+	for (int i = 0; i < nboxes; i++) {
+		palette[i] = box_average(&boxes[i], colors);
+
+		for (int j = boxes[i].lo; j < boxes[i].hi; j++)
+			index[colors[j].order] = (uint8_t)i;
+	}
+	return nboxes;
+}
+
+/* Round the color channels of `n` pixels to five bits, keeping black and
+ * white as they are. Transparent pixels are left alone. */
+void quantize_coarsen(rgba_t *pixels, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		rgba_t *c = &pixels[i];
+
+		if (c->a == 0)
+			continue;
+
+		c->r = (uint8_t)((c->r & 0xf8) | (c->r >> 5));
+		c->g = (uint8_t)((c->g & 0xf8) | (c->g >> 5));
+		c->b = (uint8_t)((c->b & 0xf8) | (c->b >> 5));
+	}
+}
+
+/* Replace each of `n` pixels with its palette color, given the histogram
+ * the palette was built from, and the `index` set by `quantize`. Pixels
+ * that weren't counted, ie. transparent ones, are left as they are. */
+void quantize_map(const struct histogram *h, const rgba_t *palette, const uint8_t *index, rgba_t *pixels, size_t n)
+{
+	rgba_t from = {0}, to = {0};
+	bool   cached = false;
+
+	for (size_t i = 0; i < n; i++) {
+		/* Runs of the same color only need a single lookup. */
+		if (cached && ! memcmp(&pixels[i], &from, sizeof(from))) {
+			pixels[i] = to;
+			continue;
+		}
+		int o = histogram_find(h, pixels[i]);
+
+		from   = pixels[i];
+		to     = o >= 0 ? palette[index[o]] : from;
+		cached = true;
+
+		pixels[i] = to;
+	}
+}
@@ -0,0 +1,10 @@
+//
+// quantize.h
+// color quantization
+//
+#define QUANTIZE_EXACT   65536      /* Colors counted exactly before falling back
+                                     * to five bits per channel */
+
+int              quantize(struct hcolor *, int, int, rgba_t *, uint8_t *);
+void             quantize_coarsen(rgba_t *, size_t);
+void             quantize_map(const struct histogram *, const rgba_t *, const uint8_t *, rgba_t *, size_t);
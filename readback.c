@@ -0,0 +1,122 @@
+//
+// readback.c
+// asynchronous pixel readback
+//
+// Reading pixels back from the GPU with `glReadPixels` waits for all pending
+// rendering to finish. Reading into a pixel buffer object instead returns
+// right away, and a fence tells us when the pixel has arrived, usually by
+// the next frame. A small ring of buffers lets a new read be issued every
+// frame while older ones are still in flight.
+//
+#include <GL/glew.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "linmath.h"
+#include "color.h"
+#include "assert.h"
+#include "gl.h"
+#include "readback.h"
+
+void readback_init(struct readback *rb)
+{
+	glGenBuffers(READBACK_DEPTH, rb->pbos);
+
+	for (int i = 0; i < READBACK_DEPTH; i++) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(rgba_t), NULL, GL_STREAM_READ);
+
+		rb->fences[i] = NULL;
+		rb->seqs[i]   = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	rb->next  = 0;
+	rb->seq   = 0;
+	rb->done  = 0;
+	rb->color = (rgba_t){0, 0, 0, 0};
+}
+
+void readback_free(struct readback *rb)
+{
+	for (int i = 0; i < READBACK_DEPTH; i++) {
+		if (rb->fences[i])
+			glDeleteSync(rb->fences[i]);
+	}
+	glDeleteBuffers(READBACK_DEPTH, rb->pbos);
+}
+
+/* Request the pixel at the given position of the bound framebuffer. If every
+ * buffer is still in flight, the oldest read is abandoned and its buffer
+ * reused. Commands run in order on the GPU, so this doesn't have to wait. */
+void readback_pixel(struct readback *rb, int x, int y)
+{
+	int i = rb->next;
+
+	if (rb->fences[i])
+		glDeleteSync(rb->fences[i]);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbos[i]);
+	glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	gl_stats.readbacks ++;
+
+	rb->fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	rb->seqs[i]   = ++ rb->seq;
+	rb->next      = (i + 1) % READBACK_DEPTH;
+}
+
+/* Answer a request without reading anything, when the result is already
+ * known. Reads still in flight are superseded. */
+void readback_value(struct readback *rb, rgba_t color)
+{
+	rb->color = color;
+	rb->done  = ++ rb->seq;
+}
+
+/* Collect the reads which have completed, without waiting on the others.
+ * Returns whether the latest result changed. */
+bool readback_poll(struct readback *rb)
+{
+	rgba_t prev = rb->color;
+
+	for (int i = 0; i < READBACK_DEPTH; i++) {
+		if (! rb->fences[i])
+			continue;
+
+		GLenum status = glClientWaitSync(rb->fences[i], 0, 0);
+
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+
+		glDeleteSync(rb->fences[i]);
+		rb->fences[i] = NULL;
+
+		if (rb->seqs[i] <= rb->done)
+			continue;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbos[i]);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(rgba_t), &rb->color);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		rb->done = rb->seqs[i];
+	}
+	return memcmp(&prev, &rb->color, sizeof(prev)) != 0;
+}
+
+/* Wait for the latest request to be answered, and collect it along with the
+ * other completed reads. Returns whether the latest result changed. */
+bool readback_wait(struct readback *rb)
+{
+	for (int i = 0; i < READBACK_DEPTH; i++) {
+		if (rb->fences[i] && rb->seqs[i] == rb->seq)
+			glClientWaitSync(rb->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, READBACK_TIMEOUT);
+	}
+	return readback_poll(rb);
+}
+
+/* Whether the latest request hasn't been answered yet. */
+bool readback_pending(struct readback *rb)
+{
+	return rb->done < rb->seq;
+}
@@ -0,0 +1,24 @@
+//
+// readback.h
+// asynchronous pixel readback
+//
+#define READBACK_DEPTH   3          /* Reads that can be in flight at once */
+#define READBACK_TIMEOUT 1000000000 /* Longest wait for a read, in nanoseconds */
+
+struct readback {
+	GLuint           pbos[READBACK_DEPTH];
+	GLsync           fences[READBACK_DEPTH]; /* Set while a read is in flight */
+	unsigned long    seqs[READBACK_DEPTH];   /* Request each read answers */
+	int              next;      /* Buffer used by the next read */
+	unsigned long    seq;       /* Last request made */
+	unsigned long    done;      /* Request `color` answers */
+	rgba_t           color;     /* Latest result */
+};
+
+void             readback_init(struct readback *);
+void             readback_free(struct readback *);
+void             readback_pixel(struct readback *, int, int);
+void             readback_value(struct readback *, rgba_t);
+bool             readback_poll(struct readback *);
+bool             readback_wait(struct readback *);
+bool             readback_pending(struct readback *);
@@ -0,0 +1,125 @@
+//
+// remap.c
+// mapping colors to the nearest palette color
+//
+// The nearest palette color of every color is found ahead of time, and kept
+// in a 3D lookup table indexed by the top `REMAP_BITS` bits of each channel,
+// so that mapping a pixel is a single lookup. Colors are compared in OKLab,
+// which follows perceived differences much better than RGB. Building the
+// table compares every cell against every palette color, which is split
+// across threads.
+//
+// Ordered dithering offsets each pixel by a threshold from a 4x4 Bayer
+// matrix before the lookup, trading banding for a regular pattern.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <float.h>
+
+#include "color.h"
+#include "parallel.h"
+#include "remap.h"
+
+#define CELLS   (1 << REMAP_BITS)
+#define SHIFT   (8 - REMAP_BITS)
+
+static const int bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+struct build {
+	struct remap    *r;
+	lab_t            labs[256];
+};
+
+static inline int cell(int r, int g, int b)
+{
+	return (r << (2 * REMAP_BITS)) | (g << REMAP_BITS) | b;
+}
+
+/* Fill in a range of red slices of the table. */
+static void remap_build(void *arg, int worker, int lo, int hi)
+{
+	struct build *b = arg;
+	struct remap *r = b->r;
+
+	for (int x = lo; x < hi; x++) {
+		for (int y = 0; y < CELLS; y++) {
+			for (int z = 0; z < CELLS; z++) {
+				/* Cells are represented by their center. */
+				lab_t c    = rgba2lab(rgba(
+					(uint8_t)((x << SHIFT) | (1 << SHIFT >> 1)),
+					(uint8_t)((y << SHIFT) | (1 << SHIFT >> 1)),
+					(uint8_t)((z << SHIFT) | (1 << SHIFT >> 1)), 255));
+				float best = FLT_MAX;
+				int   idx  = 0;
+
+				for (int i = 0; i < r->ncolors; i++) {
+					float dl = c.l - b->labs[i].l,
+					      da = c.a - b->labs[i].a,
+					      db = c.b - b->labs[i].b,
+					      d  = dl * dl + da * da + db * db;
+
+					if (d < best) {
+						best = d;
+						idx  = i;
+					}
+				}
+				r->lut[cell(x, y, z)] = (uint8_t)idx;
+			}
+		}
+	}
+}
+
+/* Build the lookup table of the given palette, of at most 256 colors. */
+void remap_init(struct remap *r, const rgba_t *colors, int n)
+{
+	struct build b = { .r = r };
+
+	r->ncolors = n > 256 ? 256 : n;
+	r->lut     = malloc((size_t)CELLS * CELLS * CELLS);
+
+	for (int i = 0; i < r->ncolors; i++) {
+		r->colors[i] = colors[i];
+		b.labs[i]    = rgba2lab(colors[i]);
+	}
+	parallel_for(CELLS, remap_build, &b);
+}
+
+void remap_free(struct remap *r)
+{
+	free(r->lut);
+}
+
+static inline uint8_t clamp8(int v)
+{
+	return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/* Map a row of `n` pixels starting at (`x`, `y`) to the palette. The
+ * position only matters for dithering, which lines up across rows and
+ * tiles. Alpha is kept, and transparent pixels are left alone. */
+void remap_row(const struct remap *r, rgba_t *pixels, size_t n, int x, int y, bool dither)
+{
+	for (size_t i = 0; i < n; i++) {
+		rgba_t p = pixels[i];
+
+		if (p.a == 0)
+			continue;
+
+		if (dither) {
+			int t = (bayer[y & 3][(x + (int)i) & 3] * 2 + 1) * REMAP_DITHER / 32 - REMAP_DITHER / 2;
+
+			p.r = clamp8(p.r + t);
+			p.g = clamp8(p.g + t);
+			p.b = clamp8(p.b + t);
+		}
+		rgba_t c = r->colors[r->lut[cell(p.r >> SHIFT, p.g >> SHIFT, p.b >> SHIFT)]];
+
+		pixels[i] = rgba(c.r, c.g, c.b, p.a);
+	}
+}
@@ -0,0 +1,16 @@
+//
+// remap.h
+// mapping colors to the nearest palette color
+//
+#define REMAP_BITS       6          /* Bits per channel of the lookup table */
+#define REMAP_DITHER     32         /* Spread of ordered dithering, per channel */
+
+struct remap {
+	uint8_t         *lut;       /* Nearest palette color of each cell */
+	rgba_t           colors[256];
+	int              ncolors;
+};
+
+void             remap_init(struct remap *, const rgba_t *, int);
+void             remap_free(struct remap *);
+void             remap_row(const struct remap *, rgba_t *, size_t, int, int, bool);
@@ -0,0 +1,195 @@
+//
+// runner.c
+// running test recordings in parallel
+//
+// Each recording in a directory is played by its own `px -t` process, with
+// a hidden window of a fixed size, so that recordings don't interfere with
+// each other and can run on machines without a display of their own, eg.
+// under Xvfb with a software renderer. Up to `jobs` processes run at once.
+// The output of each process is kept in a temporary file, and shown for
+// recordings that fail.
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "parallel.h"
+#include "runner.h"
+
+#define RUNNER_MAX_OUTPUT   4       /* Lines of output shown for failures */
+
+struct job {
+	char            *path;
+	pid_t            pid;       /* Process playing the recording, or 0 */
+	FILE            *out;       /* Output of the process */
+	double           started;
+	double           elapsed;
+	int              status;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+static int compare(const void *a, const void *b)
+{
+	return strcmp(((const struct job *)a)->path, ((const struct job *)b)->path);
+}
+
+/* List the recordings of a directory, by name. Hidden files are skipped. */
+static struct job *runner_jobs(const char *dir, int *njobs)
+{
+	DIR           *d = opendir(dir);
+	struct dirent *e;
+	struct job    *jobs = NULL;
+	int            cap  = 0;
+
+	*njobs = 0;
+
+	if (! d)
+		return NULL;
+
+	while ((e = readdir(d))) {
+		struct stat st;
+		size_t      len  = strlen(dir) + strlen(e->d_name) + 2;
+		char       *path = malloc(len);
+
+		snprintf(path, len, "%s/%s", dir, e->d_name);
+
+		if (e->d_name[0] == '.' || stat(path, &st) != 0 || ! S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		if (*njobs == cap) {
+			cap  = cap ? cap * 2 : 64;
+			jobs = realloc(jobs, sizeof(*jobs) * (size_t)cap);
+		}
+		jobs[(*njobs) ++] = (struct job){ .path = path };
+	}
+	closedir(d);
+
+	if (jobs)
+		qsort(jobs, (size_t)*njobs, sizeof(*jobs), compare);
+
+	return jobs;
+}
+
+static bool runner_start(struct job *j, const char *self)
+{
+	if (! (j->out = tmpfile()))
+		return false;
+
+	fflush(stdout);
+	j->started = now();
+
+	if ((j->pid = fork()) == 0) {
+		dup2(fileno(j->out), STDOUT_FILENO);
+		dup2(fileno(j->out), STDERR_FILENO);
+
+		execlp(self, self, "-t", j->path, (char *)NULL);
+		_exit(127);
+	}
+	return j->pid > 0;
+}
+
+/* Show the last lines of output of a failed recording. */
+static void runner_report(struct job *j)
+{
+	char line[512], last[RUNNER_MAX_OUTPUT][512];
+	int  n = 0;
+
+	rewind(j->out);
+
+	while (fgets(line, sizeof(line), j->out))
+		snprintf(last[n ++ % RUNNER_MAX_OUTPUT], sizeof(last[0]), "%s", line);
+
+	for (int i = n > RUNNER_MAX_OUTPUT ? n - RUNNER_MAX_OUTPUT : 0; i < n; i++)
+		printf("      %s", last[i % RUNNER_MAX_OUTPUT]);
+}
+
+/* Play every recording in `dir` with the `px` executable at `self`, running
+ * up to `jobs` at once, or one per core if `jobs` is zero. Prints a line
+ * per recording, followed by a summary. Returns the number of recordings
+ * which failed. */
+int runner(const char *self, const char *dir, int jobs)
+{
+	int         njobs, running = 0, next = 0, done = 0, failed = 0;
+	struct job *js      = runner_jobs(dir, &njobs);
+	double      started = now();
+
+	if (! js) {
+		fprintf(stderr, "px: no recordings found in \"%s\"\n", dir);
+		return 1;
+	}
+	if (jobs <= 0)
+		jobs = parallel_workers(njobs);
+
+	while (done < njobs) {
+		while (running < jobs && next < njobs) {
+			if (! runner_start(&js[next], self)) {
+				printf("FAIL  %s  (couldn't start)\n", js[next].path);
+
+				if (js[next].out)
+					fclose(js[next].out);
+				js[next].pid = 0;
+				js[next].out = NULL;
+
+				failed ++;
+				done ++;
+			} else {
+				running ++;
+			}
+			next ++;
+		}
+		if (running == 0)
+			continue;
+
+		int   status;
+		pid_t pid = wait(&status);
+
+		if (pid < 0)
+			break;
+
+		for (int i = 0; i < next; i++) {
+			struct job *j = &js[i];
+
+			if (j->pid != pid)
+				continue;
+
+			j->pid     = 0;
+			j->elapsed = now() - j->started;
+			j->status  = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+			printf("%s  %s  (%.2fs)\n", j->status == 0 ? "PASS" : "FAIL", j->path, j->elapsed);
+
+			if (j->status != 0) {
+				runner_report(j);
+				failed ++;
+			}
+			fclose(j->out);
+			j->out = NULL;
+
+			running --;
+			done ++;
+		}
+	}
+	printf("%d passed, %d failed, in %.2fs\n", njobs - failed, failed, now() - started);
+
+	for (int i = 0; i < njobs; i++)
+		free(js[i].path);
+	free(js);
+
+	return failed;
+}
@@ -0,0 +1,5 @@
+//
+// runner.h
+// running test recordings in parallel
+//
+int              runner(const char *, const char *, int);
@@ -0,0 +1,16 @@
+#version 330 core
+
+in      vec2       coord;
+out     vec4       fragColor;
+
+uniform sampler2D  sampler;     // Copy of the tile being adjusted
+uniform vec3       adjustment;  // Hue rotation in turns, and saturation and
+                                // lightness changes, from -1 to 1
+
+void main()
+{
+	vec4 c = texelFetch(sampler, ivec2(floor(coord)), 0);
+
+	// Transparent pixels are left as they are.
+	fragColor = c.a > 0.0 ? vec4(adjust(c.rgb, adjustment), c.a) : c;
+}
@@ -0,0 +1,44 @@
+// Color functions shared by the fragment shaders. This is prepended to each
+// of them by `shader_load`, right after their `#version` line.
+
+vec3 rgb2hsl(vec3 c)
+{
+	float mx = max(max(c.r, c.g), c.b);
+	float mn = min(min(c.r, c.g), c.b);
+	float l  = (mx + mn) / 2.0;
+	float d  = mx - mn;
+
+	if (d == 0.0)
+		return vec3(0.0, 0.0, l);
+
+	float s = l > 0.5 ? d / (2.0 - mx - mn) : d / (mx + mn);
+	float h;
+
+	if      (c.r == mx) h = (c.g - c.b) / d + (c.g < c.b ? 6.0 : 0.0);
+	else if (c.g == mx) h = (c.b - c.r) / d + 2.0;
+	else                h = (c.r - c.g) / d + 4.0;
+
+	return vec3(h / 6.0, s, l);
+}
+
+vec3 hsl2rgb(vec3 c)
+{
+	vec3 k = clamp(abs(mod(c.x * 6.0 + vec3(0.0, 4.0, 2.0), 6.0) - 3.0) - 1.0, 0.0, 1.0);
+
+	return c.z + c.y * (k - 0.5) * (1.0 - abs(2.0 * c.z - 1.0));
+}
+
+// Move a saturation or lightness value towards 1 by `amount` when it's
+// positive, or towards 0 when it's negative.
+float towards(float v, float amount)
+{
+	return amount > 0.0 ? v + (1.0 - v) * amount : v * (1.0 + amount);
+}
+
+// Must match `rgba_adjust` in color.c.
+vec3 adjust(vec3 c, vec3 a)
+{
+	vec3 h = rgb2hsl(c);
+
+	return hsl2rgb(vec3(fract(h.x + a.x), towards(h.y, a.y), towards(h.z, a.z)));
+}
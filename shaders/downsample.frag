@@ -0,0 +1,34 @@
+#version 330 core
+
+in      vec2       coord;
+out     vec4       fragColor;
+
+uniform sampler2DArray sampler; // Only the level above the one drawn is sampled
+uniform int        layer;
+uniform bool       indexed;     // Whether texels are palette indices
+
+// Average each 2x2 block of texels of the level above. Colors are weighted
+// by their alpha, so that transparent texels don't darken their neighbours.
+// Indices can't be averaged, so they are point sampled instead.
+void main()
+{
+	ivec2 p   = ivec2(floor(coord)) * 2;
+	vec4  sum = vec4(0.0);
+
+	if (indexed) {
+		fragColor = texelFetch(sampler, ivec3(p, layer), 0);
+		return;
+	}
+
+	for (int y = 0; y < 2; y++) {
+		for (int x = 0; x < 2; x++) {
+			vec4 c = texelFetch(sampler, ivec3(p + ivec2(x, y), layer), 0);
+			sum += vec4(c.rgb * c.a, c.a);
+		}
+	}
+	if (sum.a == 0.0) {
+		fragColor = vec4(0.0);
+		return;
+	}
+	fragColor = vec4(sum.rgb / sum.a, sum.a / 4.0);
+}
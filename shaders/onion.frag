@@ -0,0 +1,86 @@
+#version 330 core
+
+in      vec2       coord;
+out     vec4       fragColor;
+
+const int  MAX_DEPTH = 16;      // Must match MAX_ONION_DEPTH
+const int  LOWRES    = 3;       // Must match TILE_LOWRES
+
+uniform sampler2DArray sampler;
+uniform sampler2DArray lowres;  // Low resolution copies of the tiles
+uniform sampler2D  lut;         // Colors of an indexed view
+uniform bool       indexed;     // Whether texels are indices into `lut`
+uniform float      zoom;
+uniform int        level;       // Mip level to sample, when zoomed out
+uniform vec2       size;        // Frame size, in pixels
+uniform int        prev;        // Number of previous frames to show
+uniform int        next;        // Number of next frames to show
+uniform int        slot;        // Frame slot of the current frame
+uniform vec2       origin;      // Origin of the tile within the frame, in texels
+uniform int        prevlayers[MAX_DEPTH]; // Layers of the previous frames, nearest first,
+uniform int        nextlayers[MAX_DEPTH]; // or -1 where the tile isn't resident
+uniform int        prevcells[MAX_DEPTH];  // Cells of `lowres` holding copies of the
+uniform int        nextcells[MAX_DEPTH];  // tiles instead, or -1
+uniform float      opacity;     // Opacity of the nearest frames
+uniform float      falloff;     // Opacity multiplier for each further frame
+uniform vec4       prevtint;    // Tint of previous frames, with the amount in alpha
+uniform vec4       nexttint;    // Tint of next frames, with the amount in alpha
+
+// Composite `src` over `dst`, neither of which are premultiplied.
+vec4 over(vec4 src, vec4 dst)
+{
+	float a = src.a + dst.a * (1.0 - src.a);
+
+	if (a == 0.0)
+		return vec4(0.0);
+
+	return vec4((src.rgb * src.a + dst.rgb * dst.a * (1.0 - src.a)) / a, a);
+}
+
+// Fetch a texel of the low resolution copy of a tile, as in overlay.frag.
+vec4 coarse(ivec2 tc, int cell)
+{
+	ivec2 size = textureSize(lowres, 0).xy;
+	ivec2 cs   = size >> LOWRES;
+	ivec2 n    = size / cs;
+	int   i    = cell % (n.x * n.y);
+	ivec2 at   = ivec2(i % n.x, i / n.x) * cs;
+
+	return texelFetch(lowres, ivec3(at + min(tc >> LOWRES, cs - 1), cell / (n.x * n.y)), 0);
+}
+
+vec4 ghost(ivec2 px, int layer, int cell, float alpha, vec4 tint)
+{
+	if (layer < 0 && cell < 0)
+		return vec4(0.0);
+
+	ivec2 fs = ivec2(size);
+	ivec2 tc = ivec2(px.x, fs.y - 1 - px.y) - ivec2(origin);
+	vec4  c  = layer >= 0
+	         ? texelFetch(sampler, ivec3(min(tc >> level, textureSize(sampler, level).xy - 1), layer), level)
+	         : coarse(tc, cell);
+
+	if (indexed)
+		c = texelFetch(lut, ivec2(int(c.r * 255.0 + 0.5), 0), 0);
+
+	return vec4(mix(c.rgb, tint.rgb, tint.a), c.a * alpha);
+}
+
+void main()
+{
+	ivec2 px    = ivec2(floor(floor(coord) / zoom)) - ivec2(slot * int(size.x), 0);
+	vec4  c     = vec4(0.0);
+	int   depth = max(prev, next);
+
+	// Composite from the furthest frames to the nearest, so that nearer
+	// frames end up on top.
+	for (int i = depth; i >= 1; i--) {
+		float alpha = opacity * pow(falloff, float(i - 1));
+
+		if (i <= next)
+			c = over(ghost(px, nextlayers[i - 1], nextcells[i - 1], alpha, nexttint), c);
+		if (i <= prev)
+			c = over(ghost(px, prevlayers[i - 1], prevcells[i - 1], alpha, prevtint), c);
+	}
+	fragColor = c;
+}
@@ -0,0 +1,145 @@
+#version 330 core
+
+in      vec2       coord;
+out     vec4       fragColor;
+
+uniform sampler2DArray sampler;
+uniform sampler2DArray lowres;  // Low resolution copies of the tiles
+uniform sampler2D  lut;         // Colors of an indexed view
+uniform bool       indexed;     // Whether texels are indices into `lut`
+uniform float      zoom;
+uniform int        level;       // Mip level to sample, when zoomed out
+uniform vec2       size;        // Frame size, in pixels
+uniform int        nframes;     // Number of frames in the view
+uniform int        slot;        // Frame slot covered by this pass
+uniform int        layer;       // Layer holding the tile covered, or -1
+uniform int        cell;        // Cell of `lowres` holding its copy instead, or -1
+uniform vec2       origin;      // Origin of the tile within the frame, in texels
+uniform vec2       flip;
+uniform bool       checker;
+uniform vec2       grid;        // Grid cell size, in pixels
+uniform vec4       selection;   // Selection rect, in pixels
+uniform vec4       border;
+uniform vec4       separator;
+uniform vec4       gridcolor;
+uniform vec4       selcolor;
+uniform vec3       adjustment;  // Pending adjustment, as in adjust.frag
+uniform vec4       adjustarea;  // Area previewing the adjustment, in pixels
+
+const int  LOWRES        = 3;   // Must match TILE_LOWRES
+const int  CHECKER_SIZE  = 8;
+const vec4 CHECKER_LIGHT = vec4(0.467, 0.467, 0.467, 1.0);
+const vec4 CHECKER_DARK  = vec4(0.4, 0.4, 0.4, 1.0);
+
+// Composite `src` over `dst`, neither of which are premultiplied.
+vec4 over(vec4 src, vec4 dst)
+{
+	float a = src.a + dst.a * (1.0 - src.a);
+
+	if (a == 0.0)
+		return vec4(0.0);
+
+	return vec4((src.rgb * src.a + dst.rgb * dst.a * (1.0 - src.a)) / a, a);
+}
+
+// Fetch a texel of the low resolution copy of a tile, held in the given
+// cell. Cells are packed row by row in each layer. `tc` is in tile texels.
+vec4 coarse(ivec2 tc, int cell)
+{
+	ivec2 size = textureSize(lowres, 0).xy;
+	ivec2 cs   = size >> LOWRES;
+	ivec2 n    = size / cs;
+	int   i    = cell % (n.x * n.y);
+	ivec2 at   = ivec2(i % n.x, i / n.x) * cs;
+
+	return texelFetch(lowres, ivec3(at + min(tc >> LOWRES, cs - 1), cell / (n.x * n.y)), 0);
+}
+
+// Get the color of a texel of the tile covered, given in tile texels. Levels
+// smaller than a texel in either direction are clamped. Empty tiles of
+// indexed views hold index zero.
+vec4 texel(ivec2 tc)
+{
+	vec4 c = vec4(0.0);
+
+	if (layer >= 0)
+		c = texelFetch(sampler, ivec3(min(tc >> level, textureSize(sampler, level).xy - 1), layer), level);
+	else if (cell >= 0)
+		c = coarse(tc, cell);
+
+	return indexed ? texelFetch(lut, ivec2(int(c.r * 255.0 + 0.5), 0), 0) : c;
+}
+
+bool line(int p, int step)
+{
+	return step > 0 && p > 0 && p % step == 0;
+}
+
+// Whether screen pixel `p` is the first one of a new cell of `step` texels.
+// Unlike `line`, this works when zoomed out.
+bool edge(int p, int step)
+{
+	if (step <= 0 || p <= 0)
+		return false;
+
+	return int(floor(float(p) / zoom)) / step != int(floor(float(p - 1) / zoom)) / step;
+}
+
+void main()
+{
+	ivec2 p   = ivec2(floor(coord));
+	ivec2 fs  = ivec2(size);
+	ivec2 vs  = ivec2(fs.x * nframes, fs.y);
+	ivec2 ext = ivec2(ceil(vec2(vs) * zoom));
+
+	// The overlay extends one pixel past the view on each side, for the border.
+	if (p.x < 0 || p.y < 0 || p.x >= ext.x || p.y >= ext.y) {
+		fragColor = border;
+		return;
+	}
+	vec4 c = vec4(0.0);
+
+	if (checker) {
+		ivec2 square = p / CHECKER_SIZE;
+		c = (square.x + square.y) % 2 == 0 ? CHECKER_LIGHT : CHECKER_DARK;
+	}
+
+	ivec2 px = ivec2(floor(vec2(p) / zoom));
+
+	// Position within the frame. When the view is flipped horizontally,
+	// the frame order is reversed by the caller, through `layer`.
+	px.x -= slot * fs.x;
+
+	if (flip.x > 0.5) px.x = fs.x - 1 - px.x;
+	if (flip.y > 0.5) px.y = fs.y - 1 - px.y;
+
+	// Pixels on the border, outside of the frame, are left alone.
+	ivec2 tc = ivec2(px.x, fs.y - 1 - px.y) - ivec2(origin);
+
+	if (all(greaterThanEqual(px, ivec2(0))) && all(lessThan(px, fs))) {
+		vec4  t = texel(tc);
+		ivec2 v = ivec2(floor(vec2(p) / zoom));
+
+		if (t.a > 0.0 && all(greaterThanEqual(v, ivec2(adjustarea.xy))) && all(lessThan(v, ivec2(adjustarea.zw))))
+			t.rgb = adjust(t.rgb, adjustment);
+
+		c = over(t, c);
+	}
+
+	// The selection grid is only shown at high zoom levels, which are whole.
+	int   z   = int(zoom);
+	ivec2 q   = p - ivec2(selection.xy) * z;
+	ivec2 sel = ivec2(selection.zw - selection.xy) * z;
+
+	if (all(greaterThanEqual(q, ivec2(0))) && all(lessThan(q, sel)) &&
+	    (line(q.x, z) || line(q.y, z)))
+		c = over(selcolor, c);
+
+	if (edge(p.x, int(grid.x)) || edge(p.y, int(grid.y)))
+		c = over(gridcolor, c);
+
+	if (edge(p.x, fs.x))
+		c = over(separator, c);
+
+	fragColor = c;
+}
@@ -0,0 +1,15 @@
+#version 330 core
+
+uniform mat4 ortho;
+uniform mat4 transform;
+uniform vec4 area;
+
+layout(location = 0) in vec2 vertex;
+
+out vec2 coord;
+
+void main()
+{
+	coord       = area.xy + vertex * area.zw;
+	gl_Position = ortho * transform * vec4(coord, 0.0, 1.0);
+}
@@ -0,0 +1,25 @@
+#version 330 core
+
+in      vec2       coord;
+out     vec4       fragColor;
+
+uniform sampler2D  sampler;     // Copy of the tile being recolored
+uniform sampler2D  lut;         // Colors to replace in the first row, and
+                                // their replacements in the second
+uniform int        count;       // Number of colors to replace
+
+// Replace each texel matching a color of the table by its replacement.
+// Colors are compared as bytes, so that only exact matches are replaced.
+void main()
+{
+	vec4  c = texelFetch(sampler, ivec2(floor(coord)), 0);
+	ivec4 k = ivec4(round(c * 255.0));
+
+	for (int i = 0; i < count; i++) {
+		if (ivec4(round(texelFetch(lut, ivec2(i, 0), 0) * 255.0)) == k) {
+			c = texelFetch(lut, ivec2(i, 1), 0);
+			break;
+		}
+	}
+	fragColor = c;
+}
@@ -119,6 +119,10 @@ bool spritebatch_init(
 	glGenVertexArrays(1, &sb->vao);
 	glGenBuffers(1, &sb->vbo);
 
+	gl_bind_vertex_array(sb->vao);
+	gl_bind_buffer(sb->vbo);
+	gl_vertex_attribs(8);
+
 	sb->tex   = tex;
 	sb->len   = 0;
 	sb->cap   = SPRITEBATCH_INITIAL_SIZE;
@@ -146,8 +150,8 @@ inline size_t spritebatch_size(struct spritebatch *sb)
 
 void spritebatch_release(struct spritebatch *sb)
 {
-	glDeleteBuffers(1, &sb->vbo);
-	glDeleteVertexArrays(1, &sb->vao);
+	gl_delete_buffer(sb->vbo);
+	gl_delete_vertex_array(sb->vao);
 
 	free(sb->data);
 }
@@ -198,17 +202,10 @@ void spritebatch_reset(struct spritebatch *sb)
 
 static inline void spritebatch_bind(struct spritebatch *sb)
 {
-	if (sb) {
-		glBindVertexArray(sb->vao);
-		glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
-
-		texture_bind(sb->tex);
-		return;
-	}
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gl_bind_vertex_array(sb->vao);
+	gl_bind_buffer(sb->vbo);
 
-	texture_bind(NULL);
+	texture_bind(sb->tex);
 }
 
 static inline size_t spritebatch_vertices(struct spritebatch *sb)
@@ -223,53 +220,24 @@ static inline void spritebatch_upload(struct spritebatch *sb)
 	 * are represented in the shader as two vec4's. */
 	size_t size = spritebatch_vertices(sb) * sizeof(struct vertex);
 	glBufferData(GL_ARRAY_BUFFER, size, sb->data, GL_DYNAMIC_DRAW);
+	gl_stats.buffers ++;
 }
 
 void spritebatch_draw(struct spritebatch *sb, struct context *ctx)
 {
 	int nverts = (int)spritebatch_vertices(sb);
 
-	ctx_program(ctx, "texture");
+	ctx_program(ctx, PROGRAM_TEXTURE);
 
 	// TODO: (perf) Why do we upload the buffer data every time we draw?
 	// Upload data to video memory
 	spritebatch_bind(sb);
 	spritebatch_upload(sb);
 
-	vec4_t bcolor = ctx->blend.color;
-
-	// TODO: Look into using `glVertexAttribFormat` to separate the format
-	// and source of the vertex array.
-	// See: https://www.khronos.org/opengl/wiki/Vertex_Specification
-
-	glEnable(GL_BLEND);
-	glBlendColor(bcolor.r, bcolor.g, bcolor.b, bcolor.a);
-	glBlendFunc(ctx->blend.sfactor, ctx->blend.dfactor);
-	glEnableVertexAttribArray(VERTEX_ATTR);
-	glEnableVertexAttribArray(MULTIPLY_ATTR);
-	glVertexAttribPointer(
-		VERTEX_ATTR,                                  // Vertex attribute location
-		4,                                            // Number of vertex components
-		GL_FLOAT,                                     // Type
-		GL_FALSE,                                     // Normalized?
-		sizeof(struct vertex),                        // Stride
-		(void*)0                                      // Offset
-	);
-	glVertexAttribPointer(
-		MULTIPLY_ATTR,
-		4,
-		GL_FLOAT,
-		GL_FALSE,
-		sizeof(struct vertex),
-		(void*)offsetof(struct vertex, color)
-	);
-	glDrawArrays(GL_TRIANGLES, 0, nverts);                // Draw from vertex 0 to N
-	glDisableVertexAttribArray(VERTEX_ATTR);
-	glDisableVertexAttribArray(MULTIPLY_ATTR);
-	glDisable(GL_BLEND);
+	ctx_prepare(ctx);
+	gl_draw_triangles(nverts);
 
-	spritebatch_bind(NULL);
-	ctx_program(ctx, NULL);
+	ctx_program(ctx, PROGRAM_NONE);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
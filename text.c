@@ -40,8 +40,8 @@ void font_free(struct font *f)
 {
 	texture_free(f->tex);
 
-	glDeleteVertexArrays(1, &f->vao);
-	glDeleteBuffers(1, &f->vbo);
+	gl_delete_vertex_array(f->vao);
+	gl_delete_buffer(f->vbo);
 
 	free(f);
 }
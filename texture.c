@@ -11,6 +11,7 @@
 #include "texture.h"
 #include "color.h"
 #include "tga.h"
+#include "gl.h"
 #include "program.h"
 #include "assert.h"
 #include "util.h"
@@ -32,12 +33,12 @@ struct texture *texture_load(const char *path, GLint format)
 	return tx;
 }
 
-struct texture *texture_read(rect_t r)
+struct texture *texture_read(rect_t r, GLint format)
 {
 	int w = rect_w(&r);
 	int h = rect_h(&r);
 
-	struct texture *t = texture(NULL, w, h, GL_RGBA);
+	struct texture *t = texture(NULL, w, h, format);
 
 	texture_bind(t);
 
@@ -59,11 +60,10 @@ struct texture *texture_read(rect_t r)
 void texture_bind(struct texture *t)
 {
 	if (t) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, t->handle);
-		glBindSampler(0, t->sampler); // Bind sampler to texture unit 0
+		gl_bind_texture(0, t->handle);
+		gl_bind_sampler(0, t->sampler); // Bind sampler to texture unit 0
 	} else {
-		glBindTexture(GL_TEXTURE_2D, 0);
+		gl_bind_texture(0, 0);
 	}
 }
 
@@ -82,19 +82,29 @@ GLuint gen_sampler(GLuint minFilter, GLuint magFilter)
 	return sampler;
 }
 
+int texture_max_size(void)
+{
+	static GLint size;
+
+	if (! size)
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+
+	return size;
+}
+
 // TODO: Change argument order.
 struct texture *texture(const void *pixels, int w, int h, GLint format)
 {
 	struct texture *t = malloc(sizeof(*t));
 
-	assert(w <= 4096 && h <= 4096);
+	assert(w <= texture_max_size() && h <= texture_max_size());
 
 	t->sampler = gen_sampler(GL_NEAREST, GL_NEAREST);
 	t->w       = w;
 	t->h       = h;
 
 	glGenTextures(1, &t->handle);
-	glBindTexture(GL_TEXTURE_2D, t->handle);
+	gl_bind_texture(0, t->handle);
 
 	glTexImage2D(
 		GL_TEXTURE_2D,
@@ -106,15 +116,27 @@ struct texture *texture(const void *pixels, int w, int h, GLint format)
 		GL_UNSIGNED_BYTE,     // Data type of the components
 		pixels                // Data
 	);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	gl_bind_texture(0, 0);
+
+	if (pixels)
+		gl_stats.uploads ++;
 
 	return t;
 }
 
+/* Replace the pixels of an area of a texture. */
+void texture_update(struct texture *t, int x, int y, int w, int h, const void *pixels)
+{
+	gl_bind_texture(0, t->handle);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	gl_stats.uploads ++;
+	gl_bind_texture(0, 0);
+}
+
 void texture_free(struct texture *t)
 {
-	glDeleteTextures(1, &t->handle);
-	glDeleteSamplers(1, &t->sampler);
+	gl_delete_texture(t->handle);
+	gl_delete_sampler(t->sampler);
 
 	free(t);
 }
@@ -10,10 +10,12 @@ struct texture {
 };
 
 GLuint gen_sampler(GLuint minFilter, GLuint magFilter);
+int    texture_max_size(void);
 
 struct texture *texture(const void *pixels, int w, int h, GLint format);
 struct texture *texture_load(const char *path, GLint format);
-struct texture *texture_read(rect_t);
+struct texture *texture_read(rect_t, GLint);
+void            texture_update(struct texture *, int, int, int, int, const void *);
 void            texture_repeat(float, float);
 void            texture_free(struct texture *);
 void            texture_bind(struct texture *);
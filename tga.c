@@ -5,15 +5,59 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include "util.h"
 #include "color.h"
+#include "trace.h"
 #include "tga.h"
 
-#define TGA_TYPE_UNCOMPRESSED_RGB 2
+#define TGA_TYPE_UNCOMPRESSED_MAPPED 1
+#define TGA_TYPE_UNCOMPRESSED_RGB    2
 
-bool tga_load(struct tga *t, const char *path)
+/* Read the color map of a color-mapped image, whose entries are stored as
+ * BGR or BGRA. Entries before the first one stored are transparent. */
+static bool tga_load_colormap(struct tga *t, FILE *fp)
+{
+	size_t bytes = (size_t)t->header.colormapdepth / 8;
+	int    first = t->header.colormapoff,
+	       len   = t->header.colormaplen;
+	rgba_t p     = {0, 0, 0, 255};
+
+	if ((bytes != 3 && bytes != 4) || first < 0 || len < 0 || first + len > 256)
+		return false;
+
+	memset(t->colormap, 0, sizeof(t->colormap));
+
+	for (int i = 0; i < len; i++) {
+		if (! fread(&p, bytes, 1, fp))
+			return false;
+
+		t->colormap[first + i] = rgba(p.b, p.g, p.r, p.a);
+	}
+	t->ncolors = first + len;
+
+	return true;
+}
+
+/* Read the pixels of a color-mapped image, and look up their colors. */
+static bool tga_load_indices(struct tga *t, FILE *fp)
+{
+	size_t n = (size_t)t->width * (size_t)t->height;
+
+	t->indices = malloc(n);
+
+	if (t->depth != 8 || fread(t->indices, 1, n, fp) != n)
+		return false;
+
+	for (size_t i = 0; i < n; i++)
+		t->data[i] = t->colormap[t->indices[i]];
+
+	return true;
+}
+
+static bool tga_read(struct tga *t, const char *path)
 {
 	FILE *fp = fopen(path, "rb");
 
@@ -35,11 +79,28 @@ bool tga_load(struct tga *t, const char *path)
 
 	infof("tga", "decode %s %hdx%hdx%d, type %d", path, t->width, t->height, t->depth, t->header.imagetype);
 
-	if (t->header.imagetype != TGA_TYPE_UNCOMPRESSED_RGB) {
+	t->indices = NULL;
+	t->ncolors = 0;
+
+	if (t->header.imagetype != TGA_TYPE_UNCOMPRESSED_RGB &&
+	    t->header.imagetype != TGA_TYPE_UNCOMPRESSED_MAPPED) {
+		fclose(fp);
 		return false;
 	}
+	fseek(fp, (unsigned char)t->header.idlen, SEEK_CUR);
 
 	t->data = calloc((size_t)t->width * (size_t)t->height, sizeof(rgba_t));
+	t->size = t->width * t->height * sizeof(rgba_t);
+
+	if (t->header.imagetype == TGA_TYPE_UNCOMPRESSED_MAPPED) {
+		bool ok = tga_load_colormap(t, fp) && tga_load_indices(t, fp);
+
+		fclose(fp);
+
+		if (! ok)
+			tga_release(t);
+		return ok;
+	}
 
 	size_t bytes = (size_t)t->depth / 8;
 	rgba_t p;
@@ -51,15 +112,21 @@ bool tga_load(struct tga *t, const char *path)
 		}
 		t->data[i] = rgba(p.b, p.g, p.r, p.a);
 	}
-	t->size = t->width * t->height * sizeof(rgba_t);
-
 	fclose(fp);
 
 	return true;
 }
 
+bool tga_load(struct tga *t, const char *path)
+{
+	trace_begin("io", "tga_load");
+	bool ok = tga_read(t, path);
+	trace_end("io", "tga_load");
+
+	return ok;
+}
 
-int tga_save(rgba_t *pixels, size_t w, size_t h, char depth, const char *path)
+static int tga_write(rgba_t *pixels, size_t w, size_t h, char depth, const char *path)
 {
 	FILE *fp = fopen(path, "wb");
 
@@ -101,7 +168,70 @@ int tga_save(rgba_t *pixels, size_t w, size_t h, char depth, const char *path)
 	return 0;
 }
 
+int tga_save(rgba_t *pixels, size_t w, size_t h, char depth, const char *path)
+{
+	trace_begin("io", "tga_save");
+	int err = tga_write(pixels, w, h, depth, path);
+	trace_end("io", "tga_save");
+
+	return err;
+}
+
+static int tga_write_indexed(const uint8_t *indices, size_t w, size_t h, const rgba_t *colormap, int ncolors, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+
+	if (!fp)
+		return 1;
+
+	short null  = 0x0;
+	short len   = (short)ncolors;
+	char  depth = 8;
+
+	fputc(0, fp);  // ID length
+	fputc(1, fp);  // Color map
+	fputc(TGA_TYPE_UNCOMPRESSED_MAPPED, fp);
+
+	fwrite(&null, 2, 1, fp);  // Color map offset
+	fwrite(&len, 2, 1, fp);   // Color map length
+	fputc(32, fp);            // Color map entry size
+	fwrite(&null, 2, 1, fp);  // X
+	fwrite(&null, 2, 1, fp);  // Y
+	fwrite(&w, 2, 1, fp);     // Width
+	fwrite(&h, 2, 1, fp);     // Height
+	fwrite(&depth, 1, 1, fp); // Depth
+	fwrite(&null, 1, 1, fp);  // Image descriptor
+
+	for (int i = 0; i < ncolors; i++) {
+		rgba_t p = rgba(colormap[i].b, colormap[i].g, colormap[i].r, colormap[i].a);
+
+		if (! fwrite(&p, sizeof(p), 1, fp)) {
+			fclose(fp);
+			return 1;
+		}
+	}
+	if (fwrite(indices, 1, w * h, fp) != w * h) {
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/* Save a color-mapped image, with a 32-bit color map of `ncolors` entries
+ * and a byte per pixel. */
+int tga_save_indexed(const uint8_t *indices, size_t w, size_t h, const rgba_t *colormap, int ncolors, const char *path)
+{
+	trace_begin("io", "tga_save");
+	int err = tga_write_indexed(indices, w, h, colormap, ncolors, path);
+	trace_end("io", "tga_save");
+
+	return err;
+}
+
 void tga_release(struct tga *t)
 {
 	free(t->data);
+	free(t->indices);
 }
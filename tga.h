@@ -18,8 +18,14 @@ struct tga {
 	char                    depth;
 	size_t                  size;
 	rgba_t                 *data;
+
+	/* Color-mapped images also keep their pixels as color map indices. */
+	uint8_t                *indices;
+	rgba_t                  colormap[256];
+	int                     ncolors;
 };
 
 bool    tga_load(struct tga *t, const char *path);
 int     tga_save(rgba_t *data, size_t w, size_t h, char depth, const char *path);
+int     tga_save_indexed(const uint8_t *indices, size_t w, size_t h, const rgba_t *colormap, int ncolors, const char *path);
 void    tga_release(struct tga *t);
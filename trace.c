@@ -0,0 +1,156 @@
+//
+// trace.c
+// timeline capture, written as Chrome trace events
+//
+// Each thread records events into its own ring, so recording doesn't take
+// any locks. A thread claims a ring on its first event, and gives it back
+// when it exits, for later threads to reuse, since workers are started
+// anew for each parallel task. When a ring is full, its oldest events are
+// overwritten.
+//
+// A capture is only started and stopped from the main thread, while no
+// workers are running, so `trace_on` needn't be atomic, and rings can be
+// read once it's stopped. Captures are written in the JSON format read by
+// `chrome://tracing` and Perfetto.
+//
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+struct tracering {
+	struct traceevent   events[TRACE_EVENTS];
+	unsigned long       len;       /* Events recorded since the capture started */
+	atomic_bool         busy;      /* Whether a thread owns the ring */
+	struct tracering   *next;
+};
+
+bool trace_on = false;
+
+static _Atomic(struct tracering *)     rings;
+static atomic_int                      threads;
+static double                          epoch;
+static pthread_key_t                   key;
+static pthread_once_t                  once = PTHREAD_ONCE_INIT;
+static _Thread_local struct tracering *ring;
+static _Thread_local int               tid;
+
+static double trace_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (double)t.tv_sec * 1e6 + (double)t.tv_nsec / 1e3;
+}
+
+/* Called when a thread which claimed a ring exits. */
+static void trace_release(void *r)
+{
+	atomic_store(&((struct tracering *)r)->busy, false);
+}
+
+static void trace_key(void)
+{
+	pthread_key_create(&key, trace_release);
+}
+
+/* Claim a ring for the calling thread, reusing one if possible. */
+static struct tracering *trace_claim(void)
+{
+	struct tracering *r;
+
+	for (r = atomic_load(&rings); r; r = r->next) {
+		bool busy = false;
+
+		if (atomic_compare_exchange_strong(&r->busy, &busy, true))
+			break;
+	}
+	if (! r) {
+		if (! (r = calloc(1, sizeof(*r))))
+			return NULL;
+
+		atomic_init(&r->busy, true);
+		r->next = atomic_load(&rings);
+
+		while (! atomic_compare_exchange_weak(&rings, &r->next, r))
+			;
+	}
+	pthread_setspecific(key, r);
+
+	return r;
+}
+
+/* Start a capture. Returns false if one is already running. */
+bool trace_start(void)
+{
+	if (trace_on)
+		return false;
+
+	pthread_once(&once, trace_key);
+
+	for (struct tracering *r = atomic_load(&rings); r; r = r->next)
+		r->len = 0;
+
+	epoch    = trace_now();
+	trace_on = true;
+
+	return true;
+}
+
+/* Stop the capture, and write it to `path`. Returns the number of events
+ * written, or -1 on error, in which case the capture keeps running, so that
+ * it can be written elsewhere. */
+long trace_stop(const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (! fp)
+		return -1;
+
+	long n = 0;
+
+	trace_on = false;
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+
+	for (struct tracering *r = atomic_load(&rings); r; r = r->next) {
+		unsigned long first = r->len > TRACE_EVENTS ? r->len - TRACE_EVENTS : 0;
+
+		for (unsigned long i = first; i < r->len; i++) {
+			struct traceevent *e = &r->events[i % TRACE_EVENTS];
+
+			fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+				n++ ? ",\n" : "", e->name, e->cat, e->ph, e->ts, e->tid);
+		}
+	}
+	fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	if (fclose(fp) != 0) {
+		trace_on = true;
+		return -1;
+	}
+	return n;
+}
+
+void _trace_event(const char *cat, const char *name, char ph)
+{
+	if (! ring && ! (ring = trace_claim()))
+		return;
+	if (! tid)
+		tid = atomic_fetch_add(&threads, 1) + 1;
+
+	struct traceevent *e = &ring->events[ring->len++ % TRACE_EVENTS];
+
+	e->cat  = cat;
+	e->name = name;
+	e->ph   = ph;
+	e->tid  = tid;
+	e->ts   = trace_now() - epoch;
+}
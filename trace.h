@@ -0,0 +1,24 @@
+//
+// trace.h
+// timeline capture, written as Chrome trace events
+//
+#define TRACE_EVENTS     (1 << 16)  /* Events kept per thread */
+
+struct traceevent {
+	const char      *cat;
+	const char      *name;
+	double           ts;        /* Time since the capture started, in microseconds */
+	int              tid;
+	char             ph;        /* 'B' at the beginning of a span, 'E' at its end */
+};
+
+extern bool      trace_on;
+
+bool             trace_start(void);
+long             trace_stop(const char *);
+void            _trace_event(const char *, const char *, char);
+
+/* Spans must begin and end on the same thread, and nest. While no capture
+ * is running, they cost a branch. */
+#define trace_begin(cat, name)  do { if (trace_on) _trace_event(cat, name, 'B'); } while (0)
+#define trace_end(cat, name)    do { if (trace_on) _trace_event(cat, name, 'E'); } while (0)
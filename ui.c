@@ -8,10 +8,10 @@
 #include "color.h"
 #include "text.h"
 #include "gl.h"
+#include "program.h"
 #include "ctx.h"
 #include "ui.h"
 #include "polygon.h"
-#include "program.h"
 
 void ui_drawbox(struct context *ctx, rect_t r, int w, rgba_t color)
 {
@@ -51,12 +51,12 @@ void ui_drawbox(struct context *ctx, rect_t r, int w, rgba_t color)
 	struct polygon p = polygon(verts, 6 * 4, 2);
 	vec4_t vcolor = rgba2vec4(color);
 
-	ctx_program(ctx, "constant");
+	ctx_program(ctx, PROGRAM_CONSTANT);
 
 	/* TODO: Should be set somewhere else */
-	set_uniform_vec4(ctx->program, "color", &vcolor);
+	set_uniform_vec4(ctx->program, UNIFORM_COLOR, &vcolor);
 	polygon_draw(ctx, &p);
 	polygon_release(&p);
 
-	ctx_program(ctx, NULL);
+	ctx_program(ctx, PROGRAM_NONE);
 }